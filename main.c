@@ -7,7 +7,7 @@
 #define IO_IMPLEMENTATION
 #include "src/io.h"
 
-bool get_title_uppercase(char *name, char buffer[MAX_PATH]) {
+bool get_title_uppercase(char *name, char buffer[IO_MAX_PATH]) {
 
   char *p = strrchr(name, '.');
   if(!p) {
@@ -32,8 +32,8 @@ bool get_title_uppercase(char *name, char buffer[MAX_PATH]) {
 }
 
 typedef struct{
-  char name[MAX_PATH];
-  char path[MAX_PATH];
+  char name[IO_MAX_PATH];
+  char path[IO_MAX_PATH];
 }Component;
 
 #define COMPONENTS_CAP 48
@@ -45,16 +45,9 @@ int main() {
 
   //OPEN
   const char *output = "libstd.h";
+  const char *cache_path = "libstd.h.cache";
 
-  Io_File f;
-  if(!io_file_open(&f, output, IO_MODE_WRITE)) {
-    panicf("Can not open: '%s': (%d) %s\n",
-	   output, io_last_error(), io_last_error_cstr());
-  }
-
-  char temp[8192];
-  size_t temp_size = 0;
-  char name[MAX_PATH];
+  char name[IO_MAX_PATH];
 
   //FOR EVERY FILE IN ...
   const char *source_dir = "thirdparty/";
@@ -99,99 +92,142 @@ int main() {
 
   io_dir_close(&dir);
 
+  //SKIP, IF NOTHING CHANGED
+
+  Io_Cache cache;
+  if(!io_cache_load(&cache, cache_path)) {
+    panicf("Can not load: '%s'", cache_path);
+  }
+
+  bool changed = false;
+  for(size_t i=0;i<components_count + 2;i++) {
+    const char *path = i < components_count ? components[i].path : i == components_count ? __FILE__ : output;
+
+    bool path_changed;
+    if(!io_cache_check(&cache, path, &path_changed)) {
+      panicf("Can not read: '%s': (%d) %s",
+	     path, io_last_error(), io_last_error_cstr());
+    }
+    changed = changed || path_changed;
+  }
+  //A component was removed
+  changed = io_cache_prune(&cache) > 0 || changed;
+
+  if(!changed) {
+    //Touched, but unchanged files get their new stamps
+    if(!io_cache_save(&cache)) {
+      panicf("Can not save: '%s'", cache_path);
+    }
+    io_cache_free(&cache);
+    return 0;
+  }
 
   //PROCESS
 
-  io_file_write_cstr(&f, "#ifndef LIBSTD_H\n");
-  io_file_write_cstr(&f, "#define LIBSTD_H\n\n");
+  //The old libstd.h stays, until the new one is complete
+  Io_Commit commit;
+  io_commit_init(&commit, false);
+  Io_File *f = io_commit_open(&commit, output);
+  if(!f) {
+    panicf("Can not open: '%s': (%d) %s\n",
+	   output, io_last_error(), io_last_error_cstr());
+  }
+
+  Io_Writer w;
+  if(!io_writer_init(&w, f, NULL, 0)) {
+    panicf("Can not allocate the output buffer");
+  }
+
+
+  io_writer_write_cstr(&w, "#ifndef LIBSTD_H\n");
+  io_writer_write_cstr(&w, "#define LIBSTD_H\n\n");
 
   // _ENABLE
 
   for(size_t i=0;i<components_count;i++) {
     Component *c = &components[i];
 
-    temp_size = snprintf(temp, sizeof(temp), "// #define %s_ENABLE\n", c->name);
-    assert(temp_size < sizeof(temp));
-
-    io_file_write(&f, temp, temp_size, 1);
+    io_writer_printf(&w, "// #define %s_ENABLE\n", c->name);
   }
 
-  io_file_write_cstr(&f, "\n");
+  io_writer_write_cstr(&w, "\n");
 
   //  _IMPLEMENTATION
 
-  io_file_write_cstr(&f, "#ifdef LIBSTD_IMPLEMENTATION\n");
+  io_writer_write_cstr(&w, "#ifdef LIBSTD_IMPLEMENTATION\n");
 
   for(size_t i=0;i<components_count;i++) {
     Component *c = &components[i];
 
-    temp_size = snprintf(temp, sizeof(temp), "#  define %s_IMPLEMENTATION\n", c->name);
-    assert(temp_size < sizeof(temp));
-
-    io_file_write(&f, temp, temp_size, 1);
+    io_writer_printf(&w, "#  define %s_IMPLEMENTATION\n", c->name);
   }
 
-  io_file_write_cstr(&f, "#endif // LIBSTD_IMPLEMENTATION\n\n");
+  io_writer_write_cstr(&w, "#endif // LIBSTD_IMPLEMENTATION\n\n");
 
   //  _DEF
 
-  io_file_write_cstr(&f, "#ifdef LIBSTD_DEF\n");
+  io_writer_write_cstr(&w, "#ifdef LIBSTD_DEF\n");
 
   for(size_t i=0;i<components_count;i++) {
     Component *c = &components[i];
 
-    temp_size = snprintf(temp, sizeof(temp), "#  define %s_DEF LIBSTD_DEF\n", c->name);
-    assert(temp_size < sizeof(temp));
-
-    io_file_write(&f, temp, temp_size, 1);
+    io_writer_printf(&w, "#  define %s_DEF LIBSTD_DEF\n", c->name);
   }  
   
-  io_file_write_cstr(&f, "#endif // LIBSTD_DEF\n\n");
+  io_writer_write_cstr(&w, "#endif // LIBSTD_DEF\n\n");
 
   // *CONTENT*
-  temp_size = 0;
   for(size_t i=0;i<components_count;i++) {
     Component *c = &components[i];
 
-    unsigned char *data;
-    size_t size;
-    if(!io_slurp_file(c->path, &data, &size)) {
-      return 1;
+    Io_Mapping m;
+    if(!io_mapping_open(&m, c->path)) {
+      panicf("Can not open: '%s': (%d) %s",
+	     c->path, io_last_error(), io_last_error_cstr());
     }
+    io_mapping_advise(&m, 0, m.size, IO_ADVICE_SEQUENTIAL);
 
-    io_file_write_cstr(&f, "#ifdef ");
-    io_file_write_cstr(&f, c->name);
-    io_file_write_cstr(&f, "_ENABLE\n\n");
+    io_writer_write_cstr(&w, "#ifdef ");
+    io_writer_write_cstr(&w, c->name);
+    io_writer_write_cstr(&w, "_ENABLE\n\n");
     
-    //Fix \r\n's
-    for(size_t j=0;j<size;j++) {
-
-      if(temp_size == sizeof(temp))  {
-	io_file_write(&f, temp, temp_size, 1);
-	temp_size = 0;
+    //Fix \r\n's: Everything between the '\r's is written straight from the mapping
+    unsigned char *data = m.data;
+    unsigned char *end = m.data + m.size;
+    while(data < end) {
+      unsigned char *cr = memchr(data, '\r', end - data);
+      size_t len = (cr ? cr : end) - data;
+      if(len > 0) {
+	io_writer_write(&w, data, len);
       }
-      
-      if(data[j] == '\r') continue;
-      temp[temp_size++] = data[j];     
+      data += len + (cr ? 1 : 0);
     }
 
-    if(temp_size > 0) {
-      io_file_write(&f, temp, temp_size, 1);
-      temp_size = 0;
-    }
+    io_mapping_close(&m);
 
-    io_file_write_cstr(&f, "#endif // ");
-    io_file_write_cstr(&f, c->name);
-    io_file_write_cstr(&f, "_DISABLE\n\n");
+    io_writer_write_cstr(&w, "#endif // ");
+    io_writer_write_cstr(&w, c->name);
+    io_writer_write_cstr(&w, "_DISABLE\n\n");
   }
 
-  if(temp_size > 0) {
-    io_file_write(&f, temp, temp_size, 1);
+  io_writer_write_cstr(&w, "#endif // LIBSTD_H\n");
+
+  if(!io_writer_flush(&w)) {
+    panicf("Can not write: '%s': (%d) %s",
+	   output, io_last_error(), io_last_error_cstr());
   }
+  io_writer_free(&w);
 
-  io_file_write_cstr(&f, "#endif // LIBSTD_H\n");
-  
-  io_file_close(&f);  
+  if(!io_commit_finish(&commit)) {
+    panicf("Can not replace: '%s': (%d) %s",
+	   output, io_last_error(), io_last_error_cstr());
+  }
+
+  bool output_changed;
+  if(!io_cache_check(&cache, output, &output_changed) || !io_cache_save(&cache)) {
+    panicf("Can not save: '%s'", cache_path);
+  }
+  io_cache_free(&cache);
   
   return 0;
   
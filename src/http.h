@@ -13,6 +13,62 @@
 #  define HTTP_ENTRY_SIZE 2048
 #endif // HTTP_ENTRY_SIZE
 
+#ifndef HTTP_PIPELINE_CAP
+#  define HTTP_PIPELINE_CAP 64
+#endif // HTTP_PIPELINE_CAP
+
+#ifndef HTTP_ENGINE_EVENTS_CAP
+#  define HTTP_ENGINE_EVENTS_CAP 256
+#endif // HTTP_ENGINE_EVENTS_CAP
+
+// An Http_Engine_Task fails, if its connection makes no progress for this long
+#ifndef HTTP_ENGINE_TIMEOUT_MS
+#  define HTTP_ENGINE_TIMEOUT_MS 30000
+#endif // HTTP_ENGINE_TIMEOUT_MS
+
+// How often http_engine_poll checks for hostnames, that are resolved on a thread
+#ifndef HTTP_ENGINE_RESOLVE_POLL_MS
+#  define HTTP_ENGINE_RESOLVE_POLL_MS 5
+#endif // HTTP_ENGINE_RESOLVE_POLL_MS
+
+#ifndef HTTP_SERVER_HEADERS_CAP
+#  define HTTP_SERVER_HEADERS_CAP 64
+#endif // HTTP_SERVER_HEADERS_CAP
+
+#ifndef HTTP_SERVER_TIMEOUT_MS
+#  define HTTP_SERVER_TIMEOUT_MS 5000
+#endif // HTTP_SERVER_TIMEOUT_MS
+
+#ifndef HTTP_DNS_TTL_MS
+#  define HTTP_DNS_TTL_MS 60000
+#endif // HTTP_DNS_TTL_MS
+
+#ifndef HTTP_DNS_CACHE_CAP
+#  define HTTP_DNS_CACHE_CAP 64
+#endif // HTTP_DNS_CACHE_CAP
+
+#ifndef HTTP_DNS_ADDRESSES_CAP
+#  define HTTP_DNS_ADDRESSES_CAP 8
+#endif // HTTP_DNS_ADDRESSES_CAP
+
+// Delay before the next address is tried, while the previous is still connecting (RFC 8305)
+#ifndef HTTP_HAPPY_EYEBALLS_MS
+#  define HTTP_HAPPY_EYEBALLS_MS 250
+#endif // HTTP_HAPPY_EYEBALLS_MS
+
+#ifndef HTTP_TLS_SESSIONS_CAP
+#  define HTTP_TLS_SESSIONS_CAP 64
+#endif // HTTP_TLS_SESSIONS_CAP
+
+// Bytes per read/splice, when a body is written to a file
+#ifndef HTTP_BODY_READ_SIZE
+#  define HTTP_BODY_READ_SIZE (1 << 20)
+#endif // HTTP_BODY_READ_SIZE
+
+#ifndef HTTP_IOV_CAP
+#  define HTTP_IOV_CAP 64
+#endif // HTTP_IOV_CAP
+
 #ifndef HTTP_LOG
 #  ifdef HTTP_QUIET
 #    define HTTP_LOG(...)
@@ -34,6 +90,17 @@
 #  include <netdb.h>
 #  include <arpa/inet.h>
 #  include <unistd.h>
+#  include <errno.h>
+#  include <time.h>
+#  include <pthread.h>
+#  include <fcntl.h>
+#  include <sys/epoll.h>
+#  include <sys/stat.h>
+#  include <sys/sendfile.h>
+#  include <sys/uio.h>
+#  include <poll.h>
+#  include <sys/syscall.h>
+#  include <netinet/tcp.h>
 #endif
 
 #ifdef HTTP_OPEN_SSL
@@ -70,6 +137,14 @@ typedef struct {
 #include <stdarg.h>
 #include <assert.h>
 #include <string.h>
+#include <limits.h>
+
+// A request, which was sent and waits for its response
+typedef struct{
+  bool head; // the response to a HEAD-request has no body, even if it specifies one
+  uint64_t started_at, sent_at;
+  uint64_t bytes_sent;
+}Http_Pending;
 
 typedef struct{
 #ifdef _WIN32
@@ -87,21 +162,122 @@ typedef struct{
 #endif // HTTP_WIN32_SSL
   
   const char *hostname;
+  uint16_t port;
+  bool use_ssl;
+  bool would_block; // the last read failed, because a non-blocking socket had no data
+
+  // Keep-Alive, Pipelining
+  bool keep_alive;
+  size_t pending, pending_pos;
+  Http_Pending pending_requests[HTTP_PIPELINE_CAP];
+
+  // Instrumentation, see: Http_Timings
+  uint64_t dns_ns, connect_ns, tls_ns;
+  uint64_t bytes_sent, bytes_received, reads, writes;
+  uint64_t bytes_sent_mark;
 }Http;
 
+typedef struct{
+  const void *data;
+  size_t len;
+}Http_Buffer;
+
 HTTP_DEF bool http_init(const char* hostname, uint16_t port, bool use_ssl, Http *http);
 
 HTTP_DEF bool http_socket_write(const char *data, size_t size, void *http);
+HTTP_DEF bool http_socket_writev(Http *http, Http_Buffer *buffers, size_t buffers_len);
 HTTP_DEF bool http_socket_read(char *data, size_t size, void *http, size_t *read);
 
 HTTP_DEF bool http_socket_connect_tls(Http *http, const char *hostname);
 
+typedef struct{
+  uint64_t handshakes;
+  uint64_t resumed; // abbreviated handshakes, because a cached session was accepted
+  uint64_t full;
+  uint64_t handshake_ns;
+}Http_Tls_Stats;
+
+// With HTTP_OPEN_SSL the sessions (and TLS 1.3 tickets) are cached per 'hostname:port' and
+// offered on the next connect, so the server can skip the full handshake.
+HTTP_DEF void http_tls_get_stats(Http_Tls_Stats *stats);
+HTTP_DEF void http_tls_flush_sessions();
+
 HTTP_DEF bool http_socket_connect_plain(Http *http, const char *hostname, uint16_t port);
+HTTP_DEF bool http_socket_address(const char *hostname, uint16_t port, struct sockaddr_in *addr);
 HTTP_DEF bool http_socket_write_plain(const char *data, size_t size, void *_http);
 HTTP_DEF bool http_socket_read_plain(char *buffer, size_t buffer_size, void *_http, size_t *read);
 
 HTTP_DEF void http_free(Http *http);
 
+//////////////////////////////////////////////////////////////////////////////////////////////
+
+// Addresses alternate between IPv6 and IPv4, starting with the family getaddrinfo prefers
+typedef struct{
+  struct sockaddr_storage addrs[HTTP_DNS_ADDRESSES_CAP];
+  socklen_t addrs_len[HTTP_DNS_ADDRESSES_CAP];
+  size_t len;
+}Http_Addresses;
+
+typedef struct{
+  uint64_t hits;
+  uint64_t misses;
+  uint64_t failures;
+  uint64_t prefetches;
+  uint64_t resolve_ns; // time spent in getaddrinfo
+}Http_Resolver_Stats;
+
+// Resolves through an in-process cache. getaddrinfo does not report the TTL of a record,
+// so every entry lives for HTTP_DNS_TTL_MS.
+HTTP_DEF bool http_resolve(const char *hostname, uint16_t port, Http_Addresses *addresses);
+// Fills the cache on a background-thread, the next http_resolve for 'hostname' will not block
+HTTP_DEF bool http_resolve_async(const char *hostname);
+HTTP_DEF void http_resolver_flush();
+HTTP_DEF void http_resolver_get_stats(Http_Resolver_Stats *stats);
+// Happy Eyeballs: Starts the next connect every HTTP_HAPPY_EYEBALLS_MS, first connection wins
+HTTP_DEF bool http_socket_connect_addresses(Http *http, Http_Addresses *addresses);
+
+#define HTTP_REQUEST_STATE_DONE -2
+#define HTTP_REQUEST_STATE_ERROR -1
+#define HTTP_REQUEST_STATE_IDLE 0
+#define HTTP_REQUEST_STATE_R    1
+#define HTTP_REQUEST_STATE_RN   2
+#define HTTP_REQUEST_STATE_RNR  3
+#define HTTP_REQUEST_STATE_BODY 4
+#define HTTP_REQUEST_STATE_HEADER 5
+
+#define HTTP_REQUEST_BODY_NONE 0
+#define HTTP_REQUEST_BODY_CONTENT_LEN 1
+#define HTTP_REQUEST_BODY_CHUNKED 2
+#define HTTP_REQUEST_BODY_INFO 3
+#define HTTP_REQUEST_BODY_CLOSE 4
+
+#define HTTP_REQUEST_ENCODING_NONE 0
+#define HTTP_REQUEST_ENCODING_GZIP 1
+#define HTTP_REQUEST_ENCODING_DEFLATE 2
+
+// With HTTP_MINIZ (and miniz being available), responses are requested compressed and
+// http_next_body hands out the inflated bytes
+#ifdef HTTP_MINIZ
+#  define HTTP_ACCEPT_ENCODING "Accept-Encoding: gzip, deflate\r\n"
+#else
+#  define HTTP_ACCEPT_ENCODING ""
+#endif // HTTP_MINIZ
+
+// Measured for every response. dns_ns, connect_ns and tls_ns are only set for the first
+// response on a connection. A pipelined response, which was already buffered, has a short ttfb_ns.
+typedef struct{
+  uint64_t dns_ns;
+  uint64_t connect_ns;
+  uint64_t tls_ns;     // handshake
+  uint64_t send_ns;    // head and body
+  uint64_t ttfb_ns;    // request sent -> status-line received
+  uint64_t body_ns;    // headers received -> body received
+  uint64_t total_ns;   // request started -> body received
+  uint64_t bytes_sent; // TLS: plaintext bytes
+  uint64_t bytes_received;
+  uint64_t reads;      // recv/SSL_read/splice calls
+}Http_Timings;
+
 typedef struct{
   Http *http;
 
@@ -112,19 +288,40 @@ typedef struct{
   // Parsing
   char key[HTTP_ENTRY_SIZE];
   size_t key_len;
-  char value[HTTP_ENTRY_SIZE];
-  size_t value_len;
-  int body, state, state2, pair;
+  int body, state, state2;
   size_t content_read;
   bool chunked_debug;
+  bool head;
+  int encoding; // Content-Encoding
+
+#ifdef HTTP_MINIZ
+  mz_stream inflate;
+  int inflate_state;
+  bool inflate_more;
+  int gzip_step, gzip_pos;
+  size_t gzip_skip;
+  unsigned char gzip_flags;
+  char inflated[HTTP_BUFFER_SIZE];
+#endif // HTTP_MINIZ
+
+  // Server
+  bool server; // parse a request-line instead of a status-line
+  char line[HTTP_ENTRY_SIZE];
+  char *method, *route;
+  size_t method_len, route_len;
 
   // Info
   bool ok;
   int response_code;
   size_t content_length;
+
+  Http_Timings timings;
+  uint64_t started_at, sent_at, headers_at;
+  uint64_t bytes_received_mark, reads_mark;
   
 }Http_Request;
 
+// Points into the receive-buffer and stays valid until the next call to http_next_header
 typedef struct{
   char *key, *value;
   size_t key_len, value_len;
@@ -137,6 +334,66 @@ HTTP_DEF bool http_request_from(Http *http, const char *route, const char *metho
 HTTP_DEF bool http_next_header(Http_Request *r, Http_Header *entry);
 HTTP_DEF bool http_next_body(Http_Request *r, char **data, size_t *data_len);
 
+// Body-bytes are read straight from the socket into 'dst' (up to 'dst_cap' per call). Only
+// bytes, which were already buffered with the headers, are copied.
+HTTP_DEF bool http_next_body_into(Http_Request *r, char *dst, size_t dst_cap, size_t *data_len);
+
+#ifdef _WIN32
+typedef HANDLE Http_File;
+#else
+typedef int Http_File;
+#endif // _WIN32
+
+// Writes the rest of the body to 'file' (for example Io_File.fd / Io_File.handle). On linux the
+// bytes of a plain connection never enter userspace (splice). 'read_size' of 0 means HTTP_BODY_READ_SIZE.
+HTTP_DEF bool http_body_to_fd(Http_Request *r, Http_File file, size_t read_size, uint64_t *written);
+HTTP_DEF bool http_body_to_file(Http_Request *r, const char *filepath, size_t read_size, uint64_t *written);
+
+// Pipelining: http_request_send any number (up to HTTP_PIPELINE_CAP) of requests, then
+// http_request_begin for the first response and http_request_next for every following one.
+HTTP_DEF bool http_request_send(Http *http, const char *route, const char *method,
+				const char *headers,
+				const unsigned char *body, size_t body_len,
+				char *buffer, size_t buffer_cap);
+HTTP_DEF bool http_request_begin(Http *http, Http_Request *request);
+
+// The head is formatted into 'buffer' and sent together with the body-buffers in one writev.
+// The body is never copied.
+HTTP_DEF bool http_request_sendv(Http *http, const char *route, const char *method,
+				 const char *headers,
+				 Http_Buffer *body, size_t body_count,
+				 char *buffer, size_t buffer_cap);
+HTTP_DEF bool http_request_send_file(Http *http, const char *route, const char *method,
+				     const char *headers, const char *filepath,
+				     char *buffer, size_t buffer_cap);
+// 'body' is one of HTTP_REQUEST_BODY_NONE, HTTP_REQUEST_BODY_CONTENT_LEN or HTTP_REQUEST_BODY_CHUNKED
+HTTP_DEF bool http_request_head(Http *http, const char *route, const char *method,
+				const char *headers, int body, uint64_t content_length,
+				char *buffer, size_t buffer_cap, size_t *head_len);
+
+// Streaming uploads with 'Transfer-Encoding: chunked'. Either push the body with
+// http_request_chunked_begin, http_request_chunk (any number of times) and http_request_chunked_end,
+// or let http_request_send_stream pull it from a producer, until it reports a length of 0.
+typedef bool (*Http_Body_Producer)(void *userdata, char *buffer, size_t buffer_cap, size_t *len);
+
+HTTP_DEF bool http_request_chunked_begin(Http *http, const char *route, const char *method,
+					 const char *headers, char *buffer, size_t buffer_cap);
+HTTP_DEF bool http_request_chunk(Http *http, const void *data, size_t len);
+HTTP_DEF bool http_request_chunked_end(Http *http);
+HTTP_DEF bool http_request_send_stream(Http *http, const char *route, const char *method,
+				       const char *headers,
+				       Http_Body_Producer producer, void *userdata,
+				       char *buffer, size_t buffer_cap);
+HTTP_DEF bool http_request_next(Http_Request *request);
+HTTP_DEF void http_request_reset(Http_Request *request);
+// Releases the decoder of a compressed response, that was not read until the end
+HTTP_DEF void http_request_free(Http_Request *request);
+HTTP_DEF void http_request_finish(Http_Request *request);
+HTTP_DEF bool http_reusable(Http *http);
+HTTP_DEF bool http_parse_request_line(Http_Request *request, char *line, size_t line_len);
+HTTP_DEF bool http_parse_status_line(Http_Request *request, char *line, size_t line_len);
+HTTP_DEF size_t http_scan_line(const char *data, size_t data_len, size_t *colon);
+
 HTTP_DEF bool http_maybe_init_external_libs();
 
 HTTP_DEF bool http_parse_u64(char *buffer, size_t buffer_len, uint64_t *out);
@@ -145,6 +402,37 @@ HTTP_DEF bool http_header_eq(const char *key, size_t key_len, const char *value,
 
 //////////////////////////////////////////////////////////////////////////////////////////////
 
+// Log-linear buckets (like HdrHistogram): every power of two is split into
+// 2^HTTP_HISTOGRAM_SUB_BITS buckets, so a value is reported at most 1/16 too high.
+// Recording is lock-free and can happen on any thread.
+#define HTTP_HISTOGRAM_SUB_BITS 4
+#define HTTP_HISTOGRAM_BUCKETS ((64 - HTTP_HISTOGRAM_SUB_BITS + 1) << HTTP_HISTOGRAM_SUB_BITS)
+
+typedef struct{
+  uint64_t counts[HTTP_HISTOGRAM_BUCKETS];
+  uint64_t count, sum, max;
+}Http_Histogram;
+
+HTTP_DEF void http_histogram_record(Http_Histogram *h, uint64_t value);
+// 'q' is in [0, 1], for example 0.99. Returns the highest value of the bucket.
+HTTP_DEF uint64_t http_histogram_quantile(Http_Histogram *h, double q);
+HTTP_DEF void http_histogram_reset(Http_Histogram *h);
+
+// Every finished response (of Http_Request, Http_Pool or Http_Engine) is recorded in the
+// process-wide Http_Metrics. Phases, that did not happen (dns_ns on a reused connection) are skipped.
+typedef struct{
+  Http_Histogram dns, connect, tls, send, ttfb, body, total; // ns
+  Http_Histogram bytes_sent, bytes_received, reads;
+}Http_Metrics;
+
+HTTP_DEF Http_Metrics *http_metrics();
+HTTP_DEF void http_metrics_record(Http_Timings *timings);
+HTTP_DEF void http_metrics_reset();
+// Prints count, p50, p90, p99, p999, max and mean of every histogram
+HTTP_DEF void http_metrics_dump(FILE *f);
+
+//////////////////////////////////////////////////////////////////////////////////////////////
+
 typedef bool (*Http_Sendf_Callback)(const char *data, size_t size, void *userdata);
 
 typedef struct{
@@ -163,6 +451,314 @@ HTTP_DEF size_t http_sendf_impl_send(Http_Sendf_Context *context, size_t *buffer
 HTTP_DEF size_t http_sendf_impl_copy(Http_Sendf_Context *context, size_t buffer_size,
 				     const char *cstr, size_t cstr_len, size_t *cstr_off);
 
+//////////////////////////////////////////////////////////////////////////////////////////////
+
+#ifdef _WIN32
+typedef CRITICAL_SECTION Http_Mutex;
+typedef CONDITION_VARIABLE Http_Cond;
+#else
+typedef pthread_mutex_t Http_Mutex;
+typedef pthread_cond_t Http_Cond;
+#endif // _WIN32
+
+HTTP_DEF void http_mutex_init(Http_Mutex *mutex);
+HTTP_DEF void http_mutex_lock(Http_Mutex *mutex);
+HTTP_DEF void http_mutex_unlock(Http_Mutex *mutex);
+HTTP_DEF void http_mutex_free(Http_Mutex *mutex);
+
+HTTP_DEF void http_cond_init(Http_Cond *cond);
+HTTP_DEF void http_cond_wait(Http_Cond *cond, Http_Mutex *mutex);
+HTTP_DEF void http_cond_broadcast(Http_Cond *cond);
+HTTP_DEF void http_cond_free(Http_Cond *cond);
+
+HTTP_DEF uint64_t http_now_ns();
+HTTP_DEF bool http_socket_alive(Http *http);
+
+//////////////////////////////////////////////////////////////////////////////////////////////
+
+typedef struct Http_Pool_Conn Http_Pool_Conn;
+
+struct Http_Pool_Conn{
+  Http http; // must be the first member, see: http_pool_release
+  char *hostname; // 'hostname', 'port' and 'use_ssl' are only accessed under the lock
+  uint16_t port;
+  bool use_ssl;
+  bool connected;
+  bool busy;
+  uint64_t idle_since;
+  Http_Pool_Conn *next;
+};
+
+typedef struct{
+  uint64_t hits;     // served by an idle connection
+  uint64_t misses;   // had to open a new connection
+  uint64_t waits;    // had to wait, because 'max_per_host' was reached
+  uint64_t wait_ns;  // total time spent waiting
+  uint64_t wait_ns_max;
+  uint64_t evictions; // idle connections closed after 'idle_timeout'
+  uint64_t invalid;   // idle connections, that were closed by the server
+  size_t idle, busy;
+}Http_Pool_Stats;
+
+typedef struct{
+  Http_Mutex mutex;
+  Http_Cond cond;
+
+  Http_Pool_Conn *conns;
+  size_t max_per_host;
+  uint64_t idle_timeout_ns;
+
+  Http_Pool_Stats stats;
+}Http_Pool;
+
+HTTP_DEF void http_pool_init(Http_Pool *pool, size_t max_per_host, uint64_t idle_timeout_ms);
+HTTP_DEF bool http_pool_acquire(Http_Pool *pool, const char *hostname, uint16_t port, bool use_ssl, Http **http);
+HTTP_DEF void http_pool_release(Http_Pool *pool, Http *http);
+HTTP_DEF void http_pool_evict(Http_Pool *pool);
+HTTP_DEF void http_pool_get_stats(Http_Pool *pool, Http_Pool_Stats *stats);
+HTTP_DEF void http_pool_free(Http_Pool *pool);
+
+//////////////////////////////////////////////////////////////////////////////////////////////
+
+// http_download asks with a HEAD-request for the size, then 'connections' threads fetch
+// ranges of HTTP_DOWNLOAD_RANGE_SIZE bytes over connections of 'pool' and write them at
+// their offset. Finished ranges are recorded in '<filepath>.part', so an interrupted
+// download continues where it stopped, as long as the size and the ETag/Last-Modified of
+// the resource did not change. Servers without 'Accept-Ranges: bytes' are downloaded over
+// one connection.
+
+#ifndef HTTP_DOWNLOAD_RANGE_SIZE
+#  define HTTP_DOWNLOAD_RANGE_SIZE (8 << 20)
+#endif // HTTP_DOWNLOAD_RANGE_SIZE
+
+#ifndef HTTP_DOWNLOAD_RETRIES
+#  define HTTP_DOWNLOAD_RETRIES 3
+#endif // HTTP_DOWNLOAD_RETRIES
+
+typedef struct{
+  uint64_t size;
+  uint64_t downloaded; // by this call
+  uint64_t resumed;    // by a previous, interrupted call
+  size_t ranges;
+  size_t retries;
+  size_t connections;
+  uint64_t elapsed_ns;
+}Http_Download_Stats;
+
+// 'stats' can be NULL
+HTTP_DEF bool http_download(Http_Pool *pool, const char *hostname, uint16_t port, bool use_ssl,
+			    const char *route, const char *filepath, size_t connections,
+			    Http_Download_Stats *stats);
+
+//////////////////////////////////////////////////////////////////////////////////////////////
+
+// Http_Engine multiplexes many requests on non-blocking sockets on one thread (epoll).
+// Every callback runs on the thread calling http_engine_poll. The parsing is done by
+// http_next_header/http_next_body, which resume where they stopped once more data arrives.
+// A hostname, that is not cached yet, is resolved on a thread, so http_engine_submit does not block.
+
+typedef bool (*Http_Engine_On_Body)(void *userdata, Http_Request *request, char *data, size_t data_len);
+typedef void (*Http_Engine_On_Done)(void *userdata, Http_Request *request, bool ok);
+
+#define HTTP_ENGINE_STATE_CONNECTING 0
+#define HTTP_ENGINE_STATE_SENDING 1
+#define HTTP_ENGINE_STATE_RECEIVING 2
+#define HTTP_ENGINE_STATE_RESOLVING 3
+
+typedef struct Http_Engine_Task Http_Engine_Task;
+typedef struct Http_Engine_Resolve Http_Engine_Resolve;
+
+struct Http_Engine_Task{
+  Http http;
+  Http_Request request;
+  int state;
+
+  char *send;
+  size_t send_len, send_cap, send_pos;
+  const unsigned char *body;
+  size_t body_len, body_pos;
+  uint64_t connect_at;
+  uint64_t deadline; // the last progress + HTTP_ENGINE_TIMEOUT_MS
+
+  // A refused connect moves on to the next address
+  Http_Addresses addresses;
+  size_t address;
+
+  Http_Engine_Resolve *resolve; // while HTTP_ENGINE_STATE_RESOLVING
+  Http_Engine_Task *resolve_next;
+
+  Http_Engine_On_Body on_body;
+  Http_Engine_On_Done on_done;
+  void *userdata;
+
+  Http_Engine_Task *prev, *next;
+};
+
+// A hostname, that is resolved on a thread, while its tasks wait
+struct Http_Engine_Resolve{
+  char *hostname;
+  Http_Addresses addresses; // valid, once 'done'
+  bool done, ok;            // accessed with __atomic_*
+  int refs;                 // the engine and the thread
+  Http_Engine_Task *tasks;
+  Http_Engine_Resolve *next;
+};
+
+typedef struct{
+  int epoll;
+  // Every submitted task, until 'on_done' was called. Ordered by 'deadline', the first one expires first.
+  Http_Engine_Task *tasks, *tasks_last;
+  Http_Engine_Resolve *resolves;
+  size_t active;
+  uint64_t completed, failed;
+}Http_Engine;
+
+HTTP_DEF bool http_engine_init(Http_Engine *engine);
+// 'body' must stay valid until 'on_done' was called
+HTTP_DEF bool http_engine_submit(Http_Engine *engine, const char *hostname, uint16_t port,
+				 const char *route, const char *method, const char *headers,
+				 const unsigned char *body, size_t body_len,
+				 Http_Engine_On_Body on_body, Http_Engine_On_Done on_done, void *userdata);
+HTTP_DEF size_t http_engine_poll(Http_Engine *engine, int timeout_ms);
+HTTP_DEF void http_engine_run(Http_Engine *engine);
+// Tasks, that are still in flight, fail with 'on_done(false)'
+HTTP_DEF void http_engine_free(Http_Engine *engine);
+
+//////////////////////////////////////////////////////////////////////////////////////////////
+
+// Http_Server accepts connections on an epoll instance, which is shared by all workers.
+// Start one or more workers with: thread_create(&id, http_server_worker, &server).
+// A connection is handled by one worker at a time (EPOLLONESHOT). The request-head is received
+// without blocking, the worker only parses it with http_next_header and calls the handler, once
+// the head is complete. A head, that takes longer than HTTP_SERVER_TIMEOUT_MS, closes the connection.
+// The handler may read the body with http_next_body(&conn->request, ...) and must respond with
+// http_server_respond*.
+
+typedef struct Http_Server Http_Server;
+typedef struct Http_Server_Conn Http_Server_Conn;
+
+struct Http_Server_Conn{
+  Http http;
+  Http_Request request;
+  Http_Server *server;
+
+  char head[HTTP_BUFFER_SIZE];
+  size_t head_len;
+  Http_Header headers[HTTP_SERVER_HEADERS_CAP];
+  size_t headers_len;
+
+  bool responded;
+  uint64_t head_started; // first byte of an incomplete request-head, 0 if there is none
+
+  Http_Server_Conn *prev, *next;
+};
+
+typedef bool (*Http_Server_Handler)(Http_Server_Conn *conn, void *userdata);
+
+struct Http_Server{
+  int socket;
+  int epoll;
+  uint16_t port;
+
+  Http_Server_Handler handler;
+  void *userdata;
+  bool running; // accessed with __atomic_*
+
+  // Every open connection, closed by http_server_free
+  Http_Mutex conns_mutex;
+  Http_Server_Conn *conns;
+};
+
+// Pass port 0 to bind to any free port, which is stored in 'server->port'. 'hostname' may
+// resolve to IPv4 or IPv6, NULL binds to every interface.
+HTTP_DEF bool http_server_init(Http_Server *server, const char *hostname, uint16_t port,
+			       Http_Server_Handler handler, void *userdata);
+HTTP_DEF void *http_server_worker(void *server);
+HTTP_DEF void http_server_stop(Http_Server *server);
+// Closes the connections, that are still open. Call it, after every worker has returned.
+HTTP_DEF void http_server_free(Http_Server *server);
+
+// 'key' is expected to be lowercase
+HTTP_DEF bool http_server_header(Http_Server_Conn *conn, const char *key, char **value, size_t *value_len);
+HTTP_DEF bool http_server_respond(Http_Server_Conn *conn, int code, const char *headers,
+				  const char *body, size_t body_len);
+// Sends the file with sendfile. A single 'Range' of a 200-response is answered with 206 (or 416).
+HTTP_DEF bool http_server_respond_file(Http_Server_Conn *conn, int code, const char *headers,
+				       const char *filepath);
+HTTP_DEF bool http_server_write(const char *data, size_t size, void *conn);
+HTTP_DEF const char *http_status_text(int code);
+
+//////////////////////////////////////////////////////////////////////////////////////////////
+
+// WebSockets (RFC 6455) on top of an Http connection (plain or TLS). A client upgrades an
+// Http from http_init with http_websocket_connect. A Http_Server handler upgrades its connection
+// with http_websocket_accept and owns it until it returns (the read-timeout of HTTP_SERVER_TIMEOUT_MS
+// stays, so ping the client or read in a loop). With HTTP_MINIZ permessage-deflate (RFC 7692) is
+// negotiated. Control-frames are answered inside of http_websocket_read. Neither side is thread-safe.
+
+#ifndef HTTP_WEBSOCKET_MESSAGE_CAP
+#  define HTTP_WEBSOCKET_MESSAGE_CAP (64 << 20)
+#endif // HTTP_WEBSOCKET_MESSAGE_CAP
+
+// Smaller messages are sent uncompressed
+#ifndef HTTP_WEBSOCKET_DEFLATE_MIN
+#  define HTTP_WEBSOCKET_DEFLATE_MIN 64
+#endif // HTTP_WEBSOCKET_DEFLATE_MIN
+
+#define HTTP_WEBSOCKET_CONTINUATION 0x0
+#define HTTP_WEBSOCKET_TEXT 0x1
+#define HTTP_WEBSOCKET_BINARY 0x2
+#define HTTP_WEBSOCKET_CLOSE 0x8
+#define HTTP_WEBSOCKET_PING 0x9
+#define HTTP_WEBSOCKET_PONG 0xa
+
+typedef struct{
+  Http *http;
+  bool server; // servers do not mask their frames
+  bool deflate; // permessage-deflate was negotiated
+  bool deflate_reset; // no_context_takeover for the messages, that are sent
+  bool close_sent, close_received;
+  uint16_t close_code;
+  uint64_t random;
+
+  char buffer[HTTP_BUFFER_SIZE];
+  size_t buffer_pos, buffer_size;
+
+  // The (fragmented) message, that is received
+  char *message;
+  size_t message_len, message_cap;
+  int message_opcode; // HTTP_WEBSOCKET_CONTINUATION, if no message is started
+  bool message_compressed;
+
+#ifdef HTTP_MINIZ
+  mz_stream inflate, deflate_stream;
+  bool inflate_init, deflate_init;
+  char *decoded, *compressed;
+  size_t decoded_cap, compressed_cap;
+#endif // HTTP_MINIZ
+}Http_Websocket;
+
+// 'headers' are added to the upgrade-request
+HTTP_DEF bool http_websocket_connect(Http *http, const char *route, const char *headers, Http_Websocket *ws);
+// Responds with '101 Switching Protocols', or with '400 Bad Request' if it is no upgrade-request
+HTTP_DEF bool http_websocket_accept(Http_Server_Conn *conn, const char *headers, Http_Websocket *ws);
+// One unfragmented message, compressed if permessage-deflate was negotiated
+HTTP_DEF bool http_websocket_send(Http_Websocket *ws, int opcode, const void *data, size_t len);
+// Fragments: HTTP_WEBSOCKET_TEXT/BINARY first, then HTTP_WEBSOCKET_CONTINUATION, the last with 'fin'
+HTTP_DEF bool http_websocket_send_frame(Http_Websocket *ws, int opcode, bool fin, const void *data, size_t len);
+// Blocks until the next complete text- or binary-message. 'data' stays valid until the next call.
+// Returns false, after the peer closed the connection (see: 'close_code') or on errors.
+HTTP_DEF bool http_websocket_read(Http_Websocket *ws, int *opcode, char **data, size_t *len);
+HTTP_DEF bool http_websocket_close(Http_Websocket *ws, uint16_t code);
+// Does not close the Http
+HTTP_DEF void http_websocket_free(Http_Websocket *ws);
+
+// XORs 'data' with 'mask', as if 'data' started 'offset' bytes into the payload
+HTTP_DEF void http_websocket_mask(char *data, size_t len, const unsigned char mask[4], size_t offset);
+HTTP_DEF void http_sha1(const void *data, size_t len, unsigned char out[20]);
+// Writes 4 * ((len + 2) / 3) characters and a NUL to 'out'
+HTTP_DEF void http_base64_encode(const unsigned char *data, size_t len, char *out);
+
 #ifdef HTTP_IMPLEMENTATION
 
 #ifdef _WIN32
@@ -181,15 +777,114 @@ HTTP_DEF size_t http_sendf_impl_copy(Http_Sendf_Context *context, size_t buffer_
 #  define HTTP_LOG_OS(...)
 #endif // HTTP_QUIET
 
+// WSAStartup and the SSL_CTX are set up once, even if the resolver thread of
+// http_resolve_async and the caller race for the first connection
 #ifdef _WIN32
-static bool http_global_wsa_startup = false;
+static INIT_ONCE http_global_init_once = INIT_ONCE_STATIC_INIT;
+#else
+static pthread_once_t http_global_init_once = PTHREAD_ONCE_INIT;
 #endif //_WIN32
+static bool http_global_init_ok = false;
 
 #ifdef HTTP_OPEN_SSL
 static SSL_CTX *http_global_ssl_context = NULL;
 #endif //HTTP_OPEN_SSL
 
+//////////////////////////////////////////////////////////////////////////////////////////////
+
+static Http_Tls_Stats http_tls_stats = {0};
+
+#ifdef _WIN32
+static SRWLOCK http_tls_mutex = SRWLOCK_INIT;
+#  define http_tls_lock() AcquireSRWLockExclusive(&http_tls_mutex)
+#  define http_tls_unlock() ReleaseSRWLockExclusive(&http_tls_mutex)
+#else
+static pthread_mutex_t http_tls_mutex = PTHREAD_MUTEX_INITIALIZER;
+#  define http_tls_lock() pthread_mutex_lock(&http_tls_mutex)
+#  define http_tls_unlock() pthread_mutex_unlock(&http_tls_mutex)
+#endif // _WIN32
+
+#ifdef HTTP_OPEN_SSL
+
+typedef struct{
+  char key[272]; // 'hostname:port'
+  SSL_SESSION *session;
+  uint64_t used;
+}Http_Tls_Session;
+
+static Http_Tls_Session http_tls_sessions[HTTP_TLS_SESSIONS_CAP];
+static size_t http_tls_sessions_len = 0;
+static uint64_t http_tls_sessions_clock = 0;
+
+// Called by OpenSSL for every new session. With TLS 1.3 this happens after the handshake,
+// when the server sends its tickets. The connection carries its own copy of the key.
+static int http_tls_new_session(SSL *ssl, SSL_SESSION *session) {
+  const char *key = SSL_get_app_data(ssl);
+  if(!key) {
+    return 0;
+  }
+
+  http_tls_lock();
+
+  // Replace the session of the same host, or the least recently used
+  Http_Tls_Session *entry = NULL;
+  for(size_t i=0;i<http_tls_sessions_len;i++) {
+    if(strcmp(http_tls_sessions[i].key, key) == 0) {
+      entry = &http_tls_sessions[i];
+      break;
+    }
+  }
+  if(!entry && http_tls_sessions_len < HTTP_TLS_SESSIONS_CAP) {
+    entry = &http_tls_sessions[http_tls_sessions_len++];
+    entry->session = NULL;
+  }
+  if(!entry) {
+    entry = &http_tls_sessions[0];
+    for(size_t i=1;i<http_tls_sessions_len;i++) {
+      if(http_tls_sessions[i].used < entry->used) entry = &http_tls_sessions[i];
+    }
+  }
+
+  if(entry->session) {
+    SSL_SESSION_free(entry->session);
+  }
+  memcpy(entry->key, key, strlen(key) + 1);
+  entry->session = session;
+  entry->used = ++http_tls_sessions_clock;
+
+  http_tls_unlock();
+
+  // The reference is kept
+  return 1;
+}
+
+#endif // HTTP_OPEN_SSL
+
+HTTP_DEF void http_tls_get_stats(Http_Tls_Stats *stats) {
+  http_tls_lock();
+  *stats = http_tls_stats;
+  http_tls_unlock();
+}
+
+HTTP_DEF void http_tls_flush_sessions() {
+#ifdef HTTP_OPEN_SSL
+  http_tls_lock();
+  for(size_t i=0;i<http_tls_sessions_len;i++) {
+    SSL_SESSION_free(http_tls_sessions[i].session);
+  }
+  http_tls_sessions_len = 0;
+  http_tls_unlock();
+#endif // HTTP_OPEN_SSL
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////
+
 HTTP_DEF bool http_init(const char* hostname, uint16_t port, bool use_ssl, Http *h) {
+
+  *h = HTTP_INVALID;
+#ifdef HTTP_WIN32_SSL
+  h->win32_tls.socket = INVALID_SOCKET;
+#endif // HTTP_WIN32_SSL
   
   size_t hostname_len = strlen(hostname);
   h->hostname = malloc(hostname_len + 1);
@@ -198,29 +893,17 @@ HTTP_DEF bool http_init(const char* hostname, uint16_t port, bool use_ssl, Http
   }
   memcpy((char *) h->hostname, hostname, hostname_len + 1);
 
-  if(!http_maybe_init_external_libs()) {
-    return false;
-  }
+  h->port = port;
+  h->use_ssl = use_ssl;
+  h->keep_alive = true;
+  h->pending = 0;
+  h->pending_pos = 0;
 
-#ifdef _WIN32
-  h->socket = WSASocketW(AF_INET, SOCK_STREAM, IPPROTO_TCP, NULL, 0, 0);
-  if( h->socket == INVALID_SOCKET ) {
-    HTTP_LOG_OS("WSASocketW");
-    HTTP_LOG("Failed to initialize socket");
-    return false;
-  }
-#elif linux
-  h->socket = socket(AF_INET, SOCK_STREAM, 0);
-  if( h->socket == -1) {
-    HTTP_LOG("Failed to initialize socket");
+  if(!http_maybe_init_external_libs()) {
     return false;
   }
-#else
-  HTTP_LOG("Unsupported platform. Implement: http_init");
-  
-  return false;
-#endif // _WIN32
 
+  // The socket is created for the family of the address, that connects first
   if(!http_socket_connect_plain(h, hostname, port)) {
     HTTP_LOG("Can not connect to '%s:%u'", hostname, port);
     return false;
@@ -230,19 +913,12 @@ HTTP_DEF bool http_init(const char* hostname, uint16_t port, bool use_ssl, Http
   h->conn = NULL;
   
   if(use_ssl) {
-    h->conn = SSL_new(http_global_ssl_context);
-    if(!h->conn) {
-      HTTP_LOG("Fatal error using OPEN_SSL");
-      return false;
-    }
-    SSL_set_fd(h->conn, (int) h->socket); // TODO: maybe check this cast
-
-    SSL_set_connect_state(h->conn);
-    SSL_set_tlsext_host_name(h->conn, hostname);
-    if(SSL_connect(h->conn) != 1) {
+    uint64_t start = http_now_ns();
+    if(!http_socket_connect_tls(h, hostname)) {
       HTTP_LOG("Can not connect to '%s:%u' via SSL (OPEN_SSL)", hostname, port);
       return false;
     }
+    h->tls_ns = http_now_ns() - start;
   }  
 #endif // HTTP_OPEN_SSL
 
@@ -252,10 +928,12 @@ HTTP_DEF bool http_init(const char* hostname, uint16_t port, bool use_ssl, Http
   if(use_ssl) {
     h->win32_tls.socket = h->socket;
     
+    uint64_t start = http_now_ns();
     if(!http_socket_connect_tls(h, hostname)) {
       HTTP_LOG("Can not connect to '%s:%u' via SSL (WIN32_SSL)", hostname, port);
       return false;
     }
+    h->tls_ns = http_now_ns() - start;
   }
   
 #endif // HTTP_WIN32_SSL
@@ -270,125 +948,441 @@ HTTP_DEF bool http_init(const char* hostname, uint16_t port, bool use_ssl, Http
   return true;
 }
 
-HTTP_DEF bool http_maybe_init_external_libs() {
+static void http_init_external_libs() {
 #ifdef _WIN32
-  if(!http_global_wsa_startup) {
-    
-    WSADATA wsaData;
-    if(WSAStartup(MAKEWORD(2,2), &wsaData) != 0) {
-      HTTP_LOG("Failed to initialize WSA (ws2_32.lib)\n");
-      return false;
-    }
-    
-    http_global_wsa_startup = true;
+  WSADATA wsaData;
+  if(WSAStartup(MAKEWORD(2,2), &wsaData) != 0) {
+    HTTP_LOG("Failed to initialize WSA (ws2_32.lib)\n");
+    return;
   }
 #endif //_WIN32
 
 #ifdef HTTP_OPEN_SSL
+  SSL_library_init();
+  OpenSSL_add_all_algorithms();
+  http_global_ssl_context = SSL_CTX_new(TLS_client_method());
   if(!http_global_ssl_context) {
-    SSL_library_init();
-    OpenSSL_add_all_algorithms();
-    http_global_ssl_context = SSL_CTX_new(TLS_client_method());
-    if(!http_global_ssl_context) {
-      HTTP_LOG("Failed to initialize SSL (openssl.lib, crypto.lib)\n");
-      return false;
-    }    
-  }
+    HTTP_LOG("Failed to initialize SSL (openssl.lib, crypto.lib)\n");
+    return;
+  }    
+
+  // Sessions are kept in http_tls_sessions, OpenSSL only reports them
+  SSL_CTX_set_session_cache_mode(http_global_ssl_context,
+				 SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+  SSL_CTX_sess_set_new_cb(http_global_ssl_context, http_tls_new_session);
 #endif //HTTP_OPEN_SSL
 
-  return true;
+  http_global_init_ok = true;
 }
 
-HTTP_DEF bool http_socket_connect_plain(Http *http, const char *hostname, uint16_t port) {
+#ifdef _WIN32
+static BOOL CALLBACK http_init_external_libs_once(PINIT_ONCE once, PVOID parameter, PVOID *context) {
+  (void) once;
+  (void) parameter;
+  (void) context;
+  http_init_external_libs();
+  return TRUE;
+}
+#endif //_WIN32
 
+HTTP_DEF bool http_maybe_init_external_libs() {
 #ifdef _WIN32
-  struct addrinfo hints;
-  struct addrinfo* result = NULL;
+  InitOnceExecuteOnce(&http_global_init_once, http_init_external_libs_once, NULL, NULL);
+#else
+  pthread_once(&http_global_init_once, http_init_external_libs);
+#endif //_WIN32
 
-  ZeroMemory(&hints, sizeof(hints));
-  hints.ai_family = AF_INET;
-  hints.ai_socktype = SOCK_STREAM;
-  hints.ai_protocol = IPPROTO_TCP;
+  return http_global_init_ok;
+}
 
-  char port_cstr[6];
-  snprintf(port_cstr, sizeof(port_cstr), "%u", port);
+HTTP_DEF bool http_socket_connect_plain(Http *http, const char *hostname, uint16_t port) {
+  uint64_t start = http_now_ns();
 
-  if(getaddrinfo(hostname, port_cstr, &hints, &result) != 0) {
-    HTTP_LOG_OS("getaddrinfo");
-    freeaddrinfo(result);
+  Http_Addresses addresses;
+  if(!http_resolve(hostname, port, &addresses)) {
+    HTTP_LOG("Can not resolve '%s'", hostname);
     return false;
   }
 
-  bool out = true;
-  if(connect(http->socket, result->ai_addr, (int) result->ai_addrlen) != 0) {
-    HTTP_LOG_OS("connect");
-    out = false;
-  }
-  
-  freeaddrinfo(result);
-
-  return out;
-#elif linux
-  struct sockaddr_in addr = {0};
+  uint64_t resolved = http_now_ns();
+  http->dns_ns = resolved - start;
 
-  struct hostent *hostent = gethostbyname(hostname);
-  if(!hostent) {
+  if(!http_socket_connect_addresses(http, &addresses)) {
     return false;
   }
 
-  in_addr_t in_addr = inet_addr(inet_ntoa(*(struct in_addr*)*(hostent->h_addr_list)));
-  if(in_addr == (in_addr_t) -1) {
-    return false;
-  }
-  addr.sin_addr.s_addr = in_addr;
+  http->connect_ns = http_now_ns() - resolved;
+  return true;
+}
 
-  addr.sin_family = AF_INET;
-  addr.sin_port = htons((u_short) port);
-  if(connect(http->socket, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+HTTP_DEF bool http_socket_address(const char *hostname, uint16_t port, struct sockaddr_in *addr) {
+  Http_Addresses addresses;
+  if(!http_resolve(hostname, port, &addresses)) {
     return false;
   }
 
-  return true;
-#else
+  for(size_t i=0;i<addresses.len;i++) {
+    if(addresses.addrs[i].ss_family == AF_INET) {
+      memcpy(addr, &addresses.addrs[i], sizeof(*addr));
+      return true;
+    }
+  }
 
-  HTTP_LOG("Unsupported platform. Implement: http_socket_connect_plain");
-  
-  (void) http;
-  (void) hostname;
-  (void) port;
   return false;
-#endif
 }
 
-HTTP_DEF void http_free(Http *http) {
+//////////////////////////////////////////////////////////////////////////////////////////////
 
-#ifdef HTTP_OPEN_SSL
-  if(http->conn) {
-    SSL_set_shutdown(http->conn, SSL_RECEIVED_SHUTDOWN | SSL_SENT_SHUTDOWN);
-    SSL_shutdown(http->conn);
-    SSL_free(http->conn);
-    http->conn = NULL;
+typedef struct{
+  char hostname[256];
+  Http_Addresses addresses;
+  uint64_t expires;
+}Http_Resolver_Entry;
+
+static Http_Resolver_Entry http_resolver_cache[HTTP_DNS_CACHE_CAP];
+static size_t http_resolver_cache_len = 0;
+static Http_Resolver_Stats http_resolver_stats = {0};
+
+#ifdef _WIN32
+static SRWLOCK http_resolver_mutex = SRWLOCK_INIT;
+#  define http_resolver_lock() AcquireSRWLockExclusive(&http_resolver_mutex)
+#  define http_resolver_unlock() ReleaseSRWLockExclusive(&http_resolver_mutex)
+#else
+static pthread_mutex_t http_resolver_mutex = PTHREAD_MUTEX_INITIALIZER;
+#  define http_resolver_lock() pthread_mutex_lock(&http_resolver_mutex)
+#  define http_resolver_unlock() pthread_mutex_unlock(&http_resolver_mutex)
+#endif // _WIN32
+
+static void http_addresses_set_port(Http_Addresses *addresses, uint16_t port) {
+  for(size_t i=0;i<addresses->len;i++) {
+    if(addresses->addrs[i].ss_family == AF_INET6) {
+      ((struct sockaddr_in6 *) &addresses->addrs[i])->sin6_port = htons(port);
+    } else {
+      ((struct sockaddr_in *) &addresses->addrs[i])->sin_port = htons(port);
+    }
   }
-#endif // HTTP_OPEN_SSL
+}
 
-#ifdef HTTP_WIN32_SSL
-  if(http->win32_tls.socket != INVALID_SOCKET) {
+static bool http_resolver_lookup(const char *hostname, Http_Addresses *addresses) {
 
-    http_win32_tls_socket *s = &http->win32_tls;
-    DWORD type = SCHANNEL_SHUTDOWN;
+  if(!http_maybe_init_external_libs()) {
+    return false;
+  }
 
-    SecBuffer inbuffers[1];
-    inbuffers[0].BufferType = SECBUFFER_TOKEN;
-    inbuffers[0].pvBuffer = &type;
-    inbuffers[0].cbBuffer = sizeof(type);
+  struct addrinfo hints;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_protocol = IPPROTO_TCP;
+  hints.ai_flags = AI_ADDRCONFIG;
 
-    SecBufferDesc indesc = { SECBUFFER_VERSION, ARRAYSIZE(inbuffers), inbuffers };
-    ApplyControlToken(&s->context, &indesc);
+  uint64_t start = http_now_ns();
 
-    SecBuffer outbuffers[1];
-    outbuffers[0].BufferType = SECBUFFER_TOKEN;
+  // getaddrinfo is thread-safe, other than gethostbyname
+  struct addrinfo *result = NULL;
+  int error = getaddrinfo(hostname, NULL, &hints, &result);
+  if(error == EAI_BADFLAGS || error == EAI_NONAME) {
+    // AI_ADDRCONFIG hides everything, if only loopback is configured
+    hints.ai_flags = 0;
+    error = getaddrinfo(hostname, NULL, &hints, &result);
+  }
 
-    SecBufferDesc outdesc = { SECBUFFER_VERSION, ARRAYSIZE(outbuffers), outbuffers };
+  uint64_t elapsed = http_now_ns() - start;
+  http_resolver_lock();
+  http_resolver_stats.resolve_ns += elapsed;
+  http_resolver_unlock();
+
+  if(error != 0) {
+    return false;
+  }
+
+  // Interleave the families, starting with the one getaddrinfo sorted first
+  int first_family = result->ai_family;
+  struct addrinfo *first = result;
+  struct addrinfo *second = result;
+  addresses->len = 0;
+  while(addresses->len < HTTP_DNS_ADDRESSES_CAP && (first || second)) {
+    while(first && first->ai_family != first_family) first = first->ai_next;
+    while(second && (second->ai_family == first_family ||
+		     (second->ai_family != AF_INET && second->ai_family != AF_INET6))) second = second->ai_next;
+
+    struct addrinfo *next = (addresses->len % 2 == 0 && first) || !second ? first : second;
+    if(!next) {
+      break;
+    }
+    if(next->ai_addrlen <= sizeof(struct sockaddr_storage)) {
+      memcpy(&addresses->addrs[addresses->len], next->ai_addr, next->ai_addrlen);
+      addresses->addrs_len[addresses->len] = (socklen_t) next->ai_addrlen;
+      addresses->len++;
+    }
+    if(next == first) first = first->ai_next;
+    else second = second->ai_next;
+  }
+
+  freeaddrinfo(result);
+
+  return addresses->len > 0;
+}
+
+static void http_resolver_insert(const char *hostname, Http_Addresses *addresses) {
+  uint64_t now = http_now_ns();
+  size_t hostname_len = strlen(hostname);
+  if(hostname_len >= sizeof(http_resolver_cache[0].hostname)) {
+    return;
+  }
+
+  http_resolver_lock();
+
+  // Replace the same host, or the entry that expires first
+  Http_Resolver_Entry *entry = NULL;
+  for(size_t i=0;i<http_resolver_cache_len;i++) {
+    if(strcmp(http_resolver_cache[i].hostname, hostname) == 0) {
+      entry = &http_resolver_cache[i];
+      break;
+    }
+  }
+  if(!entry && http_resolver_cache_len < HTTP_DNS_CACHE_CAP) {
+    entry = &http_resolver_cache[http_resolver_cache_len++];
+  }
+  if(!entry) {
+    entry = &http_resolver_cache[0];
+    for(size_t i=1;i<http_resolver_cache_len;i++) {
+      if(http_resolver_cache[i].expires < entry->expires) entry = &http_resolver_cache[i];
+    }
+  }
+
+  memcpy(entry->hostname, hostname, hostname_len + 1);
+  entry->addresses = *addresses;
+  entry->expires = now + (uint64_t) HTTP_DNS_TTL_MS * 1000000;
+
+  http_resolver_unlock();
+}
+
+// Never blocks, a miss is not counted
+static bool http_resolve_cached(const char *hostname, uint16_t port, Http_Addresses *addresses) {
+  uint64_t now = http_now_ns();
+
+  http_resolver_lock();
+  for(size_t i=0;i<http_resolver_cache_len;i++) {
+    Http_Resolver_Entry *entry = &http_resolver_cache[i];
+    if(strcmp(entry->hostname, hostname) == 0 && now < entry->expires) {
+      *addresses = entry->addresses;
+      http_resolver_stats.hits++;
+      http_resolver_unlock();
+
+      http_addresses_set_port(addresses, port);
+      return true;
+    }
+  }
+  http_resolver_unlock();
+
+  return false;
+}
+
+HTTP_DEF bool http_resolve(const char *hostname, uint16_t port, Http_Addresses *addresses) {
+  if(http_resolve_cached(hostname, port, addresses)) {
+    return true;
+  }
+
+  http_resolver_lock();
+  http_resolver_stats.misses++;
+  http_resolver_unlock();
+
+  if(!http_resolver_lookup(hostname, addresses)) {
+    http_resolver_lock();
+    http_resolver_stats.failures++;
+    http_resolver_unlock();
+    return false;
+  }
+  http_resolver_insert(hostname, addresses);
+
+  http_addresses_set_port(addresses, port);
+  return true;
+}
+
+#ifdef _WIN32
+static DWORD WINAPI http_resolve_thread(LPVOID _hostname) {
+#else
+static void *http_resolve_thread(void *_hostname) {
+#endif // _WIN32
+  char *hostname = _hostname;
+
+  Http_Addresses addresses;
+  if(http_resolver_lookup(hostname, &addresses)) {
+    http_resolver_insert(hostname, &addresses);
+  }
+  free(hostname);
+
+  return 0;
+}
+
+HTTP_DEF bool http_resolve_async(const char *hostname) {
+  size_t hostname_len = strlen(hostname);
+  char *copy = malloc(hostname_len + 1);
+  if(!copy) {
+    return false;
+  }
+  memcpy(copy, hostname, hostname_len + 1);
+
+  http_resolver_lock();
+  http_resolver_stats.prefetches++;
+  http_resolver_unlock();
+
+#ifdef _WIN32
+  HANDLE thread = CreateThread(NULL, 0, http_resolve_thread, copy, 0, NULL);
+  if(thread == NULL) {
+    free(copy);
+    return false;
+  }
+  CloseHandle(thread);
+  return true;
+#else
+  pthread_t thread;
+  if(pthread_create(&thread, NULL, http_resolve_thread, copy) != 0) {
+    free(copy);
+    return false;
+  }
+  pthread_detach(thread);
+  return true;
+#endif // _WIN32
+}
+
+HTTP_DEF void http_resolver_flush() {
+  http_resolver_lock();
+  http_resolver_cache_len = 0;
+  http_resolver_unlock();
+}
+
+HTTP_DEF void http_resolver_get_stats(Http_Resolver_Stats *stats) {
+  http_resolver_lock();
+  *stats = http_resolver_stats;
+  http_resolver_unlock();
+}
+
+HTTP_DEF bool http_socket_connect_addresses(Http *http, Http_Addresses *addresses) {
+#ifdef _WIN32
+  // The addresses are tried one after the other
+  for(size_t i=0;i<addresses->len;i++) {
+    SOCKET s = WSASocketW(addresses->addrs[i].ss_family, SOCK_STREAM, IPPROTO_TCP, NULL, 0, 0);
+    if(s == INVALID_SOCKET) {
+      continue;
+    }
+    if(connect(s, (struct sockaddr *) &addresses->addrs[i], (int) addresses->addrs_len[i]) == 0) {
+      http->socket = s;
+      return true;
+    }
+    closesocket(s);
+  }
+
+  return false;
+#elif linux
+  int sockets[HTTP_DNS_ADDRESSES_CAP];
+  struct pollfd fds[HTTP_DNS_ADDRESSES_CAP];
+  size_t next = 0, fds_len = 0;
+  uint64_t next_attempt = 0;
+
+  while(next < addresses->len || fds_len > 0) {
+
+    // Start the next attempt, if the previous ones take too long or failed already
+    uint64_t now = http_now_ns();
+    if(next < addresses->len && (fds_len == 0 || now >= next_attempt)) {
+      int s = socket(addresses->addrs[next].ss_family, SOCK_STREAM | SOCK_NONBLOCK, 0);
+      int ret = s < 0 ? -1 : connect(s, (struct sockaddr *) &addresses->addrs[next], addresses->addrs_len[next]);
+      next++;
+
+      if(s >= 0 && (ret == 0 || errno == EINPROGRESS)) {
+	sockets[fds_len] = s;
+	fds[fds_len].fd = s;
+	fds[fds_len].events = POLLOUT;
+	fds_len++;
+	next_attempt = now + (uint64_t) HTTP_HAPPY_EYEBALLS_MS * 1000000;
+      } else if(s >= 0) {
+	close(s);
+      }
+      continue;
+    }
+
+    int timeout = -1;
+    if(next < addresses->len) {
+      timeout = (int) ((next_attempt - now) / 1000000) + 1;
+    }
+    int ret = poll(fds, fds_len, timeout);
+    if(ret < 0) {
+      if(errno == EINTR) continue;
+      break;
+    }
+
+    for(size_t i=0;i<fds_len;i++) {
+      if(!fds[i].revents) {
+	continue;
+      }
+
+      int error = 0;
+      socklen_t error_len = sizeof(error);
+      if(getsockopt(sockets[i], SOL_SOCKET, SO_ERROR, &error, &error_len) == 0 && error == 0) {
+	// Winner: the others are abandoned
+	for(size_t j=0;j<fds_len;j++) {
+	  if(j != i) close(sockets[j]);
+	}
+	int flags = fcntl(sockets[i], F_GETFL, 0);
+	fcntl(sockets[i], F_SETFL, flags & ~O_NONBLOCK);
+	http->socket = sockets[i];
+	return true;
+      }
+
+      // This attempt failed, the next one starts right away
+      close(sockets[i]);
+      sockets[i] = sockets[fds_len - 1];
+      fds[i] = fds[fds_len - 1];
+      fds_len--;
+      i--;
+      next_attempt = 0;
+    }
+  }
+
+  for(size_t i=0;i<fds_len;i++) {
+    close(sockets[i]);
+  }
+  return false;
+#else
+  HTTP_LOG("Unsupported platform. Implement: http_socket_connect_addresses");
+
+  (void) http;
+  (void) addresses;
+  return false;
+#endif // _WIN32
+}
+
+HTTP_DEF void http_free(Http *http) {
+
+#ifdef HTTP_OPEN_SSL
+  if(http->conn) {
+    SSL_set_shutdown(http->conn, SSL_RECEIVED_SHUTDOWN | SSL_SENT_SHUTDOWN);
+    SSL_shutdown(http->conn);
+    free(SSL_get_app_data(http->conn));
+    SSL_free(http->conn);
+    http->conn = NULL;
+  }
+#endif // HTTP_OPEN_SSL
+
+#ifdef HTTP_WIN32_SSL
+  if(http->win32_tls.socket != INVALID_SOCKET) {
+
+    http_win32_tls_socket *s = &http->win32_tls;
+    DWORD type = SCHANNEL_SHUTDOWN;
+
+    SecBuffer inbuffers[1];
+    inbuffers[0].BufferType = SECBUFFER_TOKEN;
+    inbuffers[0].pvBuffer = &type;
+    inbuffers[0].cbBuffer = sizeof(type);
+
+    SecBufferDesc indesc = { SECBUFFER_VERSION, ARRAYSIZE(inbuffers), inbuffers };
+    ApplyControlToken(&s->context, &indesc);
+
+    SecBuffer outbuffers[1];
+    outbuffers[0].BufferType = SECBUFFER_TOKEN;
+
+    SecBufferDesc outdesc = { SECBUFFER_VERSION, ARRAYSIZE(outbuffers), outbuffers };
     DWORD flags = ISC_REQ_ALLOCATE_MEMORY | ISC_REQ_CONFIDENTIALITY | ISC_REQ_REPLAY_DETECT | ISC_REQ_SEQUENCE_DETECT | ISC_REQ_STREAM;
     if (InitializeSecurityContextA(&s->handle, &s->context, NULL, flags, 0, 0, &outdesc, 0, NULL, &outdesc, &flags, NULL) == SEC_E_OK) {
       char* buffer = outbuffers[0].pvBuffer;
@@ -421,6 +1415,7 @@ HTTP_DEF void http_free(Http *http) {
 #elif linux
   if(http->socket >= 0) {
     close(http->socket);    
+    http->socket = -1;
   }
 #endif
 
@@ -443,7 +1438,9 @@ HTTP_DEF bool http_socket_write(const char *data, size_t size, void *_http) {
   // If the write fails, because of any error, but we should continue trying to write.
   
   do{
-    int ret = SSL_write(http->conn, data, (int) size);
+    // SSL_write takes an int
+    int len = size > INT_MAX ? INT_MAX : (int) size;
+    int ret = SSL_write(http->conn, data, len);
     if(ret <= 0) {
 
       int error = SSL_get_error(http->conn, ret);
@@ -465,7 +1462,13 @@ HTTP_DEF bool http_socket_write(const char *data, size_t size, void *_http) {
     } else {
 
       // ssl_write success
-      return true;
+      http->bytes_sent += (size_t) ret;
+      http->writes++;
+      data += ret;
+      size -= (size_t) ret;
+      if(size == 0) {
+	return true;
+      }
     } 
 
   }while(1);
@@ -520,6 +1523,8 @@ HTTP_DEF bool http_socket_write(const char *data, size_t size, void *_http) {
       sent += d;
     }
 
+    http->bytes_sent += use;
+    http->writes++;
     data = (char*)data + use;
     size -= use;
   }
@@ -541,46 +1546,131 @@ HTTP_DEF bool http_socket_write_plain(const char *data, size_t size, void *_http
 
   Http *http = (Http *) _http;
 
+  // send may accept only a part of the data
 #ifdef _WIN32
-  int ret = send(http->socket, data, (int) size, 0);
-  if(ret == SOCKET_ERROR) {
+  while(size > 0) {
+    int len = size > INT_MAX ? INT_MAX : (int) size;
+    int ret = send(http->socket, data, len, 0);
+    if(ret == SOCKET_ERROR) {
     
-    // send error
-    HTTP_LOG_OS("send");
-    return false;
-  } else if(ret == 0) {
-    
-    // connection was closed
-    return false;
-  } else {
+      // send error
+      HTTP_LOG_OS("send");
+      return false;
+    } else if(ret == 0) {
     
-    // send success
-    return true;
+      // connection was closed
+      return false;
+    }
+
+    http->bytes_sent += (size_t) ret;
+    http->writes++;
+    data += ret;
+    size -= (size_t) ret;
   }
-#elif linux
 
-  int ret = send(http->socket, data, (int) size, 0);
-  if(ret < 0) {
-    // TODO: check if this is the right error
-    if(errno == ECONNRESET) {
+  return true;
+#elif linux
 
-      // connection was closed
-      return false;
-    } else {
+  while(size > 0) {
+    ssize_t ret = send(http->socket, data, size, MSG_NOSIGNAL);
+    if(ret < 0) {
+      if(errno == EINTR) {
+	continue;
+      }
 
-      // send error
+      // send error or connection was closed (ECONNRESET, EPIPE)
       return false;
-    }      
-  } else {
+    }
 
-    // send success
-    return true;
+    http->bytes_sent += (size_t) ret;
+    http->writes++;
+    data += ret;
+    size -= (size_t) ret;
   }
+
+  return true;
 #else
   return false;
 #endif 
 }
 
+HTTP_DEF bool http_socket_writev(Http *http, Http_Buffer *buffers, size_t buffers_len) {
+
+  bool plain = true;
+#ifdef HTTP_OPEN_SSL
+  plain = http->conn == NULL;
+#endif // HTTP_OPEN_SSL
+
+#ifdef linux
+  if(plain) {
+    struct iovec iov[HTTP_IOV_CAP];
+    size_t i = 0, off = 0;
+
+    while(true) {
+      while(i < buffers_len && buffers[i].len == off) {
+	i++;
+	off = 0;
+      }
+      if(i == buffers_len) {
+	return true;
+      }
+
+      size_t iov_len = 0;
+      for(size_t j=i;j<buffers_len && iov_len<HTTP_IOV_CAP;j++) {
+	size_t o = j == i ? off : 0;
+	if(buffers[j].len == o) continue;
+	iov[iov_len].iov_base = (char *) buffers[j].data + o;
+	iov[iov_len].iov_len = buffers[j].len - o;
+	iov_len++;
+      }
+
+      struct msghdr msg = {0};
+      msg.msg_iov = iov;
+      msg.msg_iovlen = iov_len;
+      ssize_t ret = sendmsg(http->socket, &msg, MSG_NOSIGNAL);
+      if(ret < 0) {
+	if(errno == EINTR) {
+	  continue;
+	}
+	return false;
+      }
+
+      // Skip what was sent, the rest is sent by the next sendmsg
+      size_t sent = (size_t) ret;
+      http->bytes_sent += sent;
+      http->writes++;
+      while(sent > 0) {
+	size_t left = buffers[i].len - off;
+	if(sent < left) {
+	  off += sent;
+	  sent = 0;
+	} else {
+	  sent -= left;
+	  i++;
+	  off = 0;
+	}
+      }
+    }
+  }
+#endif // linux
+  (void) plain;
+
+  // TLS encrypts every buffer on its own anyway
+  for(size_t i=0;i<buffers_len;i++) {
+#if defined(HTTP_OPEN_SSL) || defined(HTTP_WIN32_SSL)
+    if(!http_socket_write(buffers[i].data, buffers[i].len, http)) {
+      return false;
+    }
+#else
+    if(!http_socket_write_plain(buffers[i].data, buffers[i].len, http)) {
+      return false;
+    }
+#endif // HTTP_OPEN_SSL || HTTP_WIN32_SSL
+  }
+
+  return true;
+}
+
 HTTP_DEF bool http_socket_read(char *buffer, size_t buffer_size, void *_http, size_t *read) {
 
 #ifdef HTTP_OPEN_SSL
@@ -620,6 +1710,8 @@ HTTP_DEF bool http_socket_read(char *buffer, size_t buffer_size, void *_http, si
 
       // ssl_read success
       *read = (size_t) ret;
+      http->bytes_received += *read;
+      http->reads++;
       return true;
     }
 
@@ -702,6 +1794,8 @@ HTTP_DEF bool http_socket_read(char *buffer, size_t buffer_size, void *_http, si
 	    return false;
 	  } else {
 	    *read =result;
+	    http->bytes_received += *read;
+	    http->reads++;
 	    return true;
 	  }
 	} else if (sec == SEC_I_RENEGOTIATE) {
@@ -747,6 +1841,8 @@ HTTP_DEF bool http_socket_read(char *buffer, size_t buffer_size, void *_http, si
     return false;
   } else {
     *read = result;
+    http->bytes_received += *read;
+    http->reads++;
     return true;
   }
 
@@ -765,7 +1861,61 @@ HTTP_DEF bool http_socket_read(char *buffer, size_t buffer_size, void *_http, si
 }
 
 HTTP_DEF bool http_socket_connect_tls(Http *http, const char *hostname) {
-#ifdef HTTP_WIN32_SSL
+#if defined(HTTP_OPEN_SSL)
+  http->conn = SSL_new(http_global_ssl_context);
+  if(!http->conn) {
+    HTTP_LOG("Fatal error using OPEN_SSL");
+    return false;
+  }
+  SSL_set_fd(http->conn, (int) http->socket); // TODO: maybe check this cast
+
+  SSL_set_connect_state(http->conn);
+  SSL_set_tlsext_host_name(http->conn, hostname);
+
+  // Offer the last session for this host
+  char *key = malloc(sizeof(http_tls_sessions[0].key));
+  if(!key) {
+    return false;
+  }
+  snprintf(key, sizeof(http_tls_sessions[0].key), "%s:%u", hostname, http->port);
+  SSL_set_app_data(http->conn, key);
+
+  http_tls_lock();
+  for(size_t i=0;i<http_tls_sessions_len;i++) {
+    Http_Tls_Session *entry = &http_tls_sessions[i];
+    if(strcmp(entry->key, key) != 0) {
+      continue;
+    }
+
+    if(SSL_SESSION_is_resumable(entry->session)) {
+      SSL_set_session(http->conn, entry->session);
+      entry->used = ++http_tls_sessions_clock;
+    } else {
+      SSL_SESSION_free(entry->session);
+      *entry = http_tls_sessions[--http_tls_sessions_len];
+    }
+    break;
+  }
+  http_tls_unlock();
+
+  uint64_t start = http_now_ns();
+  if(SSL_connect(http->conn) != 1) {
+    return false;
+  }
+  uint64_t elapsed = http_now_ns() - start;
+
+  http_tls_lock();
+  http_tls_stats.handshakes++;
+  http_tls_stats.handshake_ns += elapsed;
+  if(SSL_session_reused(http->conn)) {
+    http_tls_stats.resumed++;
+  } else {
+    http_tls_stats.full++;
+  }
+  http_tls_unlock();
+
+  return true;
+#elif defined(HTTP_WIN32_SSL)
   http_win32_tls_socket *s = &http->win32_tls;
 
   // initialize schannel
@@ -969,6 +2119,7 @@ HTTP_DEF bool http_socket_read_plain(char *buffer, size_t buffer_size, void *_ht
 
 #ifdef _WIN32
   int ret = recv(http->socket, buffer, (int) buffer_size, 0);
+  http->reads++;
   if(ret == SOCKET_ERROR) {
     // recv error
     HTTP_LOG_OS("recv");
@@ -982,13 +2133,20 @@ HTTP_DEF bool http_socket_read_plain(char *buffer, size_t buffer_size, void *_ht
 
     // recv success
     *read = (size_t) ret;
+    http->bytes_received += *read;
     return true;
   }
 #elif linux
 
+  http->would_block = false;
   int ret = recv(http->socket, buffer, (int) buffer_size, 0);
+  http->reads++;
   if(ret < 0) {
 
+    if(errno == EAGAIN || errno == EWOULDBLOCK) {
+      http->would_block = true;
+    }
+
     // recv error
     return false;
   } else if(ret == 0) {
@@ -999,6 +2157,7 @@ HTTP_DEF bool http_socket_read_plain(char *buffer, size_t buffer_size, void *_ht
   } else {
 
     *read = (size_t) ret; 
+    http->bytes_received += *read;
     return true;
   }
 #else
@@ -1006,22 +2165,23 @@ HTTP_DEF bool http_socket_read_plain(char *buffer, size_t buffer_size, void *_ht
 #endif 
 }
 
-#define HTTP_REQUEST_STATE_DONE -2
-#define HTTP_REQUEST_STATE_ERROR -1
-#define HTTP_REQUEST_STATE_IDLE 0
-#define HTTP_REQUEST_STATE_R    1
-#define HTTP_REQUEST_STATE_RN   2
-#define HTTP_REQUEST_STATE_RNR  3
-#define HTTP_REQUEST_STATE_BODY 4
-
-#define HTTP_REQUEST_PAIR_INVALID 0
-#define HTTP_REQUEST_PAIR_KEY 1
-#define HTTP_REQUEST_PAIR_VALUE 2
-
-#define HTTP_REQUEST_BODY_NONE 0
-#define HTTP_REQUEST_BODY_CONTENT_LEN 1
-#define HTTP_REQUEST_BODY_CHUNKED 2
-#define HTTP_REQUEST_BODY_INFO 3
+#define HTTP_INFLATE_NONE 0
+#define HTTP_INFLATE_GZIP_HEADER 1
+#define HTTP_INFLATE_START 2
+#define HTTP_INFLATE_STREAM 3
+#define HTTP_INFLATE_DONE 4
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#  include <emmintrin.h>
+#  define HTTP_SSE2
+#  ifdef _MSC_VER
+#    include <intrin.h>
+static inline unsigned int http_ctz(unsigned int x) { unsigned long i; _BitScanForward(&i, x); return (unsigned int) i; }
+#    define HTTP_CTZ(x) http_ctz(x)
+#  else
+#    define HTTP_CTZ(x) __builtin_ctz(x)
+#  endif // _MSC_VER
+#endif // __SSE2__
 
 #if defined(HTTP_OPEN_SSL) || defined(HTTP_WIN32_SSL)
 #  define HTTP_WRITE_FUNC http_socket_write
@@ -1046,54 +2206,11 @@ HTTP_DEF bool http_request_from(Http *http, const char *route, const char *metho
 				const unsigned char *body, size_t body_len,
 				Http_Request *r) {
 
-  r->http = http;
-  r->buffer_size = 0;
-  r->body = HTTP_REQUEST_BODY_NONE;
-  r->state = HTTP_REQUEST_STATE_IDLE;
-  r->state2 = HTTP_REQUEST_STATE_IDLE;
-  r->pair = HTTP_REQUEST_PAIR_KEY;
-  r->key_len = 0;
-  r->value_len = 0;
-  r->content_read = 0;
-  r->chunked_debug = false;
-  
-  if(body_len > 0) {
+  if(!http_request_send(http, route, method, headers, body, body_len, r->buffer, sizeof(r->buffer))) {
+    return false;
+  }
 
-    int len = (int) body_len;
-    
-    if(!http_sendf(HTTP_WRITE_FUNC, http, r->buffer, sizeof(r->buffer),
-		   "%s %s HTTP/1.1\r\n"
-		   "Host: %s\r\n"
-		   "%s"
-		   "Content-Length: %d\r\n"
-		   "\r\n"
-		   "%.*s", method, route, http->hostname, headers ? headers : "", len , len, (char *) body)) {
-      HTTP_LOG("Failed to send http-request");
-      return false;
-    }
-    
-  } else {
-
-#ifdef HTTP_DEBUG 
-    if(!http_sendf(http_foo, http, r->buffer, sizeof(r->buffer),
-		   "%s %s HTTP/1.1\r\n"
-		   "Host: %s\r\n"
-		   "%s"
-		   "\r\n", method, route, http->hostname, headers ? headers : "")) {
-      HTTP_LOG("Failed to send http-request");
-      return false;
-    }
-#endif // HTTP_DEBUG
-    
-    if(!http_sendf(HTTP_WRITE_FUNC, http, r->buffer, sizeof(r->buffer),
-		   "%s %s HTTP/1.1\r\n"
-		   "Host: %s\r\n"
-		   "%s"
-		   "\r\n", method, route, http->hostname, headers ? headers : "")) {
-      HTTP_LOG("Failed to send http-request");
-      return false;
-    }    
-  }
+  http_request_begin(http, r);
 
   if(!HTTP_READ_FUNC(r->buffer, sizeof(r->buffer), r->http, &r->buffer_size)) {
     return false;
@@ -1106,190 +2223,611 @@ HTTP_DEF bool http_request_from(Http *http, const char *route, const char *metho
   return true;
 }
 
-HTTP_DEF bool http_next_header(Http_Request *r, Http_Header *header) {
+HTTP_DEF bool http_request_send(Http *http, const char *route, const char *method,
+				const char *headers,
+				const unsigned char *body, size_t body_len,
+				char *buffer, size_t buffer_cap) {
+  Http_Buffer b;
+  b.data = body;
+  b.len = body_len;
 
- start:
-  if(r->state == HTTP_REQUEST_STATE_ERROR ||
-     r->state == HTTP_REQUEST_STATE_DONE) {
+  return http_request_sendv(http, route, method, headers, &b, body_len > 0 ? 1 : 0, buffer, buffer_cap);
+}
+
+// The head is collected in the sendf-buffer instead of being sent.
+// 'head_len' holds the capacity on entry.
+static bool http_head_collect(const char *data, size_t size, void *head_len) {
+  (void) data;
+  if(size >= *(size_t *) head_len) {
     return false;
   }
+  *(size_t *) head_len = size;
+  return true;
+}
 
-  if(r->buffer_size == 0) {
-    if(!HTTP_READ_FUNC(r->buffer, sizeof(r->buffer), r->http, &r->buffer_size)) {
-      return false;
+HTTP_DEF bool http_request_head(Http *http, const char *route, const char *method,
+				const char *headers, int body, uint64_t content_length,
+				char *buffer, size_t buffer_cap, size_t *head_len) {
+  *head_len = buffer_cap;
+
+  bool ok;
+  if(body == HTTP_REQUEST_BODY_CHUNKED) {
+    ok = http_sendf(http_head_collect, head_len, buffer, buffer_cap,
+		    "%s %s HTTP/1.1\r\n"
+		    "Host: %s\r\n"
+		    HTTP_ACCEPT_ENCODING
+		    "%s"
+		    "Transfer-Encoding: chunked\r\n"
+		    "\r\n", method, route, http->hostname, headers ? headers : "");
+  } else if(body == HTTP_REQUEST_BODY_CONTENT_LEN) {
+    ok = http_sendf(http_head_collect, head_len, buffer, buffer_cap,
+		    "%s %s HTTP/1.1\r\n"
+		    "Host: %s\r\n"
+		    HTTP_ACCEPT_ENCODING
+		    "%s"
+		    "Content-Length: %llu\r\n"
+		    "\r\n", method, route, http->hostname, headers ? headers : "",
+		    (unsigned long long) content_length);
+  } else {
+    ok = http_sendf(http_head_collect, head_len, buffer, buffer_cap,
+		    "%s %s HTTP/1.1\r\n"
+		    "Host: %s\r\n"
+		    HTTP_ACCEPT_ENCODING
+		    "%s"
+		    "\r\n", method, route, http->hostname, headers ? headers : "");
+  }
+  if(!ok) {
+    HTTP_LOG("Request-head does not fit into the buffer");
+    return false;
+  }
+
+#ifdef HTTP_DEBUG
+  http_foo(buffer, *head_len, NULL);
+#endif // HTTP_DEBUG
+
+  return true;
+}
+
+static void http_request_sent(Http *http, const char *method, uint64_t started_at) {
+  Http_Pending *p = &http->pending_requests[(http->pending_pos + http->pending) % HTTP_PIPELINE_CAP];
+  p->head = strcmp(method, "HEAD") == 0;
+  p->started_at = started_at;
+  p->sent_at = http_now_ns();
+  p->bytes_sent = http->bytes_sent - http->bytes_sent_mark;
+  http->bytes_sent_mark = http->bytes_sent;
+  http->pending++;
+}
+
+HTTP_DEF bool http_request_sendv(Http *http, const char *route, const char *method,
+				 const char *headers,
+				 Http_Buffer *body, size_t body_count,
+				 char *buffer, size_t buffer_cap) {
+
+  if(http->pending == HTTP_PIPELINE_CAP) {
+    HTTP_LOG("Too many pipelined requests. Increase HTTP_PIPELINE_CAP");
+    return false;
+  }
+  uint64_t started_at = http_now_ns();
+
+  uint64_t content_length = 0;
+  for(size_t i=0;i<body_count;i++) {
+    content_length += body[i].len;
+  }
+
+  Http_Buffer buffers[HTTP_IOV_CAP];
+  if(!http_request_head(http, route, method, headers,
+			body_count > 0 ? HTTP_REQUEST_BODY_CONTENT_LEN : HTTP_REQUEST_BODY_NONE, content_length,
+			buffer, buffer_cap, &buffers[0].len)) {
+    return false;
+  }
+  buffers[0].data = buffer;
+
+  // The head travels with the first body-buffers, larger bodies need more writev's
+  bool ok;
+  if(body_count < HTTP_IOV_CAP) {
+    memcpy(buffers + 1, body, body_count * sizeof(Http_Buffer));
+    ok = http_socket_writev(http, buffers, body_count + 1);
+  } else {
+    ok = http_socket_writev(http, buffers, 1) && http_socket_writev(http, body, body_count);
+  }
+  if(!ok) {
+    HTTP_LOG("Failed to send http-request");
+    http->keep_alive = false;
+    return false;
+  }
+
+  http_request_sent(http, method, started_at);
+
+  return true;
+}
+
+HTTP_DEF bool http_request_send_file(Http *http, const char *route, const char *method,
+				     const char *headers, const char *filepath,
+				     char *buffer, size_t buffer_cap) {
+#ifdef linux
+  if(http->pending == HTTP_PIPELINE_CAP) {
+    HTTP_LOG("Too many pipelined requests. Increase HTTP_PIPELINE_CAP");
+    return false;
+  }
+  uint64_t started_at = http_now_ns();
+
+  int fd = open(filepath, O_RDONLY);
+  if(fd < 0) {
+    HTTP_LOG("Can not open '%s'", filepath);
+    return false;
+  }
+
+  struct stat stats;
+  if(fstat(fd, &stats) < 0 || !S_ISREG(stats.st_mode)) {
+    HTTP_LOG("'%s' is not a file", filepath);
+    close(fd);
+    return false;
+  }
+  uint64_t size = (uint64_t) stats.st_size;
+
+  Http_Buffer head;
+  head.data = buffer;
+  if(!http_request_head(http, route, method, headers, HTTP_REQUEST_BODY_CONTENT_LEN, size,
+			buffer, buffer_cap, &head.len)) {
+    close(fd);
+    return false;
+  }
+  if(!http_socket_writev(http, &head, 1)) {
+    goto error;
+  }
+
+  bool plain = true;
+#ifdef HTTP_OPEN_SSL
+  plain = http->conn == NULL;
+#endif // HTTP_OPEN_SSL
+
+  off_t offset = 0;
+  while((uint64_t) offset < size) {
+    ssize_t ret;
+    if(plain) {
+      // The kernel copies the file into the socket
+      ret = sendfile(http->socket, fd, &offset, (size_t) (size - (uint64_t) offset));
+      if(ret > 0) {
+	http->bytes_sent += (uint64_t) ret;
+	http->writes++;
+      }
+    } else {
+      // TLS has to see the plaintext
+      ret = pread(fd, buffer, buffer_cap, offset);
+      if(ret > 0) {
+	if(!http_socket_write(buffer, (size_t) ret, http)) {
+	  goto error;
+	}
+	offset += ret;
+      }
+    }
+    if(ret < 0 && errno == EINTR) {
+      continue;
+    }
+    if(ret <= 0) {
+      goto error;
     }
+  }
+
+  close(fd);
+  http_request_sent(http, method, started_at);
+  return true;
+
+ error:
+  HTTP_LOG("Failed to send http-request");
+  http->keep_alive = false;
+  close(fd);
+  return false;
+#else
+  HTTP_LOG("Unsupported platform. Implement: http_request_send_file");
+
+  (void) http;
+  (void) route;
+  (void) method;
+  (void) headers;
+  (void) filepath;
+  (void) buffer;
+  (void) buffer_cap;
+  return false;
+#endif // linux
+}
+
+HTTP_DEF bool http_request_chunked_begin(Http *http, const char *route, const char *method,
+					 const char *headers, char *buffer, size_t buffer_cap) {
+
+  if(http->pending == HTTP_PIPELINE_CAP) {
+    HTTP_LOG("Too many pipelined requests. Increase HTTP_PIPELINE_CAP");
+    return false;
+  }
+  uint64_t started_at = http_now_ns();
+
+  Http_Buffer head;
+  head.data = buffer;
+  if(!http_request_head(http, route, method, headers, HTTP_REQUEST_BODY_CHUNKED, 0,
+			buffer, buffer_cap, &head.len)) {
+    return false;
+  }
+  if(!http_socket_writev(http, &head, 1)) {
+    HTTP_LOG("Failed to send http-request");
+    http->keep_alive = false;
+    return false;
+  }
+
+  // The response is expected from now on, even if the body is not complete yet
+  http_request_sent(http, method, started_at);
+
+  return true;
+}
+
+HTTP_DEF bool http_request_chunk(Http *http, const void *data, size_t len) {
+  // A chunk of size 0 would end the body
+  if(len == 0) {
+    return true;
+  }
+
+  // '<hex-size>\r\n<data>\r\n'
+  char size[24];
+  size_t size_len = sizeof(size) - 2;
+  size[size_len] = '\r';
+  size[size_len + 1] = '\n';
+  size_t n = len;
+  do {
+    size[--size_len] = "0123456789abcdef"[n & 0xf];
+    n >>= 4;
+  } while(n > 0);
+
+  Http_Buffer buffers[3];
+  buffers[0].data = size + size_len;
+  buffers[0].len = sizeof(size) - size_len;
+  buffers[1].data = data;
+  buffers[1].len = len;
+  buffers[2].data = "\r\n";
+  buffers[2].len = 2;
+
+  if(!http_socket_writev(http, buffers, 3)) {
+    HTTP_LOG("Failed to send http-chunk");
+    http->keep_alive = false;
+    return false;
+  }
+
+  return true;
+}
+
+HTTP_DEF bool http_request_chunked_end(Http *http) {
+  Http_Buffer last;
+  last.data = "0\r\n\r\n";
+  last.len = 5;
+
+  if(!http_socket_writev(http, &last, 1)) {
+    HTTP_LOG("Failed to send http-chunk");
+    http->keep_alive = false;
+    return false;
+  }
+
+  // The request is sent, once the body is complete
+  if(http->pending > 0) {
+    Http_Pending *p = &http->pending_requests[(http->pending_pos + http->pending - 1) % HTTP_PIPELINE_CAP];
+    p->sent_at = http_now_ns();
+    p->bytes_sent += http->bytes_sent - http->bytes_sent_mark;
+    http->bytes_sent_mark = http->bytes_sent;
+  }
+
+  return true;
+}
+
+HTTP_DEF bool http_request_send_stream(Http *http, const char *route, const char *method,
+				       const char *headers,
+				       Http_Body_Producer producer, void *userdata,
+				       char *buffer, size_t buffer_cap) {
 
-    if(r->buffer_size == 0) {
+  if(!http_request_chunked_begin(http, route, method, headers, buffer, buffer_cap)) {
+    return false;
+  }
+
+  // The producer fills the buffer, while the kernel still sends the previous chunk
+  while(true) {
+    size_t len;
+    if(!producer(userdata, buffer, buffer_cap, &len)) {
+      // The server would wait for the rest of the body
+      http->keep_alive = false;
+      return false;
+    }
+    if(len == 0) {
+      break;
+    }
+    if(!http_request_chunk(http, buffer, len)) {
       return false;
     }
-    r->buffer_pos = 0;
   }
 
-  for(size_t i=0;i<r->buffer_size;i++) {
-    int state_before = r->state;
+  return http_request_chunked_end(http);
+}
 
-    char c = r->buffer[r->buffer_pos + i];
-    
-    if(c == '\r') {
-      if(r->state == HTTP_REQUEST_STATE_IDLE) r->state = HTTP_REQUEST_STATE_R;
-      else if(r->state == HTTP_REQUEST_STATE_R) r->state = HTTP_REQUEST_STATE_IDLE;
-      else if(r->state == HTTP_REQUEST_STATE_RN) r->state = HTTP_REQUEST_STATE_RNR;
-      else if(r->state == HTTP_REQUEST_STATE_RNR) r->state = HTTP_REQUEST_STATE_IDLE;
-      else if(r->state == HTTP_REQUEST_STATE_BODY) r->state = HTTP_REQUEST_STATE_BODY;
-    } else if(c == '\n') {
-      if(r->state == HTTP_REQUEST_STATE_IDLE) r->state = HTTP_REQUEST_STATE_IDLE;
-      else if(r->state == HTTP_REQUEST_STATE_R) r->state = HTTP_REQUEST_STATE_RN;
-      else if(r->state == HTTP_REQUEST_STATE_RN) r->state = HTTP_REQUEST_STATE_IDLE;
-      else if(r->state == HTTP_REQUEST_STATE_RNR) r->state = HTTP_REQUEST_STATE_BODY;
-      else if(r->state == HTTP_REQUEST_STATE_BODY) r->state = HTTP_REQUEST_STATE_BODY;
-    } else {
-      if(r->state == HTTP_REQUEST_STATE_BODY) r->state = HTTP_REQUEST_STATE_BODY;
-      else r->state = HTTP_REQUEST_STATE_IDLE;
-    }
+HTTP_DEF bool http_request_begin(Http *http, Http_Request *r) {
+  r->http = http;
+  r->server = false;
+  r->buffer_size = 0;
+  r->buffer_pos = 0;
+  http_request_reset(r);
+
+  return http->pending > 0;
+}
+
+// Skips what is left of the current response and starts parsing the next one.
+// Bytes of the next response, which were already read, are kept.
+HTTP_DEF bool http_request_next(Http_Request *r) {
+
+  char *data;
+  size_t data_len;
+  while(http_next_body(r, &data, &data_len)) ;
+
+  if(r->state != HTTP_REQUEST_STATE_DONE) {
+    return false;
+  }
+
+  if(r->http->pending == 0) {
+    return false;
+  }
+
+  http_request_free(r);
+  http_request_reset(r);
+  return true;
+}
+
+HTTP_DEF void http_request_reset(Http_Request *r) {
+  r->body = HTTP_REQUEST_BODY_NONE;
+  r->state = HTTP_REQUEST_STATE_IDLE;
+  r->state2 = HTTP_REQUEST_STATE_IDLE;
+  r->key_len = 0;
+  r->content_read = 0;
+  r->content_length = 0;
+  r->chunked_debug = false;
+  r->ok = false;
+  r->response_code = 0;
+  r->encoding = HTTP_REQUEST_ENCODING_NONE;
+
+  Http *http = r->http;
+  Http_Pending *p = &http->pending_requests[http->pending_pos];
+  r->head = p->head;
+  r->started_at = p->started_at;
+  r->sent_at = p->sent_at;
+  r->headers_at = 0;
+  r->bytes_received_mark = http->bytes_received;
+  r->reads_mark = http->reads;
+
+  // The connection was established for the first response
+  memset(&r->timings, 0, sizeof(r->timings));
+  r->timings.dns_ns = http->dns_ns;
+  r->timings.connect_ns = http->connect_ns;
+  r->timings.tls_ns = http->tls_ns;
+  r->timings.send_ns = p->sent_at - p->started_at;
+  r->timings.bytes_sent = p->bytes_sent;
+  http->dns_ns = 0;
+  http->connect_ns = 0;
+  http->tls_ns = 0;
+#ifdef HTTP_MINIZ
+  r->inflate_state = HTTP_INFLATE_NONE;
+#endif // HTTP_MINIZ
+}
+
+HTTP_DEF void http_request_free(Http_Request *r) {
+#ifdef HTTP_MINIZ
+  if(r->inflate_state == HTTP_INFLATE_STREAM) {
+    mz_inflateEnd(&r->inflate);
+  }
+  r->inflate_state = HTTP_INFLATE_NONE;
+#else
+  (void) r;
+#endif // HTTP_MINIZ
+}
 
-    if(r->state == HTTP_REQUEST_STATE_IDLE && state_before == HTTP_REQUEST_STATE_RN) {
-      r->pair = HTTP_REQUEST_PAIR_KEY;
+HTTP_DEF void http_request_finish(Http_Request *r) {
+  r->state = HTTP_REQUEST_STATE_DONE;
+
+  Http *http = r->http;
+  if(!r->server) {
+    uint64_t now = http_now_ns();
+    Http_Timings *t = &r->timings;
+    t->body_ns = now - r->headers_at;
+    t->total_ns = now - r->started_at;
+    // Bytes of the next response, that were read together with this one, are counted here
+    t->bytes_received = http->bytes_received - r->bytes_received_mark;
+    t->reads = http->reads - r->reads_mark;
+    http_metrics_record(t);
+  }
+
+  if(http->pending > 0) {
+    http->pending--;
+    http->pending_pos = (http->pending_pos + 1) % HTTP_PIPELINE_CAP;
+  }
+}
+
+HTTP_DEF bool http_reusable(Http *http) {
+  return http->keep_alive && http->pending == 0;
+}
+
+HTTP_DEF bool http_next_header(Http_Request *r, Http_Header *header) {
+
+  while(r->state == HTTP_REQUEST_STATE_IDLE ||
+	r->state == HTTP_REQUEST_STATE_HEADER) {
+
+    char *line = r->buffer + r->buffer_pos;
+    size_t colon;
+    size_t line_end = http_scan_line(line, r->buffer_size, &colon);
+
+    if(line_end == r->buffer_size) {
+      // The line is split across reads: Move it to the front and read behind it.
+      // This is the only case, where header-bytes are copied.
+      if(r->buffer_size == sizeof(r->buffer)) {
+	HTTP_LOG("Header does not fit into HTTP_BUFFER_SIZE (%d bytes)", HTTP_BUFFER_SIZE);
+	r->state = HTTP_REQUEST_STATE_ERROR;
+	return false;
+      }
+      if(r->buffer_pos > 0) {
+	memmove(r->buffer, line, r->buffer_size);
+	r->buffer_pos = 0;
+      }
+
+      size_t read;
+      if(!HTTP_READ_FUNC(r->buffer + r->buffer_size, sizeof(r->buffer) - r->buffer_size, r->http, &read)) {
+	return false;
+      }
+      if(read == 0) {
+	return false;
+      }
+      r->buffer_size += read;
+      continue;
     }
 
-    if(r->pair == HTTP_REQUEST_PAIR_KEY) {
-      if(c == ':') {
-	r->pair = HTTP_REQUEST_PAIR_VALUE;
-      } else if(c == '\r') {
+    r->buffer_pos  += line_end + 1;
+    r->buffer_size -= line_end + 1;
 
-	// 'HTTP/1.1 '
-	static char http1_prefix[] = "HTTP";
-	static size_t http1_prefix_len = sizeof(http1_prefix) - 1;
+    size_t line_len = line_end;
+    if(line_len > 0 && line[line_len - 1] == '\r') line_len--;
 
-	if(r->key_len < http1_prefix_len ||
-	   memcmp(http1_prefix, r->key, http1_prefix_len) != 0) {
-	  HTTP_LOG("http1-prefix is not present: '%.*s'", (int) r->key_len, r->key);
-	  r->state = HTTP_REQUEST_STATE_ERROR;
-	  return false;
-	}
+    if(r->state == HTTP_REQUEST_STATE_IDLE) {
 
-	// '200'
-	if(r->key_len < http1_prefix_len + 5 + 3) {
-	  HTTP_LOG("http1 responseCode is not present");
-	  r->state = HTTP_REQUEST_STATE_ERROR;
-	  return false;
-	}
+      bool ok = r->server
+	? http_parse_request_line(r, line, line_len)
+	: http_parse_status_line(r, line, line_len);
+      if(!ok) {
+	HTTP_LOG("Failed to parse: '%.*s'", (int) line_len, line);
+	r->state = HTTP_REQUEST_STATE_ERROR;
+	return false;
+      }
 
-        size_t out;
-	if(!http_parse_u64(r->key + 5 + http1_prefix_len, 3, &out)) {
-	  HTTP_LOG("Failed to parse: '%.*s'", (int) 3, r->key + http1_prefix_len + 5);
-	  r->state = HTTP_REQUEST_STATE_ERROR;
-	  return false;
-	}
-	r->response_code = (int) out;
+      r->state = HTTP_REQUEST_STATE_HEADER;
+      if(!r->server) {
+	r->timings.ttfb_ns = http_now_ns() - r->sent_at;
+      }
+      continue;
+    }
 
-	r->ok = 199 <= r->response_code && r->response_code <= 299;
-	
-#ifndef HTTP_QUIET
-	if(!r->ok) {
-	  HTTP_LOG("Request to %s has failed with the code: %d", r->http->hostname, r->response_code);
-#endif // HTTP_QUIET
-	  
+    // '\r\n' terminates the headers
+    if(line_len == 0) {
+      r->state = HTTP_REQUEST_STATE_BODY;
+      r->headers_at = http_now_ns();
+
+      if(r->server) {
+	// a request without length has no body
+	if(r->body == HTTP_REQUEST_BODY_NONE ||
+	   (r->body == HTTP_REQUEST_BODY_CONTENT_LEN && r->content_length == 0)) {
+	  http_request_finish(r);
 	}
-	
-      } else if(c == '\n') {
-	r->key_len = 0;
-      } else {
-	assert(r->key_len < sizeof(r->key) - 1);
-	r->key[r->key_len++] = c;
+      } else if(r->head || r->response_code == 204 || r->response_code == 304) {
+	http_request_finish(r);
+      } else if(r->body == HTTP_REQUEST_BODY_CONTENT_LEN && r->content_length == 0) {
+	http_request_finish(r);
+      } else if(r->body == HTTP_REQUEST_BODY_NONE) {
+	// body ends, when the server closes the connection
+	r->body = HTTP_REQUEST_BODY_CLOSE;
+	r->http->keep_alive = false;
       }
-    } else if(r->pair == HTTP_REQUEST_PAIR_VALUE) {
-      if(c == '\r') {
+      
+      return false;
+    }
 
-	static char content_length_cstr[] = "content-length";
-	static size_t content_length_cstr_len = sizeof(content_length_cstr) - 1;
+    if(colon > line_len) {
+      HTTP_LOG("Header without ':' : '%.*s'", (int) line_len, line);
+      r->state = HTTP_REQUEST_STATE_ERROR;
+      return false;
+    }
 
-	if(http_header_eq(r->key, r->key_len, content_length_cstr, content_length_cstr_len)) {
+    // 'Key: Value'
+    size_t value_start = colon + 1;
+    while(value_start < line_len && (line[value_start] == ' ' || line[value_start] == '\t')) value_start++;
+    size_t value_end = line_len;
+    while(value_end > value_start && (line[value_end - 1] == ' ' || line[value_end - 1] == '\t')) value_end--;
 
-	  size_t len = r->value_len - 1;
-	  if(!http_parse_u64(r->value, len, &r->content_length)) {
-	    HTTP_LOG("Failed to parse: '%.*s'", (int) len, r->value);
-	    r->state = HTTP_REQUEST_STATE_ERROR;
-	    return false;
-	  }
+    line[colon] = 0;
+    line[value_end] = 0;
+    header->key = line;
+    header->key_len = colon;
+    header->value = line + value_start;
+    header->value_len = value_end - value_start;
 
-	  if(r->body != HTTP_REQUEST_BODY_NONE) {
-	    HTTP_LOG("Http-Body was already specified");
-	    r->state = HTTP_REQUEST_STATE_ERROR;
-	    return false;
- 
-	  }
-	  r->body = HTTP_REQUEST_BODY_CONTENT_LEN;
-	  r->content_read = 0;	  
-	}
+    static char content_length_cstr[] = "content-length";
+    static size_t content_length_cstr_len = sizeof(content_length_cstr) - 1;
 
-	static char chunked_encoding[] = "transfer-encoding";
-	static size_t chunked_encoding_len = sizeof(chunked_encoding) - 1;
-	static char chunked[] = "chunked";
-	static size_t chunked_len = sizeof(chunked) - 1;
-	
-	if(http_header_eq(r->key, r->key_len, chunked_encoding, chunked_encoding_len) &&
-	   http_header_eq(r->value, r->value_len - 1, chunked, chunked_len)) {
-	  if(r->body != HTTP_REQUEST_BODY_NONE) {
-	    HTTP_LOG("Http-Body was already specified");
-	    r->state = HTTP_REQUEST_STATE_ERROR;
-	    return false;
- 
-	  }
-	  r->body = HTTP_REQUEST_BODY_CHUNKED;
-	  r->content_length = 0;
-	  r->content_read = 0;
-	}
+    if(http_header_eq(header->key, header->key_len, content_length_cstr, content_length_cstr_len)) {
 
-        r->key[r->key_len] = 0;
-	r->value[r->value_len - 1] = 0;
+      if(!http_parse_u64(header->value, header->value_len, &r->content_length)) {
+	HTTP_LOG("Failed to parse: '%.*s'", (int) header->value_len, header->value);
+	r->state = HTTP_REQUEST_STATE_ERROR;
+	return false;
+      }
 
-	header->key = r->key;
-	header->key_len = r->key_len;
-	header->value = r->value;
-	header->value_len = r->value_len - 1;
-	
-	r->pair = HTTP_REQUEST_PAIR_INVALID;
-	r->value_len = 0;
-	r->key_len = 0;
+      if(r->body != HTTP_REQUEST_BODY_NONE) {
+	HTTP_LOG("Http-Body was already specified");
+	r->state = HTTP_REQUEST_STATE_ERROR;
+	return false;
 
-	r->buffer_pos  += i - 1;
-	r->buffer_size -= i - 1;
+      }
+      r->body = HTTP_REQUEST_BODY_CONTENT_LEN;
+      r->content_read = 0;	  
+    }
+
+    static char chunked_encoding[] = "transfer-encoding";
+    static size_t chunked_encoding_len = sizeof(chunked_encoding) - 1;
+    static char chunked[] = "chunked";
+    static size_t chunked_len = sizeof(chunked) - 1;
+
+    if(http_header_eq(header->key, header->key_len, chunked_encoding, chunked_encoding_len) &&
+       http_header_eq(header->value, header->value_len, chunked, chunked_len)) {
+      if(r->body != HTTP_REQUEST_BODY_NONE) {
+	HTTP_LOG("Http-Body was already specified");
+	r->state = HTTP_REQUEST_STATE_ERROR;
+	return false;
 
-#ifdef HTTP_DEBUG
-	HTTP_LOG("%s=%s", header->key, header->value);
-#endif // HTTP_DEBUG
-	
-        return true;
-      } else {
-	assert(r->value_len < sizeof(r->value) - 1);
-	if(r->value_len == 0) r->value_len++;
-	else r->value[r->value_len++ - 1] = c;
       }
+      r->body = HTTP_REQUEST_BODY_CHUNKED;
+      r->content_length = 0;
+      r->content_read = 0;
     }
 
-    if(r->state == HTTP_REQUEST_STATE_BODY) {
-      r->buffer_pos  += i + 1;
-      r->buffer_size -= i + 1;
+    static char content_encoding[] = "content-encoding";
+    static size_t content_encoding_len = sizeof(content_encoding) - 1;
 
-      if(r->body == HTTP_REQUEST_BODY_CONTENT_LEN && r->content_length == 0) {
-	r->state = HTTP_REQUEST_STATE_DONE;
+    if(!r->server && http_header_eq(header->key, header->key_len, content_encoding, content_encoding_len)) {
+      if(http_header_eq(header->value, header->value_len, "gzip", 4) ||
+	 http_header_eq(header->value, header->value_len, "x-gzip", 6)) {
+	r->encoding = HTTP_REQUEST_ENCODING_GZIP;
+      } else if(http_header_eq(header->value, header->value_len, "deflate", 7)) {
+	r->encoding = HTTP_REQUEST_ENCODING_DEFLATE;
       }
-      
-      return false;
     }
 
+    static char connection[] = "connection";
+    static size_t connection_len = sizeof(connection) - 1;
+    static char close[] = "close";
+    static size_t close_len = sizeof(close) - 1;
+
+    if(http_header_eq(header->key, header->key_len, connection, connection_len) &&
+       http_header_eq(header->value, header->value_len, close, close_len)) {
+      r->http->keep_alive = false;
+    }
+
+#ifdef HTTP_DEBUG
+    HTTP_LOG("%s=%s", header->key, header->value);
+#endif // HTTP_DEBUG
+
+    return true;
   }
 
-  r->buffer_size = 0;
-  goto start;
+  return false;
 }
 
-HTTP_DEF bool http_next_body(Http_Request *r, char **data, size_t *data_len) {
+static bool http_next_body_raw(Http_Request *r, char **data, size_t *data_len) {
   
   // Maybe parse Headers
   if(r->state != HTTP_REQUEST_STATE_BODY) {
     Http_Header header;
     while(http_next_header(r, &header)) ;
+
+    if(r->state != HTTP_REQUEST_STATE_BODY &&
+       r->state != HTTP_REQUEST_STATE_DONE) {
+      return false;
+    }
   }
 
  start:
@@ -1307,6 +2845,9 @@ HTTP_DEF bool http_next_body(Http_Request *r, char **data, size_t *data_len) {
 	 }
 
 	 if(r->buffer_size == 0) {
+	   if(r->body == HTTP_REQUEST_BODY_CLOSE) {
+	     http_request_finish(r);
+	   }
 	   return false;
 	 }
 	 r->buffer_pos = 0;
@@ -1315,19 +2856,19 @@ HTTP_DEF bool http_next_body(Http_Request *r, char **data, size_t *data_len) {
   // Consume
   if(r->body == HTTP_REQUEST_BODY_CONTENT_LEN) {
 
-    if(r->content_read + r->buffer_size > r->content_length) {
-      HTTP_LOG("Server send too much data");
-      return false;
-    }
-    r->content_read += r->buffer_size;
+    // Everything after 'content_length' belongs to the next response
+    size_t len = r->content_length - r->content_read;
+    if(len > r->buffer_size) len = r->buffer_size;
+    r->content_read += len;
     
+    *data = r->buffer + r->buffer_pos;
+    *data_len = len;
+    r->buffer_pos += len;
+    r->buffer_size -= len;
+
     if(r->content_read == r->content_length) {
-      r->state = HTTP_REQUEST_STATE_DONE;
+      http_request_finish(r);
     }
-    
-    *data = r->buffer + r->buffer_pos;
-    *data_len = r->buffer_size;
-    r->buffer_size = 0;
 
 #ifndef HTTP_QUIET
     if(!r->ok) {
@@ -1336,11 +2877,18 @@ HTTP_DEF bool http_next_body(Http_Request *r, char **data, size_t *data_len) {
 #endif // HTTP_QUIET
 
     return true;
-  } else if(r->body == HTTP_REQUEST_BODY_CHUNKED) {
-
-    if(r->content_read > 0) {
-      size_t len = r->content_read;
-      if(len > r->buffer_size) len = r->buffer_size;
+  } else if(r->body == HTTP_REQUEST_BODY_CLOSE) {
+
+    *data = r->buffer + r->buffer_pos;
+    *data_len = r->buffer_size;
+    r->buffer_size = 0;
+
+    return true;
+  } else if(r->body == HTTP_REQUEST_BODY_CHUNKED) {
+
+    if(r->content_read > 0) {
+      size_t len = r->content_read;
+      if(len > r->buffer_size) len = r->buffer_size;
 
       *data = r->buffer + r->buffer_pos;
       *data_len = len;
@@ -1376,9 +2924,13 @@ HTTP_DEF bool http_next_body(Http_Request *r, char **data, size_t *data_len) {
       } else if(r->state2 == HTTP_REQUEST_STATE_RN) {
 	if(r->key_len == 0) { // terminating \r\n, look for new length
 	  if(r->chunked_debug) {
-	    r->state = HTTP_REQUEST_STATE_DONE;
+	    r->buffer_pos  += i + 1;
+	    r->buffer_size -= i + 1;
+	    http_request_finish(r);
 	    return false;
 	  }
+	} else if(r->chunked_debug) { // trailer, ignore
+	  r->key_len = 0;
 	} else { // parse length
 	  if(!http_parse_hex_u64(r->key, r->key_len, &r->content_read)) {
 	    HTTP_LOG("Failed to parse: '%.*s'", (int) r->key_len, r->key);
@@ -1412,6 +2964,551 @@ HTTP_DEF bool http_next_body(Http_Request *r, char **data, size_t *data_len) {
     
 }
 
+#ifdef HTTP_MINIZ
+
+// Skips the gzip-header (RFC 1952), which may be split across reads.
+// Returns the number of bytes, that belong to it.
+static size_t http_gzip_header(Http_Request *r, const unsigned char *data, size_t len) {
+  size_t i = 0;
+
+  while(r->inflate_state == HTTP_INFLATE_GZIP_HEADER) {
+    if(r->gzip_step == 0) { // ID1 ID2 CM FLG MTIME(4) XFL OS
+      if(i == len) break;
+      unsigned char c = data[i++];
+      if((r->gzip_pos == 0 && c != 0x1f) || (r->gzip_pos == 1 && c != 0x8b) || (r->gzip_pos == 2 && c != 8)) {
+	HTTP_LOG("Invalid gzip-header");
+	r->state = HTTP_REQUEST_STATE_ERROR;
+	return len;
+      }
+      if(r->gzip_pos == 3) r->gzip_flags = c;
+      if(++r->gzip_pos < 10) continue;
+      r->gzip_pos = 0;
+      r->gzip_step = (r->gzip_flags & 4) ? 1 : 3;
+    } else if(r->gzip_step == 1) { // FEXTRA: XLEN
+      if(i == len) break;
+      r->gzip_skip |= (size_t) data[i++] << (8 * r->gzip_pos);
+      if(++r->gzip_pos < 2) continue;
+      r->gzip_step = 2;
+    } else if(r->gzip_step == 2) { // FEXTRA
+      size_t n = len - i < r->gzip_skip ? len - i : r->gzip_skip;
+      i += n;
+      r->gzip_skip -= n;
+      if(r->gzip_skip > 0) break;
+      r->gzip_step = 3;
+    } else if(r->gzip_step == 3 || r->gzip_step == 4) { // FNAME, FCOMMENT: zero-terminated
+      unsigned char flag = r->gzip_step == 3 ? 8 : 16;
+      if(r->gzip_flags & flag) {
+	if(i == len) break;
+	if(data[i++] != 0) continue;
+      }
+      r->gzip_step++;
+      r->gzip_pos = 0;
+    } else { // FHCRC
+      if(r->gzip_flags & 2) {
+	if(i == len) break;
+	i++;
+	if(++r->gzip_pos < 2) continue;
+      }
+      r->inflate_state = HTTP_INFLATE_START;
+    }
+  }
+
+  return i;
+}
+
+static bool http_inflate(Http_Request *r, char *out, size_t out_cap, size_t *out_len) {
+  mz_stream *z = &r->inflate;
+  *out_len = 0;
+
+  if(r->inflate_state == HTTP_INFLATE_NONE) {
+    memset(z, 0, sizeof(*z));
+    r->inflate_more = false;
+    r->gzip_step = 0;
+    r->gzip_pos = 0;
+    r->gzip_skip = 0;
+    r->gzip_flags = 0;
+    r->inflate_state = r->encoding == HTTP_REQUEST_ENCODING_GZIP
+      ? HTTP_INFLATE_GZIP_HEADER
+      : HTTP_INFLATE_START;
+  }
+
+  while(true) {
+    // The decoder may hold more output, even without new input
+    if(z->avail_in == 0 && !r->inflate_more) {
+      char *data;
+      size_t len;
+      if(!http_next_body_raw(r, &data, &len)) {
+	return false;
+      }
+      z->next_in = (const unsigned char *) data;
+      z->avail_in = (unsigned int) len;
+    }
+
+    if(r->inflate_state == HTTP_INFLATE_GZIP_HEADER) {
+      size_t n = http_gzip_header(r, z->next_in, z->avail_in);
+      z->next_in += n;
+      z->avail_in -= (unsigned int) n;
+      if(r->state == HTTP_REQUEST_STATE_ERROR) {
+	return false;
+      }
+      continue;
+    }
+
+    if(r->inflate_state == HTTP_INFLATE_START) {
+      if(z->avail_in == 0) {
+	continue;
+      }
+
+      // 'deflate' should be zlib-wrapped (RFC 9110), but some servers send raw deflate
+      unsigned char cmf = z->next_in[0];
+      bool zlib = r->encoding == HTTP_REQUEST_ENCODING_DEFLATE && (cmf & 0x0f) == 8 && (cmf >> 4) <= 7;
+      if(mz_inflateInit2(z, zlib ? MZ_DEFAULT_WINDOW_BITS : -MZ_DEFAULT_WINDOW_BITS) != MZ_OK) {
+	r->state = HTTP_REQUEST_STATE_ERROR;
+	return false;
+      }
+      r->inflate_state = HTTP_INFLATE_STREAM;
+    }
+
+    if(r->inflate_state == HTTP_INFLATE_DONE) {
+      // gzip-trailer (CRC32, ISIZE)
+      z->avail_in = 0;
+      continue;
+    }
+
+    if(out_cap > UINT_MAX) out_cap = UINT_MAX;
+    z->next_out = (unsigned char *) out;
+    z->avail_out = (unsigned int) out_cap;
+
+    int status = mz_inflate(z, MZ_NO_FLUSH);
+    size_t produced = out_cap - z->avail_out;
+    // miniz stops at the end of the input, even if it could produce more output
+    r->inflate_more = produced > 0;
+
+    if(status == MZ_STREAM_END) {
+      mz_inflateEnd(z);
+      r->inflate_state = HTTP_INFLATE_DONE;
+      r->inflate_more = false;
+    } else if(status != MZ_OK && status != MZ_BUF_ERROR) {
+      HTTP_LOG("Failed to inflate the body: %d", status);
+      mz_inflateEnd(z);
+      r->inflate_state = HTTP_INFLATE_NONE;
+      r->state = HTTP_REQUEST_STATE_ERROR;
+      return false;
+    }
+
+    if(produced > 0) {
+      *out_len = produced;
+      return true;
+    }
+  }
+}
+
+#endif // HTTP_MINIZ
+
+HTTP_DEF bool http_next_body(Http_Request *r, char **data, size_t *data_len) {
+#ifdef HTTP_MINIZ
+  if(r->state != HTTP_REQUEST_STATE_BODY) {
+    Http_Header header;
+    while(http_next_header(r, &header)) ;
+  }
+
+  if(r->encoding != HTTP_REQUEST_ENCODING_NONE && !r->head) {
+    *data = r->inflated;
+    return http_inflate(r, r->inflated, sizeof(r->inflated), data_len);
+  }
+#endif // HTTP_MINIZ
+
+  return http_next_body_raw(r, data, data_len);
+}
+
+HTTP_DEF bool http_next_body_into(Http_Request *r, char *dst, size_t dst_cap, size_t *data_len) {
+  *data_len = 0;
+
+  // Maybe parse Headers
+  if(r->state != HTTP_REQUEST_STATE_BODY) {
+    Http_Header header;
+    while(http_next_header(r, &header)) ;
+  }
+  if(dst_cap == 0) {
+    return false;
+  }
+
+#ifdef HTTP_MINIZ
+  // The decoder may still hold output, when the response is already DONE
+  if(r->encoding != HTTP_REQUEST_ENCODING_NONE && !r->head) {
+    return http_inflate(r, dst, dst_cap, data_len);
+  }
+#endif // HTTP_MINIZ
+
+  if(r->state != HTTP_REQUEST_STATE_BODY) {
+    return false;
+  }
+
+  // How much may be read, without passing the end of the body (or chunk)
+  size_t want = 0;
+  if(r->body == HTTP_REQUEST_BODY_CONTENT_LEN) {
+    want = r->content_length - r->content_read;
+  } else if(r->body == HTTP_REQUEST_BODY_CLOSE) {
+    want = dst_cap;
+  } else if(r->body == HTTP_REQUEST_BODY_CHUNKED) {
+    want = r->content_read;
+  }
+
+  if(want == 0) {
+    // The chunk-framing is parsed by http_next_body
+    char *data;
+    size_t len;
+    if(!http_next_body_raw(r, &data, &len)) {
+      return false;
+    }
+
+    // What does not fit, stays buffered
+    if(len > dst_cap) {
+      size_t excess = len - dst_cap;
+      r->buffer_pos -= excess;
+      r->buffer_size += excess;
+      r->content_read += excess;
+      r->content_length -= excess;
+      len = dst_cap;
+    }
+    memcpy(dst, data, len);
+    *data_len = len;
+    return true;
+  }
+  if(want > dst_cap) want = dst_cap;
+  if(want > INT_MAX) want = INT_MAX;
+
+  size_t n;
+  if(r->buffer_size > 0) {
+    n = want < r->buffer_size ? want : r->buffer_size;
+    memcpy(dst, r->buffer + r->buffer_pos, n);
+    r->buffer_pos += n;
+    r->buffer_size -= n;
+  } else {
+    if(!HTTP_READ_FUNC(dst, want, r->http, &n)) {
+      return false;
+    }
+    if(n == 0) {
+      if(r->body == HTTP_REQUEST_BODY_CLOSE) {
+	http_request_finish(r);
+      }
+      return false;
+    }
+  }
+
+  if(r->body == HTTP_REQUEST_BODY_CONTENT_LEN) {
+    r->content_read += n;
+    if(r->content_read == r->content_length) {
+      http_request_finish(r);
+    }
+  } else if(r->body == HTTP_REQUEST_BODY_CHUNKED) {
+    r->content_read -= n;
+    r->content_length += n;
+  }
+
+  *data_len = n;
+  return true;
+}
+
+#ifdef linux
+static bool http_write_all(int fd, const char *data, size_t size) {
+  while(size > 0) {
+    ssize_t ret = write(fd, data, size);
+    if(ret < 0 && errno == EINTR) continue;
+    if(ret <= 0) {
+      return false;
+    }
+    data += ret;
+    size -= (size_t) ret;
+  }
+  return true;
+}
+
+// socket -> pipe -> file, without a copy into userspace
+static bool http_body_splice(Http_Request *r, int fd, size_t read_size, uint64_t *written) {
+  int pipes[2];
+  if(pipe(pipes) < 0) {
+    return false;
+  }
+
+  bool ok = true;
+  while(r->state == HTTP_REQUEST_STATE_BODY) {
+    size_t want = read_size;
+    if(r->body == HTTP_REQUEST_BODY_CONTENT_LEN &&
+       r->content_length - r->content_read < want) {
+      want = r->content_length - r->content_read;
+    }
+
+    // SPLICE_F_MOVE | SPLICE_F_MORE
+    long in = syscall(SYS_splice, r->http->socket, NULL, pipes[1], NULL, want, 1 | 4);
+    r->http->reads++;
+    if(in < 0 && errno == EINTR) continue;
+    if(in < 0) {
+      ok = false;
+      break;
+    }
+    if(in == 0) {
+      if(r->body == HTTP_REQUEST_BODY_CLOSE) {
+	http_request_finish(r);
+      } else {
+	ok = false;
+      }
+      break;
+    }
+
+    long left = in;
+    while(left > 0) {
+      long out = syscall(SYS_splice, pipes[0], NULL, fd, NULL, (size_t) left, 1 | 4);
+      if(out < 0 && errno == EINTR) continue;
+      if(out <= 0) {
+	ok = false;
+	break;
+      }
+      left -= out;
+    }
+    if(!ok) {
+      break;
+    }
+
+    *written += (uint64_t) in;
+    r->http->bytes_received += (uint64_t) in;
+    if(r->body == HTTP_REQUEST_BODY_CONTENT_LEN) {
+      r->content_read += (size_t) in;
+      if(r->content_read == r->content_length) {
+	http_request_finish(r);
+      }
+    }
+  }
+
+  close(pipes[0]);
+  close(pipes[1]);
+  return ok;
+}
+#endif // linux
+
+HTTP_DEF bool http_body_to_fd(Http_Request *r, Http_File file, size_t read_size, uint64_t *written) {
+  if(read_size == 0) read_size = HTTP_BODY_READ_SIZE;
+  *written = 0;
+
+  // Maybe parse Headers
+  if(r->state != HTTP_REQUEST_STATE_BODY) {
+    Http_Header header;
+    while(http_next_header(r, &header)) ;
+  }
+  if(r->state == HTTP_REQUEST_STATE_DONE && r->encoding == HTTP_REQUEST_ENCODING_NONE) {
+    return true;
+  }
+  if(r->state != HTTP_REQUEST_STATE_BODY && r->state != HTTP_REQUEST_STATE_DONE) {
+    return false;
+  }
+
+#ifdef linux
+  bool plain = true;
+#  ifdef HTTP_OPEN_SSL
+  plain = r->http->conn == NULL;
+#  endif // HTTP_OPEN_SSL
+
+  // The rest of the buffer has to be written, before the socket is spliced
+  if(r->encoding == HTTP_REQUEST_ENCODING_NONE &&
+     (r->body == HTTP_REQUEST_BODY_CONTENT_LEN || r->body == HTTP_REQUEST_BODY_CLOSE)) {
+    size_t len = r->buffer_size;
+    if(r->body == HTTP_REQUEST_BODY_CONTENT_LEN && r->content_length - r->content_read < len) {
+      len = r->content_length - r->content_read;
+    }
+    if(!http_write_all(file, r->buffer + r->buffer_pos, len)) {
+      return false;
+    }
+    r->buffer_pos += len;
+    r->buffer_size -= len;
+    *written += len;
+    if(r->body == HTTP_REQUEST_BODY_CONTENT_LEN) {
+      r->content_read += len;
+      if(r->content_read == r->content_length) {
+	http_request_finish(r);
+	return true;
+      }
+    }
+
+    if(plain && !(fcntl(r->http->socket, F_GETFL, 0) & O_NONBLOCK)) {
+      return http_body_splice(r, file, read_size, written);
+    }
+  }
+#endif // linux
+
+  char *buffer = malloc(read_size);
+  if(!buffer) {
+    return false;
+  }
+
+  size_t len;
+  while(http_next_body_into(r, buffer, read_size, &len)) {
+#ifdef _WIN32
+    DWORD n;
+    if(!WriteFile(file, buffer, (DWORD) len, &n, NULL) || n != len) {
+      free(buffer);
+      return false;
+    }
+#else
+    if(!http_write_all(file, buffer, len)) {
+      free(buffer);
+      return false;
+    }
+#endif // _WIN32
+    *written += len;
+  }
+
+  free(buffer);
+  return r->state == HTTP_REQUEST_STATE_DONE;
+}
+
+HTTP_DEF bool http_body_to_file(Http_Request *r, const char *filepath, size_t read_size, uint64_t *written) {
+#ifdef _WIN32
+  HANDLE file = CreateFileA(filepath, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+  if(file == INVALID_HANDLE_VALUE) {
+    HTTP_LOG("Can not open '%s'", filepath);
+    return false;
+  }
+  bool ok = http_body_to_fd(r, file, read_size, written);
+  CloseHandle(file);
+  return ok;
+#elif linux
+  int fd = open(filepath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if(fd < 0) {
+    HTTP_LOG("Can not open '%s'", filepath);
+    return false;
+  }
+  bool ok = http_body_to_fd(r, fd, read_size, written);
+  close(fd);
+  return ok;
+#else
+  HTTP_LOG("Unsupported platform. Implement: http_body_to_file");
+
+  (void) r;
+  (void) filepath;
+  (void) read_size;
+  (void) written;
+  return false;
+#endif // _WIN32
+}
+
+HTTP_DEF bool http_parse_status_line(Http_Request *r, char *line, size_t line_len) {
+
+  // 'HTTP/1.1 '
+  static char http1_prefix[] = "HTTP";
+  static size_t http1_prefix_len = sizeof(http1_prefix) - 1;
+
+  if(line_len < http1_prefix_len ||
+     memcmp(http1_prefix, line, http1_prefix_len) != 0) {
+    HTTP_LOG("http1-prefix is not present: '%.*s'", (int) line_len, line);
+    return false;
+  }
+
+  // '200'
+  if(line_len < http1_prefix_len + 5 + 3) {
+    HTTP_LOG("http1 responseCode is not present");
+    return false;
+  }
+
+  uint64_t out;
+  if(!http_parse_u64(line + 5 + http1_prefix_len, 3, &out)) {
+    return false;
+  }
+  r->response_code = (int) out;
+
+  r->ok = 199 <= r->response_code && r->response_code <= 299;
+
+  // 'HTTP/1.0' closes the connection after the response
+  if(line[http1_prefix_len + 3] == '0') {
+    r->http->keep_alive = false;
+  }
+
+#ifndef HTTP_QUIET
+  if(!r->ok) {
+    HTTP_LOG("Request to %s has failed with the code: %d", r->http->hostname, r->response_code);
+  }
+#endif // HTTP_QUIET
+
+  return true;
+}
+
+// The request-line is copied, since it has to outlive the receive-buffer
+HTTP_DEF bool http_parse_request_line(Http_Request *r, char *line, size_t line_len) {
+  if(line_len >= sizeof(r->line)) {
+    return false;
+  }
+  memcpy(r->line, line, line_len);
+  r->line[line_len] = 0;
+
+  char *method_end = memchr(r->line, ' ', line_len);
+  if(!method_end) {
+    return false;
+  }
+  *method_end = 0;
+  r->method = r->line;
+  r->method_len = method_end - r->line;
+
+  r->route = method_end + 1;
+  char *route_end = memchr(r->route, ' ', line_len - r->method_len - 1);
+  if(!route_end) {
+    return false;
+  }
+  *route_end = 0;
+  r->route_len = route_end - r->route;
+
+  // 'HTTP/1.0' closes the connection after the response
+  static char http1_prefix[] = "HTTP/1.";
+  static size_t http1_prefix_len = sizeof(http1_prefix) - 1;
+  char *version = route_end + 1;
+  if(strncmp(version, http1_prefix, http1_prefix_len) != 0) {
+    return false;
+  }
+  if(version[http1_prefix_len] == '0') {
+    r->http->keep_alive = false;
+  }
+  r->ok = true;
+
+  return true;
+}
+
+// Returns the position of the first '\n' (or 'data_len') and stores the position
+// of the first ':' before it in 'colon' (or 'data_len').
+HTTP_DEF size_t http_scan_line(const char *data, size_t data_len, size_t *colon) {
+  size_t i = 0;
+  *colon = data_len;
+
+#ifdef HTTP_SSE2
+  const __m128i lf = _mm_set1_epi8('\n');
+  const __m128i dots = _mm_set1_epi8(':');
+
+  for(;i + 16 <= data_len;i+=16) {
+    __m128i block = _mm_loadu_si128((const __m128i *) (data + i));
+    unsigned int lf_mask = (unsigned int) _mm_movemask_epi8(_mm_cmpeq_epi8(block, lf));
+    unsigned int dots_mask = (unsigned int) _mm_movemask_epi8(_mm_cmpeq_epi8(block, dots));
+
+    if(*colon == data_len && dots_mask) {
+      size_t pos = i + HTTP_CTZ(dots_mask);
+      if(!lf_mask || pos < i + HTTP_CTZ(lf_mask)) {
+	*colon = pos;
+      }
+    }
+    if(lf_mask) {
+      return i + HTTP_CTZ(lf_mask);
+    }
+  }
+#endif // HTTP_SSE2
+
+  for(;i<data_len;i++) {
+    if(data[i] == '\n') {
+      return i;
+    }
+    if(data[i] == ':' && *colon == data_len) {
+      *colon = i;
+    }
+  }
+
+  return data_len;
+}
+
 HTTP_DEF bool http_parse_hex_u64(char *buffer, size_t buffer_len, uint64_t *out) {
   size_t i = 0;
   uint64_t res = 0;
@@ -1481,28 +3578,187 @@ HTTP_DEF bool http_header_eq(const char *key, size_t key_len, const char *value,
 
 //////////////////////////////////////////////////////////////////////////////////////////////
 
+#ifdef _MSC_VER
+#  define http_atomic_add(p, v) InterlockedExchangeAdd64((volatile LONG64 *) (p), (LONG64) (v))
+#  define http_atomic_load(p) ((uint64_t) InterlockedCompareExchange64((volatile LONG64 *) (p), 0, 0))
+#  define http_atomic_store(p, v) InterlockedExchange64((volatile LONG64 *) (p), (LONG64) (v))
+#  define http_atomic_cas(p, expected, desired) \
+  ((uint64_t) InterlockedCompareExchange64((volatile LONG64 *) (p), (LONG64) (desired), (LONG64) (expected)) == (expected))
+#else
+#  define http_atomic_add(p, v) __atomic_fetch_add((p), (v), __ATOMIC_RELAXED)
+#  define http_atomic_load(p) __atomic_load_n((p), __ATOMIC_RELAXED)
+#  define http_atomic_store(p, v) __atomic_store_n((p), (v), __ATOMIC_RELAXED)
+#  define http_atomic_cas(p, expected, desired) \
+  __atomic_compare_exchange_n((p), &(expected), (desired), true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)
+#endif // _MSC_VER
+
+#define HTTP_HISTOGRAM_SUB (1 << HTTP_HISTOGRAM_SUB_BITS)
+
+static size_t http_histogram_bucket(uint64_t value) {
+  if(value < HTTP_HISTOGRAM_SUB) {
+    return (size_t) value;
+  }
 
-HTTP_DEF bool http_sendf(Http_Sendf_Callback send_callback, void *userdata,
-			 char *buffer, size_t buffer_cap, const char *format, ...) {
-  va_list va;
-  va_start(va, format);
-  bool result = http_sendf_impl(send_callback, userdata, buffer, buffer_cap, format, va);
-  va_end(va);
-  return result;
+#ifdef _MSC_VER
+  unsigned long e;
+  _BitScanReverse64(&e, value);
+#else
+  unsigned int e = 63 - (unsigned int) __builtin_clzll(value);
+#endif // _MSC_VER
+
+  // The exponent selects the group, the next HTTP_HISTOGRAM_SUB_BITS bits the bucket in it
+  return ((size_t) (e - HTTP_HISTOGRAM_SUB_BITS + 1) << HTTP_HISTOGRAM_SUB_BITS) +
+    (size_t) ((value >> (e - HTTP_HISTOGRAM_SUB_BITS)) & (HTTP_HISTOGRAM_SUB - 1));
 }
 
-HTTP_DEF bool http_sendf_impl(Http_Sendf_Callback send_callback, void *userdata,
-			      char *buffer, size_t buffer_cap, const char *format, va_list va) {
-  Http_Sendf_Context context = {0};
-  context.send_callback = send_callback;
-  context.buffer = buffer;
-  context.buffer_cap = buffer_cap;
-  context.userdata = userdata;
-  context.last = false;
+// The highest value, that falls into 'bucket'
+static uint64_t http_histogram_bucket_value(size_t bucket) {
+  if(bucket < HTTP_HISTOGRAM_SUB) {
+    return (uint64_t) bucket;
+  }
 
-  size_t buffer_size = 0;
-  size_t format_len = strlen(format);
-  size_t format_last = 0;
+  size_t shift = (bucket >> HTTP_HISTOGRAM_SUB_BITS) - 1;
+  uint64_t low = (uint64_t) (HTTP_HISTOGRAM_SUB + (bucket & (HTTP_HISTOGRAM_SUB - 1))) << shift;
+  return low + ((uint64_t) 1 << shift) - 1;
+}
+
+HTTP_DEF void http_histogram_record(Http_Histogram *h, uint64_t value) {
+  http_atomic_add(&h->counts[http_histogram_bucket(value)], 1);
+  http_atomic_add(&h->count, 1);
+  http_atomic_add(&h->sum, value);
+
+  uint64_t max = http_atomic_load(&h->max);
+  while(value > max) {
+    if(http_atomic_cas(&h->max, max, value)) {
+      break;
+    }
+    max = http_atomic_load(&h->max);
+  }
+}
+
+HTTP_DEF uint64_t http_histogram_quantile(Http_Histogram *h, double q) {
+  uint64_t count = http_atomic_load(&h->count);
+  if(count == 0) {
+    return 0;
+  }
+
+  uint64_t rank = (uint64_t) (q * (double) count);
+  if(rank >= count) rank = count - 1;
+
+  uint64_t max = http_atomic_load(&h->max);
+  uint64_t seen = 0;
+  for(size_t i=0;i<HTTP_HISTOGRAM_BUCKETS;i++) {
+    seen += http_atomic_load(&h->counts[i]);
+    if(seen > rank) {
+      uint64_t value = http_histogram_bucket_value(i);
+      return value < max ? value : max;
+    }
+  }
+
+  return max;
+}
+
+HTTP_DEF void http_histogram_reset(Http_Histogram *h) {
+  for(size_t i=0;i<HTTP_HISTOGRAM_BUCKETS;i++) {
+    http_atomic_store(&h->counts[i], 0);
+  }
+  http_atomic_store(&h->count, 0);
+  http_atomic_store(&h->sum, 0);
+  http_atomic_store(&h->max, 0);
+}
+
+static Http_Metrics http_global_metrics = {0};
+
+HTTP_DEF Http_Metrics *http_metrics() {
+  return &http_global_metrics;
+}
+
+HTTP_DEF void http_metrics_record(Http_Timings *t) {
+  Http_Metrics *m = &http_global_metrics;
+
+  if(t->dns_ns) http_histogram_record(&m->dns, t->dns_ns);
+  if(t->connect_ns) http_histogram_record(&m->connect, t->connect_ns);
+  if(t->tls_ns) http_histogram_record(&m->tls, t->tls_ns);
+  http_histogram_record(&m->send, t->send_ns);
+  http_histogram_record(&m->ttfb, t->ttfb_ns);
+  http_histogram_record(&m->body, t->body_ns);
+  http_histogram_record(&m->total, t->total_ns);
+  http_histogram_record(&m->bytes_sent, t->bytes_sent);
+  http_histogram_record(&m->bytes_received, t->bytes_received);
+  http_histogram_record(&m->reads, t->reads);
+}
+
+HTTP_DEF void http_metrics_reset() {
+  Http_Metrics *m = &http_global_metrics;
+  Http_Histogram *hs[] = { &m->dns, &m->connect, &m->tls, &m->send, &m->ttfb, &m->body, &m->total,
+			   &m->bytes_sent, &m->bytes_received, &m->reads };
+  for(size_t i=0;i<sizeof(hs)/sizeof(*hs);i++) {
+    http_histogram_reset(hs[i]);
+  }
+}
+
+HTTP_DEF void http_metrics_dump(FILE *f) {
+  Http_Metrics *m = &http_global_metrics;
+  struct{ const char *name; Http_Histogram *h; bool ns; }rows[] = {
+    { "dns (us)", &m->dns, true },
+    { "connect (us)", &m->connect, true },
+    { "tls (us)", &m->tls, true },
+    { "send (us)", &m->send, true },
+    { "ttfb (us)", &m->ttfb, true },
+    { "body (us)", &m->body, true },
+    { "total (us)", &m->total, true },
+    { "bytes_sent", &m->bytes_sent, false },
+    { "bytes_received", &m->bytes_received, false },
+    { "reads", &m->reads, false },
+  };
+  static const double quantiles[] = { 0.5, 0.9, 0.99, 0.999 };
+
+  fprintf(f, "%-16s %10s %10s %10s %10s %10s %10s %10s\n",
+	  "", "count", "p50", "p90", "p99", "p999", "max", "mean");
+  for(size_t i=0;i<sizeof(rows)/sizeof(*rows);i++) {
+    Http_Histogram *h = rows[i].h;
+    uint64_t count = http_atomic_load(&h->count);
+    if(count == 0) {
+      continue;
+    }
+
+    // Timings are printed in microseconds
+    double scale = rows[i].ns ? 1000.0 : 1.0;
+    fprintf(f, "%-16s %10llu", rows[i].name, (unsigned long long) count);
+    for(size_t j=0;j<sizeof(quantiles)/sizeof(*quantiles);j++) {
+      fprintf(f, " %10.1f", (double) http_histogram_quantile(h, quantiles[j]) / scale);
+    }
+    fprintf(f, " %10.1f %10.1f\n",
+	    (double) http_atomic_load(&h->max) / scale,
+	    (double) http_atomic_load(&h->sum) / (double) count / scale);
+  }
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////
+
+HTTP_DEF bool http_sendf(Http_Sendf_Callback send_callback, void *userdata,
+			 char *buffer, size_t buffer_cap, const char *format, ...) {
+  va_list va;
+  va_start(va, format);
+  bool result = http_sendf_impl(send_callback, userdata, buffer, buffer_cap, format, va);
+  va_end(va);
+  return result;
+}
+
+#define HTTP_SENDF_DIGIT_BUFFER_CAP 32
+
+HTTP_DEF bool http_sendf_impl(Http_Sendf_Callback send_callback, void *userdata,
+			      char *buffer, size_t buffer_cap, const char *format, va_list va) {
+  Http_Sendf_Context context = {0};
+  context.send_callback = send_callback;
+  context.buffer = buffer;
+  context.buffer_cap = buffer_cap;
+  context.userdata = userdata;
+  context.last = false;
+
+  size_t buffer_size = 0;
+  size_t format_len = strlen(format);
+  size_t format_last = 0;
 
   for(size_t i=0;i<format_len;i++) {
     if(format[i]=='%' && i+1 < format_len) {
@@ -1525,6 +3781,24 @@ HTTP_DEF bool http_sendf_impl(Http_Sendf_Callback send_callback, void *userdata,
 
 	format_last = i+2;
 	i++;
+      } else if((format[i+1] == 'z' && i+2 < format_len && format[i+2] == 'u') ||
+		(format[i+1] == 'l' && i+3 < format_len && format[i+2] == 'l' && format[i+3] == 'u')) { // %zu, %llu
+	bool z = format[i+1] == 'z';
+	unsigned long long n = z ? (unsigned long long) va_arg(va, size_t) : va_arg(va, unsigned long long);
+
+	char digit_buffer[HTTP_SENDF_DIGIT_BUFFER_CAP];
+	size_t digit_buffer_count = 0;
+	do {
+	  digit_buffer[HTTP_SENDF_DIGIT_BUFFER_CAP - digit_buffer_count++ - 1] = (char) (n % 10) + '0';
+	  n = n / 10;
+	} while(n > 0);
+	if(!http_sendf_impl_send(&context, &buffer_size,
+				 digit_buffer + (HTTP_SENDF_DIGIT_BUFFER_CAP - digit_buffer_count), digit_buffer_count)) {
+	  return false;
+	}
+
+	format_last = i + (z ? 3 : 4);
+	i += z ? 2 : 3;
       } else if(format[i+1]=='d') { // %d
 	int n = va_arg(va, int);
 
@@ -1534,8 +3808,7 @@ HTTP_DEF bool http_sendf_impl(Http_Sendf_Callback send_callback, void *userdata,
 	    return false;
 	  }	  
 	} else {
-#define HTTP_SENDF_DIGIT_BUFFER_CAP 32
-	  static char digit_buffer[HTTP_SENDF_DIGIT_BUFFER_CAP ];
+	  char digit_buffer[HTTP_SENDF_DIGIT_BUFFER_CAP];
 	  size_t digit_buffer_count = 0;
 	  bool was_negative = false;
 	  if(n < 0) {
@@ -1617,6 +3890,2673 @@ HTTP_DEF size_t http_sendf_impl_copy(Http_Sendf_Context *context, size_t buffer_
 
 }
 
+//////////////////////////////////////////////////////////////////////////////////////////////
+
+HTTP_DEF void http_mutex_init(Http_Mutex *mutex) {
+#ifdef _WIN32
+  InitializeCriticalSection(mutex);
+#else
+  pthread_mutex_init(mutex, NULL);
+#endif // _WIN32
+}
+
+HTTP_DEF void http_mutex_lock(Http_Mutex *mutex) {
+#ifdef _WIN32
+  EnterCriticalSection(mutex);
+#else
+  pthread_mutex_lock(mutex);
+#endif // _WIN32
+}
+
+HTTP_DEF void http_mutex_unlock(Http_Mutex *mutex) {
+#ifdef _WIN32
+  LeaveCriticalSection(mutex);
+#else
+  pthread_mutex_unlock(mutex);
+#endif // _WIN32
+}
+
+HTTP_DEF void http_mutex_free(Http_Mutex *mutex) {
+#ifdef _WIN32
+  DeleteCriticalSection(mutex);
+#else
+  pthread_mutex_destroy(mutex);
+#endif // _WIN32
+}
+
+HTTP_DEF void http_cond_init(Http_Cond *cond) {
+#ifdef _WIN32
+  InitializeConditionVariable(cond);
+#else
+  pthread_cond_init(cond, NULL);
+#endif // _WIN32
+}
+
+HTTP_DEF void http_cond_wait(Http_Cond *cond, Http_Mutex *mutex) {
+#ifdef _WIN32
+  SleepConditionVariableCS(cond, mutex, INFINITE);
+#else
+  pthread_cond_wait(cond, mutex);
+#endif // _WIN32
+}
+
+HTTP_DEF void http_cond_broadcast(Http_Cond *cond) {
+#ifdef _WIN32
+  WakeAllConditionVariable(cond);
+#else
+  pthread_cond_broadcast(cond);
+#endif // _WIN32
+}
+
+HTTP_DEF void http_cond_free(Http_Cond *cond) {
+#ifdef _WIN32
+  (void) cond;
+#else
+  pthread_cond_destroy(cond);
+#endif // _WIN32
+}
+
+HTTP_DEF uint64_t http_now_ns() {
+#ifdef _WIN32
+  static LARGE_INTEGER frequency = {0};
+  if(frequency.QuadPart == 0) {
+    QueryPerformanceFrequency(&frequency);
+  }
+
+  LARGE_INTEGER counter;
+  QueryPerformanceCounter(&counter);
+  return (uint64_t) (counter.QuadPart / frequency.QuadPart) * 1000000000ULL +
+    (uint64_t) (counter.QuadPart % frequency.QuadPart) * 1000000000ULL / (uint64_t) frequency.QuadPart;
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+#endif // _WIN32
+}
+
+// Checks without blocking, if an idle connection was closed by the server
+HTTP_DEF bool http_socket_alive(Http *http) {
+#ifdef _WIN32
+  fd_set set;
+  FD_ZERO(&set);
+  FD_SET(http->socket, &set);
+  struct timeval timeout = {0};
+  int ret = select(0, &set, NULL, NULL, &timeout);
+  if(ret == SOCKET_ERROR) {
+    return false;
+  }
+  if(ret == 0) {
+    return true;
+  }
+
+  char c;
+  ret = recv(http->socket, &c, 1, MSG_PEEK);
+  if(ret <= 0) {
+    return false;
+  }
+
+  // TLS may receive records (session tickets, ...) on an idle connection
+  return http->use_ssl;
+#elif linux
+  char c;
+  ssize_t ret = recv(http->socket, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+  if(ret == 0) {
+    return false;
+  }
+  if(ret > 0) {
+    // TLS may receive records (session tickets, ...) on an idle connection
+    return http->use_ssl;
+  }
+
+  return errno == EAGAIN || errno == EWOULDBLOCK;
+#else
+  (void) http;
+  return false;
+#endif // _WIN32
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////
+
+HTTP_DEF void http_pool_init(Http_Pool *pool, size_t max_per_host, uint64_t idle_timeout_ms) {
+  http_mutex_init(&pool->mutex);
+  http_cond_init(&pool->cond);
+
+  pool->conns = NULL;
+  pool->max_per_host = max_per_host;
+  pool->idle_timeout_ns = idle_timeout_ms * 1000000ULL;
+
+  memset(&pool->stats, 0, sizeof(pool->stats));
+}
+
+static void http_pool_remove(Http_Pool *pool, Http_Pool_Conn *conn) {
+  Http_Pool_Conn **it = &pool->conns;
+  while(*it != conn) it = &(*it)->next;
+  *it = conn->next;
+
+  if(conn->busy) {
+    pool->stats.busy--;
+  } else {
+    pool->stats.idle--;
+  }
+}
+
+static void http_pool_conn_free(Http_Pool_Conn *conn) {
+  if(conn->connected) {
+    http_free(&conn->http);
+  }
+  free(conn->hostname);
+  free(conn);
+}
+
+static void http_pool_evict_locked(Http_Pool *pool, uint64_t now) {
+  Http_Pool_Conn *conn = pool->conns;
+  while(conn) {
+    Http_Pool_Conn *next = conn->next;
+
+    if(!conn->busy && now - conn->idle_since >= pool->idle_timeout_ns) {
+      http_pool_remove(pool, conn);
+      http_pool_conn_free(conn);
+      pool->stats.evictions++;
+    }
+
+    conn = next;
+  }
+}
+
+HTTP_DEF bool http_pool_acquire(Http_Pool *pool, const char *hostname, uint16_t port, bool use_ssl, Http **http) {
+
+  http_mutex_lock(&pool->mutex);
+  http_pool_evict_locked(pool, http_now_ns());
+
+  uint64_t wait_start = 0;
+  Http_Pool_Conn *conn = NULL;
+
+  while(!conn) {
+
+    size_t count = 0;
+    Http_Pool_Conn *idle = NULL;
+    for(Http_Pool_Conn *it = pool->conns;it;it = it->next) {
+      if(it->port == port &&
+	 it->use_ssl == use_ssl &&
+	 strcmp(it->hostname, hostname) == 0) {
+	if(it->busy) {
+	  count++;
+	} else if(!idle) {
+	  idle = it;
+	}
+      }
+    }
+
+    if(idle) {
+      // Claim the connection and check it without holding the lock
+      idle->busy = true;
+      pool->stats.idle--;
+      pool->stats.busy++;
+      http_mutex_unlock(&pool->mutex);
+      bool alive = http_socket_alive(&idle->http);
+      http_mutex_lock(&pool->mutex);
+
+      if(alive) {
+	conn = idle;
+	pool->stats.hits++;
+	break;
+      }
+
+      http_pool_remove(pool, idle);
+      pool->stats.invalid++;
+      http_cond_broadcast(&pool->cond);
+      http_mutex_unlock(&pool->mutex);
+      http_pool_conn_free(idle);
+      http_mutex_lock(&pool->mutex);
+      continue;
+    }
+
+    if(count < pool->max_per_host) {
+
+      // Reserve the slot, while connecting without holding the lock
+      size_t hostname_len = strlen(hostname);
+      conn = malloc(sizeof(Http_Pool_Conn));
+      if(conn) conn->hostname = malloc(hostname_len + 1);
+      if(!conn || !conn->hostname) {
+	free(conn);
+	http_mutex_unlock(&pool->mutex);
+	return false;
+      }
+      memcpy(conn->hostname, hostname, hostname_len + 1);
+      conn->http = HTTP_INVALID;
+      conn->port = port;
+      conn->use_ssl = use_ssl;
+      conn->connected = false;
+      conn->busy = true;
+      conn->next = pool->conns;
+      pool->conns = conn;
+      pool->stats.misses++;
+      pool->stats.busy++;
+      break;
+    }
+
+    if(wait_start == 0) {
+      wait_start = http_now_ns();
+      pool->stats.waits++;
+    }
+    http_cond_wait(&pool->cond, &pool->mutex);
+  }
+
+  if(wait_start != 0) {
+    uint64_t wait_ns = http_now_ns() - wait_start;
+    pool->stats.wait_ns += wait_ns;
+    if(wait_ns > pool->stats.wait_ns_max) pool->stats.wait_ns_max = wait_ns;
+  }
+
+  http_mutex_unlock(&pool->mutex);
+
+  if(!conn->connected) {
+    conn->connected = true;
+
+    if(!http_init(hostname, port, use_ssl, &conn->http)) {
+      http_mutex_lock(&pool->mutex);
+      http_pool_remove(pool, conn);
+      http_cond_broadcast(&pool->cond);
+      http_mutex_unlock(&pool->mutex);
+
+      http_pool_conn_free(conn);
+      return false;
+    }
+  }
+
+  *http = &conn->http;
+  return true;
+}
+
+// Keeps the connection, if the previous responses were read completely and the
+// server did not close it. Otherwise the connection is closed.
+HTTP_DEF void http_pool_release(Http_Pool *pool, Http *http) {
+  Http_Pool_Conn *conn = (Http_Pool_Conn *) http;
+  bool reusable = http_reusable(http);
+
+  http_mutex_lock(&pool->mutex);
+
+  if(reusable) {
+    conn->busy = false;
+    conn->idle_since = http_now_ns();
+    pool->stats.busy--;
+    pool->stats.idle++;
+  } else {
+    http_pool_remove(pool, conn);
+  }
+
+  http_cond_broadcast(&pool->cond);
+  http_mutex_unlock(&pool->mutex);
+
+  if(!reusable) {
+    http_pool_conn_free(conn);
+  }
+}
+
+HTTP_DEF void http_pool_evict(Http_Pool *pool) {
+  http_mutex_lock(&pool->mutex);
+  http_pool_evict_locked(pool, http_now_ns());
+  http_mutex_unlock(&pool->mutex);
+}
+
+HTTP_DEF void http_pool_get_stats(Http_Pool *pool, Http_Pool_Stats *stats) {
+  http_mutex_lock(&pool->mutex);
+  *stats = pool->stats;
+  http_mutex_unlock(&pool->mutex);
+}
+
+HTTP_DEF void http_pool_free(Http_Pool *pool) {
+  Http_Pool_Conn *conn = pool->conns;
+  while(conn) {
+    Http_Pool_Conn *next = conn->next;
+    http_pool_conn_free(conn);
+    conn = next;
+  }
+  pool->conns = NULL;
+
+  http_cond_free(&pool->cond);
+  http_mutex_free(&pool->mutex);
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////
+
+#ifdef linux
+
+typedef struct{
+  Http_Pool *pool;
+  const char *hostname;
+  uint16_t port;
+  bool use_ssl;
+  const char *route;
+  char if_range[256];
+
+  int fd, part_fd;
+  off_t part_header;
+  uint64_t size;
+  size_t ranges_len;
+  unsigned char *done; // one byte per range
+
+  Http_Mutex mutex;
+  size_t next;
+  bool failed;
+  uint64_t downloaded;
+  size_t retries;
+}Http_Download;
+
+// 'bytes 0-99/1000'
+static bool http_download_content_range(char *value, size_t value_len, uint64_t *start, uint64_t *end) {
+  if(value_len < 6 || memcmp(value, "bytes ", 6) != 0) {
+    return false;
+  }
+  value += 6;
+  value_len -= 6;
+
+  size_t dash = 0;
+  while(dash < value_len && value[dash] != '-') dash++;
+  size_t slash = dash;
+  while(slash < value_len && value[slash] != '/') slash++;
+  if(slash == value_len) {
+    return false;
+  }
+
+  return http_parse_u64(value, dash, start) &&
+    http_parse_u64(value + dash + 1, slash - dash - 1, end);
+}
+
+static bool http_download_range(Http_Download *d, Http *http, size_t index, char *buffer, size_t buffer_cap) {
+  uint64_t start = (uint64_t) index * HTTP_DOWNLOAD_RANGE_SIZE;
+  uint64_t end = start + HTTP_DOWNLOAD_RANGE_SIZE;
+  if(end > d->size) end = d->size;
+
+  char headers[512];
+  snprintf(headers, sizeof(headers), "Range: bytes=%llu-%llu\r\n%s",
+	   (unsigned long long) start, (unsigned long long) (end - 1), d->if_range);
+
+  Http_Request r;
+  if(!http_request_from(http, d->route, "GET", headers, NULL, 0, &r)) {
+    return false;
+  }
+
+  // A '200 OK' means, that the server ignored the range or the resource changed (If-Range)
+  bool matches = false;
+  Http_Header header;
+  while(http_next_header(&r, &header)) {
+    uint64_t range_start, range_end;
+    if(http_header_eq(header.key, header.key_len, "content-range", 13) &&
+       http_download_content_range(header.value, header.value_len, &range_start, &range_end)) {
+      matches = range_start == start && range_end == end - 1;
+    }
+  }
+  if(r.response_code != 206 || !matches || r.encoding != HTTP_REQUEST_ENCODING_NONE) {
+    HTTP_LOG("Unexpected response for the range %llu-%llu: %d",
+	     (unsigned long long) start, (unsigned long long) (end - 1), r.response_code);
+    http_request_free(&r);
+    return false;
+  }
+
+  uint64_t offset = start;
+  size_t len;
+  while(http_next_body_into(&r, buffer, buffer_cap, &len)) {
+    if(offset + len > end) {
+      break;
+    }
+
+    size_t pos = 0;
+    while(pos < len) {
+      ssize_t ret = pwrite(d->fd, buffer + pos, len - pos, (off_t) (offset + pos));
+      if(ret < 0 && errno == EINTR) {
+	continue;
+      }
+      if(ret <= 0) {
+	http_request_free(&r);
+	return false;
+      }
+      pos += (size_t) ret;
+    }
+    offset += len;
+  }
+
+  bool ok = r.state == HTTP_REQUEST_STATE_DONE && offset == end;
+  http_request_free(&r);
+  return ok;
+}
+
+// The bytes have to be on disk, before the range is marked as done. Losing a mark
+// only means, that the range is downloaded again.
+static bool http_download_mark(Http_Download *d, size_t index) {
+  if(fdatasync(d->fd) < 0) {
+    return false;
+  }
+
+  unsigned char one = 1;
+  return pwrite(d->part_fd, &one, 1, d->part_header + (off_t) index) == 1;
+}
+
+static void *http_download_worker(void *_d) {
+  Http_Download *d = _d;
+
+  char *buffer = malloc(HTTP_BODY_READ_SIZE);
+  if(!buffer) {
+    http_mutex_lock(&d->mutex);
+    d->failed = true;
+    http_mutex_unlock(&d->mutex);
+    return NULL;
+  }
+
+  // The connection is kept for all ranges of this worker
+  Http *http = NULL;
+
+  while(true) {
+    http_mutex_lock(&d->mutex);
+    while(d->next < d->ranges_len && d->done[d->next]) d->next++;
+    if(d->failed || d->next == d->ranges_len) {
+      http_mutex_unlock(&d->mutex);
+      break;
+    }
+    size_t index = d->next++;
+    http_mutex_unlock(&d->mutex);
+
+    bool ok = false;
+    for(size_t attempt=0;!ok && attempt<HTTP_DOWNLOAD_RETRIES;attempt++) {
+      if(attempt > 0) {
+	http_mutex_lock(&d->mutex);
+	d->retries++;
+	http_mutex_unlock(&d->mutex);
+      }
+      if(!http && !http_pool_acquire(d->pool, d->hostname, d->port, d->use_ssl, &http)) {
+	http = NULL;
+	continue;
+      }
+
+      ok = http_download_range(d, http, index, buffer, HTTP_BODY_READ_SIZE);
+      if(!ok) {
+	// Whatever is left of the response, the connection can not be reused
+	http->keep_alive = false;
+	http_pool_release(d->pool, http);
+	http = NULL;
+      }
+    }
+
+    ok = ok && http_download_mark(d, index);
+
+    http_mutex_lock(&d->mutex);
+    if(ok) {
+      uint64_t start = (uint64_t) index * HTTP_DOWNLOAD_RANGE_SIZE;
+      uint64_t end = start + HTTP_DOWNLOAD_RANGE_SIZE;
+      d->downloaded += (end > d->size ? d->size : end) - start;
+    } else {
+      d->failed = true;
+    }
+    http_mutex_unlock(&d->mutex);
+    if(!ok) {
+      break;
+    }
+  }
+
+  if(http) {
+    http_pool_release(d->pool, http);
+  }
+  free(buffer);
+  return NULL;
+}
+
+// Reads the size, the validator and whether ranges are supported
+static bool http_download_head(Http_Download *d, bool *ranges, char *validator, size_t validator_cap) {
+  Http *http;
+  if(!http_pool_acquire(d->pool, d->hostname, d->port, d->use_ssl, &http)) {
+    return false;
+  }
+
+  Http_Request r;
+  if(!http_request_from(http, d->route, "HEAD", NULL, NULL, 0, &r)) {
+    http->keep_alive = false;
+    http_pool_release(d->pool, http);
+    return false;
+  }
+
+  char etag[128] = {0}, last_modified[64] = {0};
+  *ranges = false;
+
+  Http_Header header;
+  while(http_next_header(&r, &header)) {
+    if(http_header_eq(header.key, header.key_len, "accept-ranges", 13) &&
+       http_header_eq(header.value, header.value_len, "bytes", 5)) {
+      *ranges = true;
+    } else if(http_header_eq(header.key, header.key_len, "etag", 4) &&
+	      header.value_len < sizeof(etag)) {
+      memcpy(etag, header.value, header.value_len);
+      etag[header.value_len] = 0;
+    } else if(http_header_eq(header.key, header.key_len, "last-modified", 13) &&
+	      header.value_len < sizeof(last_modified)) {
+      memcpy(last_modified, header.value, header.value_len);
+      last_modified[header.value_len] = 0;
+    }
+  }
+
+  bool ok = r.state == HTTP_REQUEST_STATE_DONE && r.response_code == 200;
+  if(!ok) {
+    HTTP_LOG("HEAD '%s' failed: %d", d->route, r.response_code);
+  }
+
+  // Without a length, or with an encoded body, the ranges would not match the bytes
+  if(r.body != HTTP_REQUEST_BODY_CONTENT_LEN || r.encoding != HTTP_REQUEST_ENCODING_NONE) {
+    *ranges = false;
+  }
+  d->size = r.content_length;
+
+  // Weak ETags can not be used for If-Range
+  d->if_range[0] = 0;
+  if(etag[0] && strncmp(etag, "W/", 2) != 0) {
+    snprintf(d->if_range, sizeof(d->if_range), "If-Range: %s\r\n", etag);
+  }
+  snprintf(validator, validator_cap, "%s %s", etag, last_modified);
+
+  http_request_free(&r);
+  http_pool_release(d->pool, http);
+  return ok;
+}
+
+static bool http_download_single(Http_Download *d, const char *filepath, Http_Download_Stats *stats) {
+  Http *http;
+  if(!http_pool_acquire(d->pool, d->hostname, d->port, d->use_ssl, &http)) {
+    return false;
+  }
+
+  Http_Request r;
+  if(!http_request_from(http, d->route, "GET", NULL, NULL, 0, &r)) {
+    http->keep_alive = false;
+    http_pool_release(d->pool, http);
+    return false;
+  }
+
+  Http_Header header;
+  while(http_next_header(&r, &header)) ;
+
+  uint64_t written = 0;
+  bool ok = r.response_code == 200 && http_body_to_file(&r, filepath, 0, &written);
+  if(ok) {
+    stats->size = written;
+    stats->downloaded = written;
+  } else {
+    http->keep_alive = false;
+  }
+
+  http_request_free(&r);
+  http_pool_release(d->pool, http);
+  return ok;
+}
+
+#endif // linux
+
+HTTP_DEF bool http_download(Http_Pool *pool, const char *hostname, uint16_t port, bool use_ssl,
+			    const char *route, const char *filepath, size_t connections,
+			    Http_Download_Stats *_stats) {
+#ifdef linux
+  Http_Download_Stats unused;
+  Http_Download_Stats *stats = _stats ? _stats : &unused;
+  memset(stats, 0, sizeof(*stats));
+  uint64_t started_at = http_now_ns();
+
+  Http_Download d = {0};
+  d.pool = pool;
+  d.hostname = hostname;
+  d.port = port;
+  d.use_ssl = use_ssl;
+  d.route = route;
+  d.fd = -1;
+  d.part_fd = -1;
+
+  bool ranges;
+  char validator[256];
+  if(!http_download_head(&d, &ranges, validator, sizeof(validator))) {
+    return false;
+  }
+
+  if(!ranges || d.size == 0) {
+    stats->connections = 1;
+    bool ok = http_download_single(&d, filepath, stats);
+    stats->elapsed_ns = http_now_ns() - started_at;
+    return ok;
+  }
+
+  d.ranges_len = (size_t) ((d.size + HTTP_DOWNLOAD_RANGE_SIZE - 1) / HTTP_DOWNLOAD_RANGE_SIZE);
+  d.done = calloc(d.ranges_len, 1);
+  if(!d.done) {
+    return false;
+  }
+
+  char part_path[PATH_MAX];
+  if((size_t) snprintf(part_path, sizeof(part_path), "%s.part", filepath) >= sizeof(part_path)) {
+    free(d.done);
+    return false;
+  }
+
+  // '<filepath>.part': the header, followed by one byte per range
+  char part_header[512];
+  d.part_header = snprintf(part_header, sizeof(part_header), "http_download 1\n%llu %llu\n%s\n",
+			   (unsigned long long) d.size, (unsigned long long) HTTP_DOWNLOAD_RANGE_SIZE,
+			   validator);
+  if((size_t) d.part_header >= sizeof(part_header)) {
+    free(d.done);
+    return false;
+  }
+
+  // Without a validator, a changed resource could not be detected
+  bool resume = strcmp(validator, " ") != 0;
+
+  d.part_fd = open(part_path, O_RDWR | O_CREAT, 0644);
+  d.fd = open(filepath, O_RDWR | O_CREAT, 0644);
+  if(d.part_fd < 0 || d.fd < 0) {
+    HTTP_LOG("Can not open '%s'", d.fd < 0 ? filepath : part_path);
+    goto fail;
+  }
+
+  struct stat part_stats, file_stats;
+  if(resume &&
+     fstat(d.part_fd, &part_stats) == 0 &&
+     fstat(d.fd, &file_stats) == 0 &&
+     (uint64_t) file_stats.st_size == d.size &&
+     part_stats.st_size == d.part_header + (off_t) d.ranges_len) {
+
+    char existing[sizeof(part_header)];
+    if(pread(d.part_fd, existing, (size_t) d.part_header, 0) == d.part_header &&
+       memcmp(existing, part_header, (size_t) d.part_header) == 0 &&
+       pread(d.part_fd, d.done, d.ranges_len, d.part_header) == (ssize_t) d.ranges_len) {
+
+      for(size_t i=0;i<d.ranges_len;i++) {
+	if(!d.done[i]) continue;
+	uint64_t start = (uint64_t) i * HTTP_DOWNLOAD_RANGE_SIZE;
+	uint64_t end = start + HTTP_DOWNLOAD_RANGE_SIZE;
+	stats->resumed += (end > d.size ? d.size : end) - start;
+      }
+    } else {
+      memset(d.done, 0, d.ranges_len);
+    }
+  }
+
+  if(stats->resumed == 0) {
+    if(ftruncate(d.part_fd, 0) < 0 ||
+       pwrite(d.part_fd, part_header, (size_t) d.part_header, 0) != d.part_header ||
+       ftruncate(d.part_fd, d.part_header + (off_t) d.ranges_len) < 0 ||
+       ftruncate(d.fd, (off_t) d.size) < 0) {
+      HTTP_LOG("Can not prepare '%s'", filepath);
+      goto fail;
+    }
+  }
+
+  if(connections == 0) connections = 1;
+  if(connections > d.ranges_len) connections = d.ranges_len;
+
+  http_mutex_init(&d.mutex);
+
+  pthread_t *threads = malloc(sizeof(pthread_t) * connections);
+  size_t threads_len = 0;
+  if(threads) {
+    for(;threads_len<connections;threads_len++) {
+      if(pthread_create(&threads[threads_len], NULL, http_download_worker, &d) != 0) {
+	break;
+      }
+    }
+  }
+  if(threads_len == 0) {
+    // Run it on this thread
+    http_download_worker(&d);
+  }
+  for(size_t i=0;i<threads_len;i++) {
+    pthread_join(threads[i], NULL);
+  }
+  free(threads);
+  http_mutex_free(&d.mutex);
+
+  stats->size = d.size;
+  stats->downloaded = d.downloaded;
+  stats->ranges = d.ranges_len;
+  stats->retries = d.retries;
+  stats->connections = threads_len == 0 ? 1 : threads_len;
+  stats->elapsed_ns = http_now_ns() - started_at;
+
+  if(d.failed) {
+    goto fail;
+  }
+
+  close(d.part_fd);
+  close(d.fd);
+  unlink(part_path);
+  free(d.done);
+  return true;
+
+ fail:
+  // The '.part'-file stays, so the next call can resume
+  if(d.part_fd >= 0) close(d.part_fd);
+  if(d.fd >= 0) close(d.fd);
+  free(d.done);
+  return false;
+#else
+  (void) pool;
+  (void) hostname;
+  (void) port;
+  (void) use_ssl;
+  (void) route;
+  (void) filepath;
+  (void) connections;
+  (void) _stats;
+  HTTP_LOG("Unsupported platform. Implement: http_download");
+  return false;
+#endif // linux
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////
+
+HTTP_DEF bool http_engine_init(Http_Engine *e) {
+  e->tasks = NULL;
+  e->tasks_last = NULL;
+  e->resolves = NULL;
+  e->active = 0;
+  e->completed = 0;
+  e->failed = 0;
+
+#ifdef linux
+  e->epoll = epoll_create1(0);
+  if(e->epoll < 0) {
+    HTTP_LOG("Failed to create epoll instance");
+    return false;
+  }
+
+  return true;
+#else
+  HTTP_LOG("Unsupported platform. Implement: http_engine_init");
+  return false;
+#endif // linux
+}
+
+static bool http_engine_append(const char *data, size_t size, void *userdata) {
+  Http_Engine_Task *t = userdata;
+
+  if(t->send_len + size > t->send_cap) {
+    size_t new_cap = t->send_cap == 0 ? 1024 : t->send_cap;
+    while(t->send_len + size > new_cap) new_cap *= 2;
+
+    char *new_send = realloc(t->send, new_cap);
+    if(!new_send) {
+      return false;
+    }
+    t->send = new_send;
+    t->send_cap = new_cap;
+  }
+
+  memcpy(t->send + t->send_len, data, size);
+  t->send_len += size;
+  return true;
+}
+
+static void http_engine_unlink(Http_Engine *e, Http_Engine_Task *t) {
+  if(t->prev) t->prev->next = t->next;
+  else e->tasks = t->next;
+  if(t->next) t->next->prev = t->prev;
+  else e->tasks_last = t->prev;
+}
+
+// Moves 't' to the end of the tasks, with a new deadline
+static void http_engine_touch(Http_Engine *e, Http_Engine_Task *t) {
+  t->deadline = http_now_ns() + (uint64_t) HTTP_ENGINE_TIMEOUT_MS * 1000000ULL;
+  t->prev = e->tasks_last;
+  t->next = NULL;
+  if(e->tasks_last) e->tasks_last->next = t;
+  else e->tasks = t;
+  e->tasks_last = t;
+}
+
+static void http_engine_finish(Http_Engine *e, Http_Engine_Task *t, bool ok) {
+#ifdef linux
+  if(t->resolve) {
+    Http_Engine_Task **it = &t->resolve->tasks;
+    while(*it != t) it = &(*it)->resolve_next;
+    *it = t->resolve_next;
+  } else {
+    epoll_ctl(e->epoll, EPOLL_CTL_DEL, t->http.socket, NULL);
+  }
+#endif // linux
+
+  if(ok) {
+    e->completed++;
+  } else {
+    e->failed++;
+    t->request.state = HTTP_REQUEST_STATE_ERROR;
+  }
+  e->active--;
+  http_engine_unlink(e, t);
+
+  if(t->on_done) {
+    t->on_done(t->userdata, &t->request, ok);
+  }
+
+  http_request_free(&t->request);
+  http_free(&t->http);
+  free(t->send);
+  free(t);
+}
+
+#ifdef linux
+// Connects to the first address from 't->address' on, that does not fail right away,
+// and registers the socket for EPOLLOUT
+static bool http_engine_connect(Http_Engine *e, Http_Engine_Task *t) {
+  for(;t->address < t->addresses.len;t->address++) {
+    struct sockaddr_storage *addr = &t->addresses.addrs[t->address];
+
+    if(t->http.socket >= 0) {
+      close(t->http.socket);
+    }
+    t->http.socket = socket(addr->ss_family, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if(t->http.socket < 0) {
+      continue;
+    }
+
+    t->state = HTTP_ENGINE_STATE_SENDING;
+    if(connect(t->http.socket, (struct sockaddr *) addr, t->addresses.addrs_len[t->address]) < 0) {
+      if(errno != EINPROGRESS) {
+	continue;
+      }
+      t->state = HTTP_ENGINE_STATE_CONNECTING;
+    } else {
+      t->request.timings.connect_ns = http_now_ns() - t->connect_at;
+    }
+
+    struct epoll_event event = {0};
+    event.events = EPOLLOUT;
+    event.data.ptr = t;
+    if(epoll_ctl(e->epoll, EPOLL_CTL_ADD, t->http.socket, &event) < 0) {
+      return false;
+    }
+    return true;
+  }
+
+  HTTP_LOG("Can not connect to '%s:%u'", t->http.hostname, t->http.port);
+  return false;
+}
+
+static void http_engine_resolve_release(Http_Engine_Resolve *r) {
+  if(__atomic_sub_fetch(&r->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+    free(r->hostname);
+    free(r);
+  }
+}
+
+static void *http_engine_resolve_thread(void *_r) {
+  Http_Engine_Resolve *r = _r;
+
+  bool ok = http_resolve(r->hostname, 0, &r->addresses);
+  __atomic_store_n(&r->ok, ok, __ATOMIC_RELAXED);
+  __atomic_store_n(&r->done, true, __ATOMIC_RELEASE);
+
+  http_engine_resolve_release(r);
+  return NULL;
+}
+
+// Lets 't' wait for 'hostname', which is resolved on a thread. Tasks for the same
+// hostname share the thread.
+static bool http_engine_resolve(Http_Engine *e, Http_Engine_Task *t, const char *hostname) {
+  Http_Engine_Resolve *r = e->resolves;
+  while(r && strcmp(r->hostname, hostname) != 0) r = r->next;
+
+  if(!r) {
+    size_t hostname_len = strlen(hostname);
+    r = malloc(sizeof(Http_Engine_Resolve));
+    if(r) r->hostname = malloc(hostname_len + 1);
+    if(!r || !r->hostname) {
+      free(r);
+      return false;
+    }
+    memcpy(r->hostname, hostname, hostname_len + 1);
+    r->done = false;
+    r->ok = false;
+    r->refs = 2;
+    r->tasks = NULL;
+
+    pthread_t thread;
+    if(pthread_create(&thread, NULL, http_engine_resolve_thread, r) != 0) {
+      free(r->hostname);
+      free(r);
+      return false;
+    }
+    pthread_detach(thread);
+
+    r->next = e->resolves;
+    e->resolves = r;
+  }
+
+  t->state = HTTP_ENGINE_STATE_RESOLVING;
+  t->resolve = r;
+  t->resolve_next = r->tasks;
+  r->tasks = t;
+  return true;
+}
+
+// Connects the tasks of every hostname, that was resolved since the last call
+static void http_engine_resolved(Http_Engine *e) {
+  Http_Engine_Resolve **it = &e->resolves;
+  while(*it) {
+    Http_Engine_Resolve *r = *it;
+    if(!__atomic_load_n(&r->done, __ATOMIC_ACQUIRE)) {
+      it = &r->next;
+      continue;
+    }
+    *it = r->next;
+
+    bool ok = __atomic_load_n(&r->ok, __ATOMIC_RELAXED);
+    if(!ok) {
+      HTTP_LOG("Can not resolve '%s'", r->hostname);
+    }
+
+    Http_Engine_Task *t = r->tasks;
+    r->tasks = NULL;
+    while(t) {
+      Http_Engine_Task *next = t->resolve_next;
+      t->resolve = NULL;
+
+      if(ok) {
+	t->addresses = r->addresses;
+	http_addresses_set_port(&t->addresses, t->http.port);
+	t->connect_at = http_now_ns();
+	t->request.timings.dns_ns = t->connect_at - t->request.started_at;
+	t->address = 0;
+      }
+      if(!ok || !http_engine_connect(e, t)) {
+	http_engine_finish(e, t, false);
+      }
+
+      t = next;
+    }
+
+    http_engine_resolve_release(r);
+  }
+}
+#endif // linux
+
+HTTP_DEF bool http_engine_submit(Http_Engine *e, const char *hostname, uint16_t port,
+				 const char *route, const char *method, const char *headers,
+				 const unsigned char *body, size_t body_len,
+				 Http_Engine_On_Body on_body, Http_Engine_On_Done on_done, void *userdata) {
+#ifdef linux
+  Http_Engine_Task *t = malloc(sizeof(Http_Engine_Task));
+  if(!t) {
+    return false;
+  }
+  t->http = HTTP_INVALID;
+  t->send = NULL;
+  t->send_len = 0;
+  t->send_cap = 0;
+  t->send_pos = 0;
+  t->body = body;
+  t->body_len = body_len;
+  t->body_pos = 0;
+  t->on_body = on_body;
+  t->on_done = on_done;
+  t->userdata = userdata;
+
+  size_t hostname_len = strlen(hostname);
+  t->http.hostname = malloc(hostname_len + 1);
+  if(!t->http.hostname) {
+    free(t);
+    return false;
+  }
+  memcpy((char *) t->http.hostname, hostname, hostname_len + 1);
+  t->http.port = port;
+  t->http.use_ssl = false;
+  t->http.keep_alive = true;
+
+  // The head is formatted once and sent as the socket accepts it
+  bool ok;
+  if(body_len > 0) {
+    ok = http_sendf(http_engine_append, t, t->request.buffer, sizeof(t->request.buffer),
+		    "%s %s HTTP/1.1\r\n"
+		    "Host: %s\r\n"
+		    HTTP_ACCEPT_ENCODING
+		    "%s"
+		    "Content-Length: %zu\r\n"
+		    "\r\n", method, route, hostname, headers ? headers : "", body_len);
+  } else {
+    ok = http_sendf(http_engine_append, t, t->request.buffer, sizeof(t->request.buffer),
+		    "%s %s HTTP/1.1\r\n"
+		    "Host: %s\r\n"
+		    HTTP_ACCEPT_ENCODING
+		    "%s"
+		    "\r\n", method, route, hostname, headers ? headers : "");
+  }
+  if(!ok) {
+    http_free(&t->http);
+    free(t->send);
+    free(t);
+    return false;
+  }
+
+  uint64_t started_at = http_now_ns();
+  t->http.pending_requests[0].head = strcmp(method, "HEAD") == 0;
+  t->http.pending_requests[0].started_at = started_at;
+  t->http.pending = 1;
+  t->http.pending_pos = 0;
+  http_request_begin(&t->http, &t->request);
+
+  // Cached after the first request to a host. Addresses, that are not cached, are resolved
+  // on a thread, unless they are numeric (getaddrinfo does not block for them).
+  t->resolve = NULL;
+  struct in6_addr numeric;
+  if(http_resolve_cached(hostname, port, &t->addresses) ||
+     ((inet_pton(AF_INET, hostname, &numeric) == 1 || inet_pton(AF_INET6, hostname, &numeric) == 1) &&
+      http_resolve(hostname, port, &t->addresses))) {
+    t->connect_at = http_now_ns();
+    t->request.timings.dns_ns = t->connect_at - started_at;
+
+    t->address = 0;
+    if(!http_engine_connect(e, t)) {
+      goto error;
+    }
+  } else if(!http_engine_resolve(e, t, hostname)) {
+    goto error;
+  }
+
+  http_engine_touch(e, t);
+  e->active++;
+  return true;
+
+ error:
+  http_free(&t->http);
+  free(t->send);
+  free(t);
+  return false;
+#else
+  HTTP_LOG("Unsupported platform. Implement: http_engine_submit");
+
+  (void) e;
+  (void) hostname;
+  (void) port;
+  (void) route;
+  (void) method;
+  (void) headers;
+  (void) body;
+  (void) body_len;
+  (void) on_body;
+  (void) on_done;
+  (void) userdata;
+  return false;
+#endif // linux
+}
+
+static void http_engine_step(Http_Engine *e, Http_Engine_Task *t) {
+#ifdef linux
+  http_engine_unlink(e, t);
+  http_engine_touch(e, t);
+
+  if(t->state == HTTP_ENGINE_STATE_CONNECTING) {
+    int error = 0;
+    socklen_t error_len = sizeof(error);
+    if(getsockopt(t->http.socket, SOL_SOCKET, SO_ERROR, &error, &error_len) < 0 || error != 0) {
+      // Closing the socket removes it from the epoll set
+      t->address++;
+      if(!http_engine_connect(e, t)) {
+	http_engine_finish(e, t, false);
+      }
+      return;
+    }
+    t->state = HTTP_ENGINE_STATE_SENDING;
+    t->request.timings.connect_ns = http_now_ns() - t->connect_at;
+  }
+
+  if(t->state == HTTP_ENGINE_STATE_SENDING) {
+    while(t->send_pos < t->send_len || t->body_pos < t->body_len) {
+      // Head and body leave in one sendmsg
+      struct iovec iov[2];
+      size_t iov_len = 0;
+      if(t->send_pos < t->send_len) {
+	iov[iov_len].iov_base = t->send + t->send_pos;
+	iov[iov_len].iov_len = t->send_len - t->send_pos;
+	iov_len++;
+      }
+      if(t->body_pos < t->body_len) {
+	iov[iov_len].iov_base = (unsigned char *) t->body + t->body_pos;
+	iov[iov_len].iov_len = t->body_len - t->body_pos;
+	iov_len++;
+      }
+
+      struct msghdr msg = {0};
+      msg.msg_iov = iov;
+      msg.msg_iovlen = iov_len;
+      ssize_t ret = sendmsg(t->http.socket, &msg, MSG_NOSIGNAL);
+      if(ret < 0) {
+	if(errno == EAGAIN || errno == EWOULDBLOCK) {
+	  return;
+	}
+	if(errno == EINTR) {
+	  continue;
+	}
+	http_engine_finish(e, t, false);
+	return;
+      }
+
+      size_t sent = (size_t) ret;
+      t->http.bytes_sent += sent;
+      t->http.writes++;
+      size_t head_left = t->send_len - t->send_pos;
+      if(sent < head_left) {
+	t->send_pos += sent;
+      } else {
+	t->send_pos = t->send_len;
+	t->body_pos += sent - head_left;
+      }
+    }
+
+    struct epoll_event event = {0};
+    event.events = EPOLLIN;
+    event.data.ptr = t;
+    if(epoll_ctl(e->epoll, EPOLL_CTL_MOD, t->http.socket, &event) < 0) {
+      http_engine_finish(e, t, false);
+      return;
+    }
+    t->state = HTTP_ENGINE_STATE_RECEIVING;
+
+    Http_Timings *timings = &t->request.timings;
+    t->request.sent_at = http_now_ns();
+    timings->send_ns = t->request.sent_at - t->connect_at - timings->connect_ns;
+    timings->bytes_sent = t->http.bytes_sent;
+    return;
+  }
+
+  char *data;
+  size_t data_len;
+  while(http_next_body(&t->request, &data, &data_len)) {
+    if(t->on_body && !t->on_body(t->userdata, &t->request, data, data_len)) {
+      http_engine_finish(e, t, false);
+      return;
+    }
+  }
+
+  if(t->request.state == HTTP_REQUEST_STATE_DONE) {
+    http_engine_finish(e, t, true);
+  } else if(!t->http.would_block) {
+    http_engine_finish(e, t, false);
+  }
+#else
+  (void) e;
+  (void) t;
+#endif // linux
+}
+
+static void http_engine_expire(Http_Engine *e) {
+  uint64_t now = http_now_ns();
+  while(e->tasks && e->tasks->deadline <= now) {
+    Http_Engine_Task *t = e->tasks;
+    HTTP_LOG("Request to '%s:%u' timed out after %d ms", t->http.hostname, t->http.port, HTTP_ENGINE_TIMEOUT_MS);
+    http_engine_finish(e, t, false);
+  }
+}
+
+HTTP_DEF size_t http_engine_poll(Http_Engine *e, int timeout_ms) {
+#ifdef linux
+  http_engine_resolved(e);
+  http_engine_expire(e);
+
+  if(e->resolves && (timeout_ms < 0 || timeout_ms > HTTP_ENGINE_RESOLVE_POLL_MS)) {
+    timeout_ms = HTTP_ENGINE_RESOLVE_POLL_MS;
+  }
+
+  // Wake up for the first deadline
+  if(e->tasks) {
+    uint64_t now = http_now_ns();
+    uint64_t left = e->tasks->deadline > now ? e->tasks->deadline - now : 0;
+    int left_ms = (int) ((left + 999999) / 1000000);
+    if(timeout_ms < 0 || left_ms < timeout_ms) timeout_ms = left_ms;
+  }
+
+  struct epoll_event events[HTTP_ENGINE_EVENTS_CAP];
+  int n = epoll_wait(e->epoll, events, HTTP_ENGINE_EVENTS_CAP, timeout_ms);
+  for(int i=0;i<n;i++) {
+    http_engine_step(e, events[i].data.ptr);
+  }
+
+  // Only after the round, 'events' may point to the finished tasks
+  http_engine_resolved(e);
+  http_engine_expire(e);
+#else
+  (void) timeout_ms;
+#endif // linux
+
+  return e->active;
+}
+
+HTTP_DEF void http_engine_run(Http_Engine *e) {
+  while(http_engine_poll(e, -1) > 0) ;
+}
+
+HTTP_DEF void http_engine_free(Http_Engine *e) {
+  while(e->tasks) {
+    http_engine_finish(e, e->tasks, false);
+  }
+
+#ifdef linux
+  // The threads free them, when they are done
+  while(e->resolves) {
+    Http_Engine_Resolve *r = e->resolves;
+    e->resolves = r->next;
+    http_engine_resolve_release(r);
+  }
+#endif // linux
+
+#ifdef linux
+  if(e->epoll >= 0) {
+    close(e->epoll);
+    e->epoll = -1;
+  }
+#else
+  (void) e;
+#endif // linux
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////
+
+#ifdef linux
+// Binds to the first address of 'family', that 'hostname' resolves to
+static bool http_server_bind(Http_Server *s, const char *hostname, uint16_t port, int family) {
+  struct addrinfo hints;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = family;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_protocol = IPPROTO_TCP;
+  hints.ai_flags = AI_PASSIVE;
+
+  char service[8];
+  snprintf(service, sizeof(service), "%u", port);
+
+  struct addrinfo *result;
+  if(getaddrinfo(hostname, service, &hints, &result) != 0) {
+    return false;
+  }
+
+  for(struct addrinfo *it = result;it;it = it->ai_next) {
+    s->socket = socket(it->ai_family, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if(s->socket < 0) {
+      continue;
+    }
+
+    int one = 1;
+    setsockopt(s->socket, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if(it->ai_family == AF_INET6) {
+      // '::' accepts IPv4 as well
+      int zero = 0;
+      setsockopt(s->socket, IPPROTO_IPV6, IPV6_V6ONLY, &zero, sizeof(zero));
+    }
+
+    if(bind(s->socket, it->ai_addr, it->ai_addrlen) == 0) {
+      break;
+    }
+    close(s->socket);
+    s->socket = -1;
+  }
+  freeaddrinfo(result);
+
+  return s->socket >= 0;
+}
+#endif // linux
+
+HTTP_DEF bool http_server_init(Http_Server *s, const char *hostname, uint16_t port,
+			       Http_Server_Handler handler, void *userdata) {
+  s->handler = handler;
+  s->userdata = userdata;
+  s->running = true;
+  s->socket = -1;
+  s->epoll = -1;
+  s->conns = NULL;
+  http_mutex_init(&s->conns_mutex);
+
+#ifdef linux
+  // Every interface is served by one dual-stack socket, if there is IPv6
+  if(!(hostname == NULL && http_server_bind(s, hostname, port, AF_INET6)) &&
+     !http_server_bind(s, hostname, port, AF_UNSPEC)) {
+    HTTP_LOG("Can not bind to '%s:%u'", hostname ? hostname : "*", port);
+    http_server_free(s);
+    return false;
+  }
+
+  if(listen(s->socket, SOMAXCONN) < 0) {
+    HTTP_LOG("Can not listen on '%s:%u'", hostname ? hostname : "*", port);
+    http_server_free(s);
+    return false;
+  }
+
+  struct sockaddr_storage addr;
+  socklen_t addr_len = sizeof(addr);
+  if(getsockname(s->socket, (struct sockaddr *) &addr, &addr_len) < 0) {
+    http_server_free(s);
+    return false;
+  }
+  if(addr.ss_family == AF_INET6) {
+    s->port = ntohs(((struct sockaddr_in6 *) &addr)->sin6_port);
+  } else {
+    s->port = ntohs(((struct sockaddr_in *) &addr)->sin_port);
+  }
+
+  s->epoll = epoll_create1(0);
+  if(s->epoll < 0) {
+    HTTP_LOG("Failed to create epoll instance");
+    http_server_free(s);
+    return false;
+  }
+
+  // Only one of the workers is woken up for a new connection
+  struct epoll_event event = {0};
+  event.events = EPOLLIN | EPOLLEXCLUSIVE;
+  event.data.ptr = s;
+  if(epoll_ctl(s->epoll, EPOLL_CTL_ADD, s->socket, &event) < 0) {
+    http_server_free(s);
+    return false;
+  }
+
+  return true;
+#else
+  HTTP_LOG("Unsupported platform. Implement: http_server_init");
+
+  (void) hostname;
+  (void) port;
+  return false;
+#endif // linux
+}
+
+static void http_server_close(Http_Server *s, Http_Server_Conn *c) {
+#ifdef linux
+  epoll_ctl(s->epoll, EPOLL_CTL_DEL, c->http.socket, NULL);
+#endif // linux
+
+  http_mutex_lock(&s->conns_mutex);
+  if(c->prev) c->prev->next = c->next;
+  else s->conns = c->next;
+  if(c->next) c->next->prev = c->prev;
+  http_mutex_unlock(&s->conns_mutex);
+
+  http_free(&c->http);
+  free(c);
+}
+
+static void http_server_accept(Http_Server *s) {
+#ifdef linux
+  while(true) {
+    int socket = accept(s->socket, NULL, NULL);
+    if(socket < 0) {
+      return;
+    }
+
+    Http_Server_Conn *c = malloc(sizeof(Http_Server_Conn));
+    if(!c) {
+      close(socket);
+      continue;
+    }
+    c->http = HTTP_INVALID;
+    c->http.socket = socket;
+    c->server = s;
+    c->head_started = 0;
+    http_request_begin(&c->http, &c->request);
+
+    http_mutex_lock(&s->conns_mutex);
+    c->prev = NULL;
+    c->next = s->conns;
+    if(s->conns) s->conns->prev = c;
+    s->conns = c;
+    http_mutex_unlock(&s->conns_mutex);
+
+    int one = 1;
+    setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    // Bodies are read by the handler, slow clients are dropped there
+    struct timeval timeout;
+    timeout.tv_sec = HTTP_SERVER_TIMEOUT_MS / 1000;
+    timeout.tv_usec = (HTTP_SERVER_TIMEOUT_MS % 1000) * 1000;
+    setsockopt(socket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(socket, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+    struct epoll_event event = {0};
+    event.events = EPOLLIN | EPOLLONESHOT;
+    event.data.ptr = c;
+    if(epoll_ctl(s->epoll, EPOLL_CTL_ADD, socket, &event) < 0) {
+      http_server_close(s, c);
+    }
+  }
+#else
+  (void) s;
+#endif // linux
+}
+
+// Receives, what is available without blocking, until the buffer holds a complete request-head.
+// Returns false, if the connection should be closed.
+static bool http_server_read_head(Http_Server_Conn *c, bool *ready) {
+#ifdef linux
+  Http_Request *r = &c->request;
+  size_t scanned = 0;
+
+  while(true) {
+    const char *head = r->buffer + r->buffer_pos;
+    for(size_t i=scanned;i<r->buffer_size;i++) {
+      if(head[i] != '\n') continue;
+      if((i + 1 < r->buffer_size && head[i + 1] == '\n') ||
+	 (i + 2 < r->buffer_size && head[i + 1] == '\r' && head[i + 2] == '\n')) {
+	c->head_started = 0;
+	*ready = true;
+	return true;
+      }
+    }
+    // The terminator may be split across reads
+    scanned = r->buffer_size > 2 ? r->buffer_size - 2 : 0;
+
+    if(r->buffer_pos + r->buffer_size == sizeof(r->buffer)) {
+      if(r->buffer_pos == 0) {
+	HTTP_LOG("Request-head does not fit into HTTP_BUFFER_SIZE (%d bytes)", HTTP_BUFFER_SIZE);
+	c->http.keep_alive = false;
+	http_server_respond(c, 431, NULL, NULL, 0);
+	return false;
+      }
+      memmove(r->buffer, r->buffer + r->buffer_pos, r->buffer_size);
+      r->buffer_pos = 0;
+    }
+
+    char *dst = r->buffer + r->buffer_pos + r->buffer_size;
+    ssize_t ret = recv(c->http.socket, dst, sizeof(r->buffer) - r->buffer_pos - r->buffer_size, MSG_DONTWAIT);
+    c->http.reads++;
+    if(ret < 0 && errno == EINTR) {
+      continue;
+    }
+    if(ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      break;
+    }
+    if(ret <= 0) {
+      return false;
+    }
+    c->http.bytes_received += (uint64_t) ret;
+    r->buffer_size += (size_t) ret;
+  }
+
+  // Wait for the next EPOLLIN, but not forever
+  uint64_t now = http_now_ns();
+  if(r->buffer_size == 0) {
+    c->head_started = 0;
+  } else if(c->head_started == 0) {
+    c->head_started = now;
+  } else if(now - c->head_started > (uint64_t) HTTP_SERVER_TIMEOUT_MS * 1000000ULL) {
+    HTTP_LOG("Request-head was not received within HTTP_SERVER_TIMEOUT_MS (%d ms)", HTTP_SERVER_TIMEOUT_MS);
+    return false;
+  }
+
+  *ready = false;
+  return true;
+#else
+  (void) c;
+  (void) ready;
+  return false;
+#endif // linux
+}
+
+// Serves every request, whose head is already received. Returns false,
+// if the connection should be closed.
+static bool http_server_serve(Http_Server *s, Http_Server_Conn *c) {
+  Http_Request *r = &c->request;
+
+  for(bool woken = true;;woken = false) {
+    // Without EPOLLIN, only a pipelined request may be buffered
+    if(!woken && r->buffer_size == 0) {
+      return true;
+    }
+
+    bool ready;
+    if(!http_server_read_head(c, &ready)) {
+      return false;
+    }
+    if(!ready) {
+      return true;
+    }
+
+    c->http.keep_alive = true;
+    http_request_reset(r);
+    r->server = true;
+    r->method = NULL;
+    r->route = NULL;
+    c->head_len = 0;
+    c->headers_len = 0;
+    c->responded = false;
+
+    Http_Header header;
+    while(http_next_header(r, &header)) {
+      if(c->headers_len == HTTP_SERVER_HEADERS_CAP ||
+	 c->head_len + header.key_len + header.value_len + 2 > sizeof(c->head)) {
+	// The handler would see a truncated set of headers
+	HTTP_LOG("Too many request-headers. Increase HTTP_SERVER_HEADERS_CAP or HTTP_BUFFER_SIZE");
+	c->http.keep_alive = false;
+	http_server_respond(c, 431, NULL, NULL, 0);
+	return false;
+      }
+
+      Http_Header *h = &c->headers[c->headers_len++];
+      h->key = c->head + c->head_len;
+      h->key_len = header.key_len;
+      memcpy(h->key, header.key, header.key_len + 1);
+      c->head_len += header.key_len + 1;
+
+      h->value = c->head + c->head_len;
+      h->value_len = header.value_len;
+      memcpy(h->value, header.value, header.value_len + 1);
+      c->head_len += header.value_len + 1;
+    }
+
+    if((r->state != HTTP_REQUEST_STATE_BODY &&
+	r->state != HTTP_REQUEST_STATE_DONE) || !r->route) {
+      return false;
+    }
+
+    if(!s->handler(c, s->userdata)) {
+      return false;
+    }
+
+    if(!c->responded) {
+      if(!http_server_respond(c, 500, NULL, NULL, 0)) {
+	return false;
+      }
+    }
+
+    // skip what the handler did not read
+    char *data;
+    size_t data_len;
+    while(http_next_body(r, &data, &data_len)) ;
+    if(r->state != HTTP_REQUEST_STATE_DONE) {
+      return false;
+    }
+
+    if(!c->http.keep_alive) {
+      return false;
+    }
+  }
+}
+
+HTTP_DEF void *http_server_worker(void *_server) {
+  Http_Server *s = _server;
+
+#ifdef linux
+  struct epoll_event events[HTTP_ENGINE_EVENTS_CAP];
+
+  while(__atomic_load_n(&s->running, __ATOMIC_ACQUIRE)) {
+    int n = epoll_wait(s->epoll, events, HTTP_ENGINE_EVENTS_CAP, 100);
+
+    for(int i=0;i<n;i++) {
+      if(events[i].data.ptr == s) {
+	http_server_accept(s);
+	continue;
+      }
+
+      Http_Server_Conn *c = events[i].data.ptr;
+      if(!http_server_serve(s, c)) {
+	http_server_close(s, c);
+	continue;
+      }
+
+      struct epoll_event event = {0};
+      event.events = EPOLLIN | EPOLLONESHOT;
+      event.data.ptr = c;
+      if(epoll_ctl(s->epoll, EPOLL_CTL_MOD, c->http.socket, &event) < 0) {
+	http_server_close(s, c);
+      }
+    }
+  }
+#else
+  (void) s;
+#endif // linux
+
+  return NULL;
+}
+
+HTTP_DEF void http_server_stop(Http_Server *s) {
+#ifdef linux
+  __atomic_store_n(&s->running, false, __ATOMIC_RELEASE);
+#else
+  s->running = false;
+#endif // linux
+}
+
+HTTP_DEF void http_server_free(Http_Server *s) {
+  Http_Server_Conn *c = s->conns;
+  while(c) {
+    Http_Server_Conn *next = c->next;
+    http_free(&c->http);
+    free(c);
+    c = next;
+  }
+  s->conns = NULL;
+  http_mutex_free(&s->conns_mutex);
+
+#ifdef linux
+  if(s->epoll >= 0) {
+    close(s->epoll);
+    s->epoll = -1;
+  }
+  if(s->socket >= 0) {
+    close(s->socket);
+    s->socket = -1;
+  }
+#else
+  (void) s;
+#endif // linux
+}
+
+HTTP_DEF bool http_server_header(Http_Server_Conn *c, const char *key, char **value, size_t *value_len) {
+  size_t key_len = strlen(key);
+
+  for(size_t i=0;i<c->headers_len;i++) {
+    Http_Header *h = &c->headers[i];
+    if(http_header_eq(h->key, h->key_len, key, key_len)) {
+      *value = h->value;
+      *value_len = h->value_len;
+      return true;
+    }
+  }
+
+  return false;
+}
+
+HTTP_DEF bool http_server_write(const char *data, size_t size, void *_conn) {
+  Http_Server_Conn *c = _conn;
+
+#ifdef linux
+  while(size > 0) {
+    ssize_t ret = send(c->http.socket, data, size, MSG_NOSIGNAL);
+    if(ret < 0) {
+      if(errno == EINTR) continue;
+      return false;
+    }
+    data += ret;
+    size -= (size_t) ret;
+  }
+
+  return true;
+#else
+  (void) c;
+  (void) data;
+  (void) size;
+  return false;
+#endif // linux
+}
+
+HTTP_DEF bool http_server_respond(Http_Server_Conn *c, int code, const char *headers,
+				  const char *body, size_t body_len) {
+  c->responded = true;
+
+  char buffer[1024];
+  Http_Buffer buffers[2];
+  buffers[0].data = buffer;
+  buffers[0].len = sizeof(buffer);
+  if(!http_sendf(http_head_collect, &buffers[0].len, buffer, sizeof(buffer),
+		 "HTTP/1.1 %d %s\r\n"
+		 "Content-Length: %zu\r\n"
+		 "%s"
+		 "%s"
+		 "\r\n", code, http_status_text(code), body_len,
+		 c->http.keep_alive ? "" : "Connection: close\r\n",
+		 headers ? headers : "")) {
+    return false;
+  }
+  buffers[1].data = body;
+  buffers[1].len = body_len;
+
+  // Head and body leave in one writev
+  bool has_body = body_len > 0 && strcmp(c->request.method, "HEAD") != 0;
+  return http_socket_writev(&c->http, buffers, has_body ? 2 : 1);
+}
+
+// 'bytes=0-99', 'bytes=100-' or 'bytes=-100' (the last 100 bytes). Returns 1 for a valid range
+// [start, end), -1 if it is not satisfiable and 0 if it is ignored (multiple ranges).
+static int http_server_parse_range(char *value, size_t value_len, uint64_t size, uint64_t *start, uint64_t *end) {
+  if(value_len < 6 || memcmp(value, "bytes=", 6) != 0) {
+    return 0;
+  }
+  value += 6;
+  value_len -= 6;
+
+  size_t dash = 0;
+  while(dash < value_len && value[dash] != '-') dash++;
+  if(dash == value_len || memchr(value, ',', value_len)) {
+    return 0;
+  }
+
+  uint64_t first, last;
+  if(dash == 0) {
+    if(!http_parse_u64(value + 1, value_len - 1, &last)) return 0;
+    if(last == 0 || size == 0) return -1;
+    *start = last < size ? size - last : 0;
+    *end = size;
+    return 1;
+  }
+
+  if(!http_parse_u64(value, dash, &first)) return 0;
+  if(dash + 1 == value_len) {
+    last = size - 1;
+  } else if(!http_parse_u64(value + dash + 1, value_len - dash - 1, &last) || last < first) {
+    return 0;
+  }
+  if(first >= size) return -1;
+
+  *start = first;
+  *end = (last < size - 1 ? last : size - 1) + 1;
+  return 1;
+}
+
+HTTP_DEF bool http_server_respond_file(Http_Server_Conn *c, int code, const char *headers,
+				       const char *filepath) {
+#ifdef linux
+  int fd = open(filepath, O_RDONLY);
+  if(fd < 0) {
+    return http_server_respond(c, 404, NULL, NULL, 0);
+  }
+
+  struct stat stats;
+  if(fstat(fd, &stats) < 0 || !S_ISREG(stats.st_mode)) {
+    close(fd);
+    return http_server_respond(c, 404, NULL, NULL, 0);
+  }
+  uint64_t size = (uint64_t) stats.st_size;
+
+  // A single 'Range: bytes=...' of a '200 OK' is answered with '206 Partial Content'
+  uint64_t start = 0, end = size;
+  char content_range[128] = {0};
+  char *range;
+  size_t range_len;
+  if(code == 200 && http_server_header(c, "range", &range, &range_len)) {
+    int ret = http_server_parse_range(range, range_len, size, &start, &end);
+    if(ret < 0) {
+      close(fd);
+      snprintf(content_range, sizeof(content_range), "Content-Range: bytes */%llu\r\n",
+	       (unsigned long long) size);
+      return http_server_respond(c, 416, content_range, NULL, 0);
+    }
+    if(ret > 0) {
+      code = 206;
+      snprintf(content_range, sizeof(content_range), "Content-Range: bytes %llu-%llu/%llu\r\n",
+	       (unsigned long long) start, (unsigned long long) (end - 1), (unsigned long long) size);
+    }
+  }
+
+  c->responded = true;
+
+  char buffer[1024];
+  if(!http_sendf(http_server_write, c, buffer, sizeof(buffer),
+		 "HTTP/1.1 %d %s\r\n"
+		 "Content-Length: %llu\r\n"
+		 "Accept-Ranges: bytes\r\n"
+		 "%s"
+		 "%s"
+		 "%s"
+		 "\r\n", code, http_status_text(code), (unsigned long long) (end - start),
+		 content_range,
+		 c->http.keep_alive ? "" : "Connection: close\r\n",
+		 headers ? headers : "")) {
+    close(fd);
+    return false;
+  }
+
+  // The kernel copies the file into the socket
+  off_t offset = (off_t) start;
+  while(strcmp(c->request.method, "HEAD") != 0 && (uint64_t) offset < end) {
+    ssize_t ret = sendfile(c->http.socket, fd, &offset, (size_t) (end - (uint64_t) offset));
+    if(ret < 0 && errno == EINTR) {
+      continue;
+    }
+    if(ret <= 0) {
+      close(fd);
+      return false;
+    }
+  }
+
+  close(fd);
+  return true;
+#else
+  (void) c;
+  (void) code;
+  (void) headers;
+  (void) filepath;
+  return false;
+#endif // linux
+}
+
+HTTP_DEF const char *http_status_text(int code) {
+  switch(code) {
+  case 100: return "Continue";
+  case 101: return "Switching Protocols";
+  case 200: return "OK";
+  case 201: return "Created";
+  case 204: return "No Content";
+  case 206: return "Partial Content";
+  case 301: return "Moved Permanently";
+  case 302: return "Found";
+  case 304: return "Not Modified";
+  case 400: return "Bad Request";
+  case 401: return "Unauthorized";
+  case 403: return "Forbidden";
+  case 404: return "Not Found";
+  case 405: return "Method Not Allowed";
+  case 413: return "Payload Too Large";
+  case 416: return "Range Not Satisfiable";
+  case 431: return "Request Header Fields Too Large";
+  case 500: return "Internal Server Error";
+  case 501: return "Not Implemented";
+  case 503: return "Service Unavailable";
+  default: return "Unknown";
+  }
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////
+
+#define HTTP_ROL32(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+
+HTTP_DEF void http_sha1(const void *_data, size_t len, unsigned char out[20]) {
+  const unsigned char *data = _data;
+  uint32_t h[5] = { 0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0 };
+
+  // The message, 0x80, zeros and the bit-length fill whole blocks
+  uint64_t bits = (uint64_t) len * 8;
+  size_t blocks = (len + 72) / 64;
+  for(size_t b=0;b<blocks;b++) {
+    unsigned char block[64];
+    for(size_t i=0;i<64;i++) {
+      size_t k = b * 64 + i;
+      block[i] = k < len ? data[k] : k == len ? 0x80 : 0;
+    }
+    if(b == blocks - 1) {
+      for(size_t i=0;i<8;i++) block[56 + i] = (unsigned char) (bits >> (56 - 8 * i));
+    }
+
+    uint32_t w[80];
+    for(size_t i=0;i<16;i++) {
+      w[i] = (uint32_t) block[4*i] << 24 | (uint32_t) block[4*i + 1] << 16 |
+	(uint32_t) block[4*i + 2] << 8 | (uint32_t) block[4*i + 3];
+    }
+    for(size_t i=16;i<80;i++) {
+      uint32_t x = w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16];
+      w[i] = HTTP_ROL32(x, 1);
+    }
+
+    uint32_t a = h[0], bb = h[1], c = h[2], d = h[3], e = h[4];
+    for(size_t i=0;i<80;i++) {
+      uint32_t f, k;
+      if(i < 20) {
+	f = (bb & c) | (~bb & d);
+	k = 0x5a827999;
+      } else if(i < 40) {
+	f = bb ^ c ^ d;
+	k = 0x6ed9eba1;
+      } else if(i < 60) {
+	f = (bb & c) | (bb & d) | (c & d);
+	k = 0x8f1bbcdc;
+      } else {
+	f = bb ^ c ^ d;
+	k = 0xca62c1d6;
+      }
+      uint32_t temp = HTTP_ROL32(a, 5) + f + e + k + w[i];
+      e = d;
+      d = c;
+      c = HTTP_ROL32(bb, 30);
+      bb = a;
+      a = temp;
+    }
+    h[0] += a;
+    h[1] += bb;
+    h[2] += c;
+    h[3] += d;
+    h[4] += e;
+  }
+
+  for(size_t i=0;i<20;i++) {
+    out[i] = (unsigned char) (h[i / 4] >> (24 - 8 * (i % 4)));
+  }
+}
+
+HTTP_DEF void http_base64_encode(const unsigned char *data, size_t len, char *out) {
+  static const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+  size_t j = 0;
+  for(size_t i=0;i<len;i+=3) {
+    uint32_t n = (uint32_t) data[i] << 16;
+    if(i + 1 < len) n |= (uint32_t) data[i + 1] << 8;
+    if(i + 2 < len) n |= (uint32_t) data[i + 2];
+
+    out[j++] = alphabet[(n >> 18) & 63];
+    out[j++] = alphabet[(n >> 12) & 63];
+    out[j++] = i + 1 < len ? alphabet[(n >> 6) & 63] : '=';
+    out[j++] = i + 2 < len ? alphabet[n & 63] : '=';
+  }
+  out[j] = 0;
+}
+
+HTTP_DEF void http_websocket_mask(char *data, size_t len, const unsigned char mask[4], size_t offset) {
+  // The key repeats every 4 bytes, so it is rotated once and then applied 16 (or 8) bytes at a time
+  unsigned char key[16];
+  for(size_t i=0;i<16;i++) {
+    key[i] = mask[(offset + i) & 3];
+  }
+
+  size_t i = 0;
+#ifdef HTTP_SSE2
+  __m128i key128 = _mm_loadu_si128((const __m128i *) key);
+  for(;i + 16 <= len;i+=16) {
+    __m128i v = _mm_loadu_si128((const __m128i *) (data + i));
+    _mm_storeu_si128((__m128i *) (data + i), _mm_xor_si128(v, key128));
+  }
+#endif // HTTP_SSE2
+
+  uint64_t key64;
+  memcpy(&key64, key, 8);
+  for(;i + 8 <= len;i+=8) {
+    uint64_t v;
+    memcpy(&v, data + i, 8);
+    v ^= key64;
+    memcpy(data + i, &v, 8);
+  }
+
+  for(;i<len;i++) {
+    data[i] ^= (char) key[i & 3];
+  }
+}
+
+static uint64_t http_websocket_random(Http_Websocket *ws) {
+  // xorshift64*, the masks only have to be unpredictable for proxies, see: RFC 6455 10.3
+  uint64_t x = ws->random;
+  x ^= x >> 12;
+  x ^= x << 25;
+  x ^= x >> 27;
+  ws->random = x;
+  return x * 0x2545f4914f6cdd1dULL;
+}
+
+static void http_websocket_init(Http_Websocket *ws, Http *http, bool server) {
+  ws->http = http;
+  ws->server = server;
+  ws->deflate = false;
+  ws->deflate_reset = false;
+  ws->close_sent = false;
+  ws->close_received = false;
+  ws->close_code = 0;
+  ws->random = (http_now_ns() ^ (uint64_t) (uintptr_t) ws) | 1;
+  ws->buffer_pos = 0;
+  ws->buffer_size = 0;
+  ws->message = NULL;
+  ws->message_len = 0;
+  ws->message_cap = 0;
+  ws->message_opcode = HTTP_WEBSOCKET_CONTINUATION;
+  ws->message_compressed = false;
+#ifdef HTTP_MINIZ
+  ws->inflate_init = false;
+  ws->deflate_init = false;
+  ws->decoded = NULL;
+  ws->decoded_cap = 0;
+  ws->compressed = NULL;
+  ws->compressed_cap = 0;
+#endif // HTTP_MINIZ
+}
+
+// 'out' holds 28 characters and a NUL
+static bool http_websocket_accept_key(const char *key, size_t key_len, char *out) {
+  static const char guid[] = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+
+  char buffer[128 + sizeof(guid)];
+  if(key_len > 128) {
+    return false;
+  }
+  memcpy(buffer, key, key_len);
+  memcpy(buffer + key_len, guid, sizeof(guid) - 1);
+
+  unsigned char digest[20];
+  http_sha1(buffer, key_len + sizeof(guid) - 1, digest);
+  http_base64_encode(digest, sizeof(digest), out);
+  return true;
+}
+
+// Takes the next 'sep'-separated part of 'value', without surrounding whitespace
+static bool http_websocket_split(const char **value, size_t *value_len, char sep,
+				 const char **part, size_t *part_len) {
+  const char *v = *value;
+  size_t n = *value_len;
+  if(n == 0) {
+    return false;
+  }
+
+  size_t end = 0;
+  while(end < n && v[end] != sep) end++;
+
+  size_t start = 0;
+  size_t stop = end;
+  while(start < stop && (v[start] == ' ' || v[start] == '\t')) start++;
+  while(stop > start && (v[stop - 1] == ' ' || v[stop - 1] == '\t')) stop--;
+  *part = v + start;
+  *part_len = stop - start;
+
+  if(end < n) end++;
+  *value = v + end;
+  *value_len = n - end;
+  return true;
+}
+
+// 'token' is expected to be lowercase
+static bool http_websocket_has_token(const char *value, size_t value_len, const char *token) {
+  size_t token_len = strlen(token);
+  const char *part;
+  size_t part_len;
+  while(http_websocket_split(&value, &value_len, ',', &part, &part_len)) {
+    if(http_header_eq(part, part_len, token, token_len)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+#ifdef HTTP_MINIZ
+
+// The server picks the first acceptable offer. miniz compresses with a window of 2^15 only,
+// so offers, which limit the window of the server, are declined.
+static bool http_websocket_negotiate(Http_Websocket *ws, const char *value, size_t value_len,
+				     char *response, size_t response_cap) {
+  const char *offer;
+  size_t offer_len;
+  while(http_websocket_split(&value, &value_len, ',', &offer, &offer_len)) {
+    const char *p;
+    size_t p_len;
+    if(!http_websocket_split(&offer, &offer_len, ';', &p, &p_len) ||
+       !http_header_eq(p, p_len, "permessage-deflate", 18)) {
+      continue;
+    }
+
+    bool ok = true, server_reset = false, client_reset = false, server_bits = false;
+    while(http_websocket_split(&offer, &offer_len, ';', &p, &p_len)) {
+      if(http_header_eq(p, p_len, "server_no_context_takeover", 26)) {
+	server_reset = true;
+      } else if(http_header_eq(p, p_len, "client_no_context_takeover", 26)) {
+	client_reset = true;
+      } else if(p_len >= 22 && http_header_eq(p, 22, "server_max_window_bits", 22)) {
+	server_bits = true;
+	ok = ok && p_len == 25 && memcmp(p + 22, "=15", 3) == 0;
+      } else if(p_len >= 22 && http_header_eq(p, 22, "client_max_window_bits", 22)) {
+	// A hint, that the client can compress with a smaller window. The inflater takes any.
+      } else {
+	ok = false;
+      }
+    }
+    if(!ok) {
+      continue;
+    }
+
+    ws->deflate = true;
+    ws->deflate_reset = server_reset;
+    snprintf(response, response_cap, "Sec-WebSocket-Extensions: permessage-deflate%s%s%s\r\n",
+	     server_reset ? "; server_no_context_takeover" : "",
+	     client_reset ? "; client_no_context_takeover" : "",
+	     server_bits ? "; server_max_window_bits=15" : "");
+    return true;
+  }
+
+  return false;
+}
+
+// The client accepts, what the server selected from its offer
+static bool http_websocket_negotiated(Http_Websocket *ws, const char *value, size_t value_len) {
+  const char *p;
+  size_t p_len;
+  if(!http_websocket_split(&value, &value_len, ';', &p, &p_len) ||
+     !http_header_eq(p, p_len, "permessage-deflate", 18)) {
+    return false;
+  }
+
+  while(http_websocket_split(&value, &value_len, ';', &p, &p_len)) {
+    if(http_header_eq(p, p_len, "client_no_context_takeover", 26)) {
+      ws->deflate_reset = true;
+    } else if(http_header_eq(p, p_len, "server_no_context_takeover", 26) ||
+	      (p_len >= 22 && http_header_eq(p, 22, "server_max_window_bits", 22))) {
+      // Only restricts the server
+    } else {
+      return false;
+    }
+  }
+
+  ws->deflate = true;
+  return true;
+}
+
+#endif // HTTP_MINIZ
+
+HTTP_DEF bool http_websocket_connect(Http *http, const char *route, const char *headers, Http_Websocket *ws) {
+  http_websocket_init(ws, http, false);
+
+  unsigned char nonce[16];
+  uint64_t r0 = http_websocket_random(ws);
+  uint64_t r1 = http_websocket_random(ws);
+  memcpy(nonce, &r0, 8);
+  memcpy(nonce + 8, &r1, 8);
+
+  char key[32], expected[32];
+  http_base64_encode(nonce, sizeof(nonce), key);
+  http_websocket_accept_key(key, strlen(key), expected);
+
+  char upgrade[HTTP_ENTRY_SIZE];
+  int upgrade_len = snprintf(upgrade, sizeof(upgrade),
+			     "Upgrade: websocket\r\n"
+			     "Connection: Upgrade\r\n"
+			     "Sec-WebSocket-Key: %s\r\n"
+			     "Sec-WebSocket-Version: 13\r\n"
+#ifdef HTTP_MINIZ
+			     "Sec-WebSocket-Extensions: permessage-deflate\r\n"
+#endif // HTTP_MINIZ
+			     "%s", key, headers ? headers : "");
+  if(upgrade_len < 0 || (size_t) upgrade_len >= sizeof(upgrade)) {
+    HTTP_LOG("Upgrade-headers do not fit into HTTP_ENTRY_SIZE");
+    return false;
+  }
+
+  Http_Request r;
+  if(!http_request_from(http, route, "GET", upgrade, NULL, 0, &r)) {
+    return false;
+  }
+
+  bool upgraded = false, accepted = false, extensions = true;
+  Http_Header header;
+  while(http_next_header(&r, &header)) {
+    if(http_header_eq(header.key, header.key_len, "upgrade", 7)) {
+      upgraded = http_websocket_has_token(header.value, header.value_len, "websocket");
+    } else if(http_header_eq(header.key, header.key_len, "sec-websocket-accept", 20)) {
+      accepted = header.value_len == 28 && memcmp(header.value, expected, 28) == 0;
+    } else if(http_header_eq(header.key, header.key_len, "sec-websocket-extensions", 24)) {
+#ifdef HTTP_MINIZ
+      extensions = http_websocket_negotiated(ws, header.value, header.value_len);
+#else
+      // Nothing was offered
+      extensions = false;
+#endif // HTTP_MINIZ
+    }
+  }
+
+  if(r.state != HTTP_REQUEST_STATE_BODY || r.response_code != 101 ||
+     !upgraded || !accepted || !extensions) {
+    HTTP_LOG("Websocket-upgrade of '%s' failed (%d)", route, r.response_code);
+    http_request_free(&r);
+    return false;
+  }
+
+  // Frames, that were read together with the response
+  memcpy(ws->buffer, r.buffer + r.buffer_pos, r.buffer_size);
+  ws->buffer_size = r.buffer_size;
+
+  http_request_finish(&r);
+  http_request_free(&r);
+  http->keep_alive = false;
+
+  return true;
+}
+
+HTTP_DEF bool http_websocket_accept(Http_Server_Conn *c, const char *headers, Http_Websocket *ws) {
+  char *upgrade, *connection, *key, *version;
+  size_t upgrade_len, connection_len, key_len, version_len;
+
+  if(strcmp(c->request.method, "GET") != 0 ||
+     !http_server_header(c, "upgrade", &upgrade, &upgrade_len) ||
+     !http_websocket_has_token(upgrade, upgrade_len, "websocket") ||
+     !http_server_header(c, "connection", &connection, &connection_len) ||
+     !http_websocket_has_token(connection, connection_len, "upgrade") ||
+     !http_server_header(c, "sec-websocket-key", &key, &key_len) ||
+     !http_server_header(c, "sec-websocket-version", &version, &version_len) ||
+     !http_header_eq(version, version_len, "13", 2)) {
+    http_server_respond(c, 400, "Sec-WebSocket-Version: 13\r\n", NULL, 0);
+    return false;
+  }
+
+  char accept[32];
+  if(!http_websocket_accept_key(key, key_len, accept)) {
+    http_server_respond(c, 400, NULL, NULL, 0);
+    return false;
+  }
+
+  http_websocket_init(ws, &c->http, true);
+
+  char extension[256] = {0};
+#ifdef HTTP_MINIZ
+  char *offer;
+  size_t offer_len;
+  if(http_server_header(c, "sec-websocket-extensions", &offer, &offer_len)) {
+    http_websocket_negotiate(ws, offer, offer_len, extension, sizeof(extension));
+  }
+#endif // HTTP_MINIZ
+
+  // After the handler returns, the connection is closed
+  c->responded = true;
+  c->http.keep_alive = false;
+
+  char buffer[1024];
+  Http_Buffer head;
+  head.data = buffer;
+  head.len = sizeof(buffer);
+  if(!http_sendf(http_head_collect, &head.len, buffer, sizeof(buffer),
+		 "HTTP/1.1 101 Switching Protocols\r\n"
+		 "Upgrade: websocket\r\n"
+		 "Connection: Upgrade\r\n"
+		 "Sec-WebSocket-Accept: %s\r\n"
+		 "%s"
+		 "%s"
+		 "\r\n", accept, extension, headers ? headers : "")) {
+    return false;
+  }
+  if(!http_socket_writev(&c->http, &head, 1)) {
+    return false;
+  }
+
+  // Frames, that were read together with the upgrade-request
+  Http_Request *r = &c->request;
+  memcpy(ws->buffer, r->buffer + r->buffer_pos, r->buffer_size);
+  ws->buffer_size = r->buffer_size;
+  r->buffer_size = 0;
+
+  return true;
+}
+
+static bool http_websocket_write_frame(Http_Websocket *ws, int opcode, bool fin, bool rsv1,
+				       const void *data, size_t len) {
+  unsigned char head[14];
+  size_t head_len = 2;
+  head[0] = (unsigned char) ((fin ? 0x80 : 0) | (rsv1 ? 0x40 : 0) | (opcode & 0x0f));
+  if(len < 126) {
+    head[1] = (unsigned char) len;
+  } else if(len <= 0xffff) {
+    head[1] = 126;
+    head[2] = (unsigned char) (len >> 8);
+    head[3] = (unsigned char) len;
+    head_len = 4;
+  } else {
+    head[1] = 127;
+    for(size_t i=0;i<8;i++) head[2 + i] = (unsigned char) ((uint64_t) len >> (56 - 8 * i));
+    head_len = 10;
+  }
+
+  Http_Buffer buffers[2];
+  buffers[0].data = head;
+  buffers[0].len = head_len;
+
+  if(ws->server) {
+    buffers[1].data = data;
+    buffers[1].len = len;
+    return http_socket_writev(ws->http, buffers, len > 0 ? 2 : 1);
+  }
+
+  // Clients mask every frame with a new key. The payload is masked in chunks,
+  // the data of the caller stays untouched.
+  unsigned char *mask = head + head_len;
+  uint32_t key = (uint32_t) http_websocket_random(ws);
+  memcpy(mask, &key, 4);
+  head[1] |= 0x80;
+  buffers[0].len = head_len + 4;
+
+  char chunk[HTTP_BUFFER_SIZE];
+  size_t off = 0;
+  bool first = true;
+  while(first || off < len) {
+    size_t n = len - off;
+    if(n > sizeof(chunk)) n = sizeof(chunk);
+    memcpy(chunk, (const char *) data + off, n);
+    http_websocket_mask(chunk, n, mask, off);
+    buffers[1].data = chunk;
+    buffers[1].len = n;
+
+    bool ok = first
+      ? http_socket_writev(ws->http, buffers, n > 0 ? 2 : 1)
+      : http_socket_writev(ws->http, buffers + 1, 1);
+    if(!ok) {
+      return false;
+    }
+    off += n;
+    first = false;
+  }
+
+  return true;
+}
+
+static bool http_websocket_reserve(char **buffer, size_t *cap, size_t need) {
+  if(need <= *cap) {
+    return true;
+  }
+
+  size_t new_cap = *cap > 0 ? *cap : 4096;
+  while(new_cap < need) new_cap *= 2;
+  char *new_buffer = realloc(*buffer, new_cap);
+  if(!new_buffer) {
+    return false;
+  }
+  *buffer = new_buffer;
+  *cap = new_cap;
+  return true;
+}
+
+#ifdef HTTP_MINIZ
+
+static bool http_websocket_send_deflated(Http_Websocket *ws, int opcode, const void *data, size_t len) {
+  mz_stream *s = &ws->deflate_stream;
+  if(!ws->deflate_init) {
+    memset(s, 0, sizeof(*s));
+    if(mz_deflateInit2(s, MZ_DEFAULT_LEVEL, MZ_DEFLATED, -MZ_DEFAULT_WINDOW_BITS, 9, MZ_DEFAULT_STRATEGY) != MZ_OK) {
+      return false;
+    }
+    ws->deflate_init = true;
+  }
+
+  s->next_in = (const unsigned char *) data;
+  s->avail_in = (unsigned int) len;
+
+  size_t out_len = 0;
+  while(true) {
+    if(!http_websocket_reserve(&ws->compressed, &ws->compressed_cap, out_len + len / 4 + 1024)) {
+      return false;
+    }
+    s->next_out = (unsigned char *) ws->compressed + out_len;
+    s->avail_out = (unsigned int) (ws->compressed_cap - out_len);
+
+    int status = mz_deflate(s, MZ_SYNC_FLUSH);
+    out_len = (size_t) ((char *) s->next_out - ws->compressed);
+    if(status != MZ_OK && status != MZ_BUF_ERROR) {
+      return false;
+    }
+    if(s->avail_in == 0 && s->avail_out > 0) {
+      break;
+    }
+  }
+
+  // Every message ends with an empty stored block, which is not sent (RFC 7692 7.2.1)
+  if(out_len >= 4 && memcmp(ws->compressed + out_len - 4, "\x00\x00\xff\xff", 4) == 0) {
+    out_len -= 4;
+  }
+
+  if(ws->deflate_reset) {
+    mz_deflateReset(s);
+  }
+
+  return http_websocket_write_frame(ws, opcode, true, true, ws->compressed, out_len);
+}
+
+static bool http_websocket_inflate(Http_Websocket *ws, char **data, size_t *len) {
+  mz_stream *s = &ws->inflate;
+  if(!ws->inflate_init) {
+    memset(s, 0, sizeof(*s));
+    if(mz_inflateInit2(s, -MZ_DEFAULT_WINDOW_BITS) != MZ_OK) {
+      return false;
+    }
+    ws->inflate_init = true;
+  }
+
+  // The stored block, that the sender removed. The message has room for it.
+  memcpy(ws->message + ws->message_len, "\x00\x00\xff\xff", 4);
+  s->next_in = (const unsigned char *) ws->message;
+  s->avail_in = (unsigned int) (ws->message_len + 4);
+
+  size_t out_len = 0;
+  while(true) {
+    if(!http_websocket_reserve(&ws->decoded, &ws->decoded_cap, out_len + ws->message_len * 2 + 1024)) {
+      return false;
+    }
+    s->next_out = (unsigned char *) ws->decoded + out_len;
+    s->avail_out = (unsigned int) (ws->decoded_cap - out_len);
+
+    int status = mz_inflate(s, MZ_SYNC_FLUSH);
+    out_len = (size_t) ((char *) s->next_out - ws->decoded);
+    if(status != MZ_OK && status != MZ_BUF_ERROR && status != MZ_STREAM_END) {
+      return false;
+    }
+    if(out_len > HTTP_WEBSOCKET_MESSAGE_CAP) {
+      return false;
+    }
+    if(s->avail_in == 0 && s->avail_out > 0) {
+      break;
+    }
+    if(status == MZ_BUF_ERROR && s->avail_out > 0) {
+      return false;
+    }
+  }
+
+  *data = ws->decoded;
+  *len = out_len;
+  return true;
+}
+
+#endif // HTTP_MINIZ
+
+HTTP_DEF bool http_websocket_send(Http_Websocket *ws, int opcode, const void *data, size_t len) {
+#ifdef HTTP_MINIZ
+  if(ws->deflate && len >= HTTP_WEBSOCKET_DEFLATE_MIN && len <= UINT_MAX &&
+     (opcode == HTTP_WEBSOCKET_TEXT || opcode == HTTP_WEBSOCKET_BINARY)) {
+    return http_websocket_send_deflated(ws, opcode, data, len);
+  }
+#endif // HTTP_MINIZ
+
+  return http_websocket_write_frame(ws, opcode, true, false, data, len);
+}
+
+HTTP_DEF bool http_websocket_send_frame(Http_Websocket *ws, int opcode, bool fin, const void *data, size_t len) {
+  return http_websocket_write_frame(ws, opcode, fin, false, data, len);
+}
+
+HTTP_DEF bool http_websocket_close(Http_Websocket *ws, uint16_t code) {
+  if(ws->close_sent) {
+    return true;
+  }
+  ws->close_sent = true;
+
+  unsigned char payload[2];
+  payload[0] = (unsigned char) (code >> 8);
+  payload[1] = (unsigned char) code;
+  return http_websocket_write_frame(ws, HTTP_WEBSOCKET_CLOSE, true, false, payload, sizeof(payload));
+}
+
+static bool http_websocket_fail(Http_Websocket *ws, uint16_t code, const char *reason) {
+  HTTP_LOG("Websocket: %s", reason);
+  (void) reason;
+  http_websocket_close(ws, code);
+  return false;
+}
+
+// Makes at least 'need' bytes available in the buffer
+static bool http_websocket_fill(Http_Websocket *ws, size_t need) {
+  if(ws->buffer_size >= need) {
+    return true;
+  }
+  if(ws->buffer_pos > 0) {
+    memmove(ws->buffer, ws->buffer + ws->buffer_pos, ws->buffer_size);
+    ws->buffer_pos = 0;
+  }
+
+  while(ws->buffer_size < need) {
+    size_t read;
+    if(!HTTP_READ_FUNC(ws->buffer + ws->buffer_size, sizeof(ws->buffer) - ws->buffer_size, ws->http, &read)) {
+      return false;
+    }
+    if(read == 0) {
+      return false;
+    }
+    ws->buffer_size += read;
+  }
+
+  return true;
+}
+
+static bool http_websocket_payload(Http_Websocket *ws, char *dst, size_t len) {
+  size_t n = len < ws->buffer_size ? len : ws->buffer_size;
+  memcpy(dst, ws->buffer + ws->buffer_pos, n);
+  ws->buffer_pos += n;
+  ws->buffer_size -= n;
+  dst += n;
+  len -= n;
+
+  // Large payloads are read straight into the message
+  while(len >= sizeof(ws->buffer) / 2) {
+    size_t read;
+    if(!HTTP_READ_FUNC(dst, len, ws->http, &read) || read == 0) {
+      return false;
+    }
+    dst += read;
+    len -= read;
+  }
+
+  if(len > 0) {
+    if(!http_websocket_fill(ws, len)) {
+      return false;
+    }
+    memcpy(dst, ws->buffer + ws->buffer_pos, len);
+    ws->buffer_pos += len;
+    ws->buffer_size -= len;
+  }
+
+  return true;
+}
+
+HTTP_DEF bool http_websocket_read(Http_Websocket *ws, int *opcode, char **data, size_t *len) {
+
+  while(!ws->close_received) {
+    if(!http_websocket_fill(ws, 2)) {
+      return false;
+    }
+
+    unsigned char *h = (unsigned char *) ws->buffer + ws->buffer_pos;
+    bool fin = (h[0] & 0x80) != 0;
+    bool rsv1 = (h[0] & 0x40) != 0;
+    int op = h[0] & 0x0f;
+    bool masked = (h[1] & 0x80) != 0;
+    uint64_t payload_len = h[1] & 0x7f;
+    size_t head_len = 2 + (payload_len == 126 ? 2 : payload_len == 127 ? 8 : 0) + (masked ? 4 : 0);
+
+    if((h[0] & 0x30) || (rsv1 && !ws->deflate)) {
+      return http_websocket_fail(ws, 1002, "Reserved bits are set");
+    }
+    // Clients mask, servers do not
+    if(masked != ws->server) {
+      return http_websocket_fail(ws, 1002, "Wrong masking");
+    }
+
+    if(!http_websocket_fill(ws, head_len)) {
+      return false;
+    }
+    h = (unsigned char *) ws->buffer + ws->buffer_pos;
+
+    size_t p = 2;
+    if(payload_len == 126) {
+      payload_len = (uint64_t) h[2] << 8 | (uint64_t) h[3];
+      p = 4;
+    } else if(payload_len == 127) {
+      payload_len = 0;
+      for(size_t i=0;i<8;i++) payload_len = payload_len << 8 | h[2 + i];
+      p = 10;
+    }
+    unsigned char mask[4] = {0};
+    if(masked) {
+      memcpy(mask, h + p, 4);
+    }
+    ws->buffer_pos += head_len;
+    ws->buffer_size -= head_len;
+
+    if(op >= 0x8) {
+      // Control-frames are short and never fragmented
+      if(!fin || rsv1 || payload_len > 125) {
+	return http_websocket_fail(ws, 1002, "Invalid control-frame");
+      }
+
+      char control[125];
+      if(!http_websocket_payload(ws, control, (size_t) payload_len)) {
+	return false;
+      }
+      if(masked) {
+	http_websocket_mask(control, (size_t) payload_len, mask, 0);
+      }
+
+      if(op == HTTP_WEBSOCKET_PING) {
+	if(!http_websocket_write_frame(ws, HTTP_WEBSOCKET_PONG, true, false, control, (size_t) payload_len)) {
+	  return false;
+	}
+      } else if(op == HTTP_WEBSOCKET_CLOSE) {
+	ws->close_received = true;
+	ws->close_code = payload_len >= 2
+	  ? (uint16_t) ((unsigned char) control[0] << 8 | (unsigned char) control[1])
+	  : 1005;
+
+	// Echo the status-code
+	if(!ws->close_sent) {
+	  ws->close_sent = true;
+	  http_websocket_write_frame(ws, HTTP_WEBSOCKET_CLOSE, true, false, control, payload_len >= 2 ? 2 : 0);
+	}
+	return false;
+      } else if(op != HTTP_WEBSOCKET_PONG) {
+	return http_websocket_fail(ws, 1002, "Unknown opcode");
+      }
+      continue;
+    }
+
+    if(op == HTTP_WEBSOCKET_CONTINUATION) {
+      if(ws->message_opcode == HTTP_WEBSOCKET_CONTINUATION || rsv1) {
+	return http_websocket_fail(ws, 1002, "Unexpected continuation-frame");
+      }
+    } else if(op == HTTP_WEBSOCKET_TEXT || op == HTTP_WEBSOCKET_BINARY) {
+      if(ws->message_opcode != HTTP_WEBSOCKET_CONTINUATION) {
+	return http_websocket_fail(ws, 1002, "Message is not finished");
+      }
+      ws->message_opcode = op;
+      ws->message_compressed = rsv1;
+      ws->message_len = 0;
+    } else {
+      return http_websocket_fail(ws, 1002, "Unknown opcode");
+    }
+
+    if(payload_len > HTTP_WEBSOCKET_MESSAGE_CAP - ws->message_len) {
+      return http_websocket_fail(ws, 1009, "Message is bigger than HTTP_WEBSOCKET_MESSAGE_CAP");
+    }
+    // 4 more bytes for the tail of a compressed message
+    if(!http_websocket_reserve(&ws->message, &ws->message_cap, ws->message_len + (size_t) payload_len + 4)) {
+      return http_websocket_fail(ws, 1011, "Out of memory");
+    }
+    char *payload = ws->message + ws->message_len;
+    if(!http_websocket_payload(ws, payload, (size_t) payload_len)) {
+      return false;
+    }
+    if(masked) {
+      http_websocket_mask(payload, (size_t) payload_len, mask, 0);
+    }
+    ws->message_len += (size_t) payload_len;
+
+    if(!fin) {
+      continue;
+    }
+
+    *opcode = ws->message_opcode;
+    ws->message_opcode = HTTP_WEBSOCKET_CONTINUATION;
+
+    if(ws->message_compressed) {
+#ifdef HTTP_MINIZ
+      if(!http_websocket_inflate(ws, data, len)) {
+	return http_websocket_fail(ws, 1007, "Can not inflate message");
+      }
+      return true;
+#endif // HTTP_MINIZ
+    }
+
+    *data = ws->message;
+    *len = ws->message_len;
+    return true;
+  }
+
+  return false;
+}
+
+HTTP_DEF void http_websocket_free(Http_Websocket *ws) {
+  free(ws->message);
+  ws->message = NULL;
+#ifdef HTTP_MINIZ
+  if(ws->inflate_init) mz_inflateEnd(&ws->inflate);
+  if(ws->deflate_init) mz_deflateEnd(&ws->deflate_stream);
+  free(ws->decoded);
+  free(ws->compressed);
+  ws->inflate_init = false;
+  ws->deflate_init = false;
+  ws->decoded = NULL;
+  ws->compressed = NULL;
+#endif // HTTP_MINIZ
+}
+
 #endif // HTTP_IMPLEMENTATION
 
 #endif // HTTP_H
@@ -15,11 +15,42 @@
 #  include <fcntl.h>
 #  include <unistd.h>
 #  include <sys/stat.h>
+#  include <sys/mman.h>
+#  include <sys/syscall.h>
+#  include <sys/uio.h>
 #  include <dirent.h>
+#  include <pthread.h>
 #  include <linux/limits.h>
 #  define IO_MAX_PATH PATH_MAX
+#  if !defined(IO_NO_URING) && defined(__has_include)
+#    if __has_include(<linux/io_uring.h>)
+#      include <linux/io_uring.h>
+#      define IO_URING
+#    endif
+#  endif
 #endif //_WIN32
 
+#include <stdint.h>
+#include <stdarg.h>
+
+#ifndef IO_ENGINE_THREADS
+#  define IO_ENGINE_THREADS 4
+#endif // IO_ENGINE_THREADS
+
+#ifndef IO_STREAM_BUFFERS
+#  define IO_STREAM_BUFFERS 2
+#endif // IO_STREAM_BUFFERS
+
+#ifndef IO_WRITER_CAP
+#  define IO_WRITER_CAP (64 << 10)
+#endif // IO_WRITER_CAP
+
+// Files, that were modified less than this before the cache was saved, are hashed again,
+// even if their metadata matches. The file could have been changed again in the same tick.
+#ifndef IO_CACHE_RACY_NS
+#  define IO_CACHE_RACY_NS 2000000000ULL
+#endif // IO_CACHE_RACY_NS
+
 #ifndef IO_DEF
 #  define IO_DEF static inline
 #endif //IO_DEF
@@ -41,7 +72,13 @@ typedef bool (*Io_Stream_Callback)(void *userdata, const unsigned char *buf, siz
 IO_DEF bool io_slurp_file(const char *filepath, unsigned char **data, size_t *data_size);
 IO_DEF bool io_write_file(const char *filepath, unsigned char *data, size_t data_size);
 IO_DEF bool io_delete_file(const char *filepath);
+// Reads the next IO_STREAM_BUFFERS - 1 chunks ahead (into allocated buffers), while 'callback' runs.
+// A file, that fits into one chunk, is read without an Io_Engine, there is nothing to overlap.
 IO_DEF bool io_stream_file(const char *filepath, Io_Stream_Callback callback, unsigned char *buf, size_t buf_size, void *userdata);
+// Like io_stream_file, but 'buf' holds 'buffers' chunks of 'buf_size' bytes, which rotate:
+// The callback consumes chunk k, while the chunks k + 1 .. k + buffers - 1 are read.
+IO_DEF bool io_stream_file_pipelined(const char *filepath, Io_Stream_Callback callback, unsigned char *buf, size_t buf_size,
+				     size_t buffers, void *userdata);
 
 IO_DEF bool io_create_dir(const char *dir_path, bool *existed);
 IO_DEF bool io_delete_dir(const char *dir_path);
@@ -63,6 +100,7 @@ typedef struct{
     struct dirent *ent;
     DIR *handle;
     struct stat stats;
+    size_t name_len;
 #endif //_WIN32
 
     const char *name;
@@ -80,6 +118,40 @@ IO_DEF void io_dir_close(Io_Dir *dir);
 
 ////////////////////////////////////////////////////////////////////////////////////////
 
+// Io_Walk
+
+// Recursive directory walks. On linux every directory is read with getdents64 into
+// IO_WALK_BUFFER bytes and opened relative to its parent (openat). Whether an entry is a
+// directory comes from d_type, only filesystems without it cost an fstatat per entry.
+// Symbolic links are reported, but not followed.
+
+#ifndef IO_WALK_BUFFER
+#  define IO_WALK_BUFFER (32 << 10)
+#endif // IO_WALK_BUFFER
+
+typedef struct{
+  // 'root/a/b', only valid during the callback
+  const char *path;
+  size_t path_len;
+  // 'b', points into 'path'
+  const char *name;
+  bool is_dir;
+  // 0 for the entries of 'root'
+  size_t depth;
+}Io_Walk_Entry;
+
+// Return false to stop the walk
+typedef bool (*Io_Walk_Callback)(void *userdata, Io_Walk_Entry *entry);
+
+// Returns false if 'root' or a directory below it could not be read
+IO_DEF bool io_walk(const char *root, Io_Walk_Callback callback, void *userdata);
+// Every thread owns a deque of directories. It takes the newest of its own and steals the
+// oldest of the others, when it ran out. The callback runs concurrently on 'threads'
+// threads (0 means one per cpu).
+IO_DEF bool io_walk_parallel(const char *root, size_t threads, Io_Walk_Callback callback, void *userdata);
+
+////////////////////////////////////////////////////////////////////////////////////////
+
 // Io_File
 
 typedef enum{
@@ -89,26 +161,246 @@ typedef enum{
 }Io_Mode;
 
 #ifdef _WIN32
-typedef struct{ HANDLE handle; DWORD size; DWORD pos; }Io_File;
+typedef struct{ HANDLE handle; uint64_t size; uint64_t pos; }Io_File;
 #else
-typedef struct{ int fd; size_t size; size_t pos; }Io_File;
+typedef struct{ int fd; uint64_t size; uint64_t pos; }Io_File;
 #endif //_WIN32
 
 IO_DEF bool io_file_open(Io_File *f, const char *filepath, Io_Mode mode);
-IO_DEF int io_file_seek(Io_File *f, long int offset, int whence);
-IO_DEF long int io_file_tell(Io_File *f);
+// Returns 0 on success and -1 on failure, like fseek
+IO_DEF int io_file_seek(Io_File *f, int64_t offset, int whence);
+IO_DEF int64_t io_file_tell(Io_File *f);
 IO_DEF size_t io_file_read(Io_File *f, void *ptr, size_t size, size_t count);
 IO_DEF size_t io_file_write(Io_File *f, const void *ptr, size_t size, size_t nmemb);
+// Read/write 'len' bytes at 'offset', without using or moving 'f->pos', so many threads can
+// share one Io_File. Short transfers are continued, so less than 'len' bytes are only returned
+// at the end of the file (or on an error).
+IO_DEF size_t io_file_pread(Io_File *f, void *buf, size_t len, uint64_t offset);
+IO_DEF size_t io_file_pwrite(Io_File *f, const void *buf, size_t len, uint64_t offset);
 IO_DEF void io_file_close(Io_File *f);
 
 ////////////////////////////////////////////////////////////////////////////////////////
 
+// Io_Writer
+
+// Collects small writes to an Io_File and writes them with one syscall per full buffer.
+// Writes, that are at least as big as the buffer, are not copied: They leave together
+// with the buffered bytes in one writev.
+
+typedef struct{
+  Io_File *file;
+  unsigned char *buf;
+  size_t len, cap;
+  bool owned;
+  bool failed;
+}Io_Writer;
+
+// 'buf' can be NULL, then 'cap' bytes (or IO_WRITER_CAP, if 'cap' is 0) are allocated
+IO_DEF bool io_writer_init(Io_Writer *w, Io_File *f, unsigned char *buf, size_t cap);
+IO_DEF bool io_writer_write(Io_Writer *w, const void *data, size_t data_len);
+IO_DEF bool io_writer_printf(Io_Writer *w, const char *fmt, ...);
+IO_DEF bool io_writer_flush(Io_Writer *w);
+// Does not flush
+IO_DEF void io_writer_free(Io_Writer *w);
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+// Io_Commit
+
+// Replaces files atomically: Everything is written to a temporary file next to the target,
+// which is renamed over the target in io_commit_finish. A crash leaves either the old or the
+// new content, never a truncated file.
+//
+// If 'durable', the data is on disk, when io_commit_finish returns. The writeback of all files
+// is started at once and every directory is synced only once, so committing many files does not
+// cost a full round trip to the disk per file.
+//
+// Every file is replaced atomically, the batch is not: If a rename fails, the files before it
+// are already replaced. Every pending file holds an open descriptor.
+
+typedef struct{
+  char *path;
+  char *tmp_path;
+  Io_File file;
+}Io_Commit_File;
+
+typedef struct{
+  Io_Commit_File **files;
+  size_t len, cap;
+  bool durable;
+}Io_Commit;
+
+IO_DEF void io_commit_init(Io_Commit *c, bool durable);
+// Returns the temporary file, which is valid until io_commit_finish/io_commit_abort
+IO_DEF Io_File *io_commit_open(Io_Commit *c, const char *filepath);
+IO_DEF bool io_commit_write(Io_Commit *c, const char *filepath, const unsigned char *data, size_t data_size);
+IO_DEF bool io_commit_finish(Io_Commit *c);
+// Deletes all temporary files
+IO_DEF void io_commit_abort(Io_Commit *c);
+
+IO_DEF bool io_write_file_atomic(const char *filepath, const unsigned char *data, size_t data_size, bool durable);
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+// Io_Mapping
+
+// A read-only view of a whole file. Pages are loaded, when they are touched, and
+// are shared with the page cache, so nothing is copied. Writing to 'data' crashes.
+
+typedef enum{
+  IO_ADVICE_NORMAL = 0,
+  IO_ADVICE_SEQUENTIAL,
+  IO_ADVICE_RANDOM,
+  IO_ADVICE_WILLNEED,
+  IO_ADVICE_DONTNEED,
+  COUNT_IO_ADVICE,
+}Io_Advice;
+
+typedef struct{
+  unsigned char *data;
+  size_t size;
+#ifdef _WIN32
+  HANDLE handle;
+  HANDLE mapping;
+#endif //_WIN32
+}Io_Mapping;
+
+IO_DEF bool io_mapping_open(Io_Mapping *m, const char *filepath);
+// Hints the access pattern for the bytes [offset, offset + len) of the view
+IO_DEF bool io_mapping_advise(Io_Mapping *m, size_t offset, size_t len, Io_Advice advice);
+IO_DEF void io_mapping_close(Io_Mapping *m);
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+// Io_Cache
+
+// Remembers what files looked like, to find out which ones changed since the last run.
+// If size, modification time and inode match, the file is not read at all. Otherwise its
+// content hash decides, so a touched, but unchanged file is not reported.
+//
+// io_cache_check only records the new state. It is persisted with io_cache_save, which
+// should be called, once the work, that depends on the files, succeeded.
+
+typedef struct{
+  uint64_t size;
+  uint64_t mtime_ns;
+  uint64_t inode;
+}Io_Stamp;
+
+typedef struct{
+  char *path;
+  uint64_t path_hash;
+  Io_Stamp stamp;
+  uint64_t hash;
+  bool seen;
+}Io_Cache_Entry;
+
+typedef struct{
+  char *filepath;
+  uint64_t saved_ns;
+
+  Io_Cache_Entry *items;
+  size_t len, cap;
+
+  // Open addressing over 'items', index + 1, 0 is empty
+  size_t *index;
+  size_t index_cap;
+
+  bool dirty;
+}Io_Cache;
+
+IO_DEF uint64_t io_hash(const void *data, size_t data_len);
+IO_DEF bool io_hash_file(const char *filepath, uint64_t *hash);
+IO_DEF bool io_stamp_get(const char *filepath, Io_Stamp *stamp);
+
+// A missing or unreadable cache file results in an empty cache
+IO_DEF bool io_cache_load(Io_Cache *c, const char *filepath);
+// Sets 'changed', if 'filepath' is new or its content changed. A missing file counts as changed.
+IO_DEF bool io_cache_check(Io_Cache *c, const char *filepath, bool *changed);
+// Removes the entries, that were not checked since io_cache_load. Returns how many.
+IO_DEF size_t io_cache_prune(Io_Cache *c);
+IO_DEF bool io_cache_save(Io_Cache *c);
+IO_DEF void io_cache_free(Io_Cache *c);
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+// Io_Engine
+
+// Reads and writes at explicit offsets, that run in the background. On linux they are
+// submitted in batches to an io_uring, or to IO_ENGINE_THREADS threads, if io_uring is
+// not available, does not support IORING_OP_READ/IORING_OP_WRITE (before 5.6), or
+// IO_NO_URING is defined. On windows they run in io_engine_submit.
+//
+// io_engine_read/io_engine_write only queue an operation. The 'op' and the 'buf' must stay
+// valid until the operation is done. Callbacks run on the thread calling io_engine_wait.
+
+typedef struct Io_Engine_Op Io_Engine_Op;
+
+typedef void (*Io_Engine_Callback)(void *userdata, Io_Engine_Op *op);
+
+struct Io_Engine_Op{
+  bool write;
+  Io_File *file;
+  void *buf;
+  size_t len;
+  uint64_t offset;
+  Io_Engine_Callback callback;
+  void *userdata;
+
+  bool done;
+  // Bytes transferred, like pread/pwrite (less than 'len' at the end of a file), or -1
+  int64_t result;
+  int error;
+
+  Io_Engine_Op *next;
+};
+
+typedef struct{
+  size_t depth;
+  size_t inflight;
+  Io_Engine_Op *queue, *queue_last;
+  Io_Engine_Op *done, *done_last;
+  bool uring;
+
+#ifndef _WIN32
+  int ring;
+  void *sq_ring, *cq_ring, *sqes, *cqes;
+  size_t sq_ring_size, cq_ring_size, sqes_size;
+  unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+  unsigned *cq_head, *cq_tail, *cq_mask;
+  unsigned to_submit; // in the ring, but not yet taken by io_uring_enter
+
+  pthread_t threads[IO_ENGINE_THREADS];
+  size_t threads_len;
+  pthread_mutex_t mutex;
+  pthread_cond_t work_cond, done_cond;
+  Io_Engine_Op *work, *work_last;
+  bool stop;
+#endif //_WIN32
+}Io_Engine;
+
+// At most 'depth' operations are in flight, the rest waits in the queue
+IO_DEF bool io_engine_init(Io_Engine *e, size_t depth);
+IO_DEF void io_engine_read(Io_Engine *e, Io_Engine_Op *op, Io_File *f, void *buf, size_t len, uint64_t offset,
+			   Io_Engine_Callback callback, void *userdata);
+IO_DEF void io_engine_write(Io_Engine *e, Io_Engine_Op *op, Io_File *f, const void *buf, size_t len, uint64_t offset,
+			    Io_Engine_Callback callback, void *userdata);
+IO_DEF bool io_engine_submit(Io_Engine *e);
+// Submits the queue and waits until at least 'min_complete' operations are done (0 polls).
+// Returns the number of completed operations.
+IO_DEF size_t io_engine_wait(Io_Engine *e, size_t min_complete);
+// Waits for every operation, that is still in flight
+IO_DEF void io_engine_free(Io_Engine *e);
+
+////////////////////////////////////////////////////////////////////////////////////////
+
 IO_DEF int io_last_error();
 IO_DEF const char *io_last_error_cstr();
 
 #ifdef IO_IMPLEMENTATION
 
 #define io_file_write_cstr(f, cstr) io_file_write((f), (cstr), 1, (strlen(cstr)))
+#define io_writer_write_cstr(w, cstr) io_writer_write((w), (cstr), (strlen(cstr)))
 
 IO_DEF bool io_slurp_file(const char *filepath, unsigned char **data, size_t *data_size) {
   Io_File f;
@@ -118,7 +410,12 @@ IO_DEF bool io_slurp_file(const char *filepath, unsigned char **data, size_t *da
     return false;
   }
 
-  *data_size = f.size;
+  if(f.size > SIZE_MAX) {
+    io_file_close(&f);
+    IO_LOG("'%s' does not fit into memory", filepath);
+    return false;
+  }
+  *data_size = (size_t) f.size;
   
   unsigned char *result = malloc(*data_size);
   if(!result) {
@@ -127,11 +424,18 @@ IO_DEF bool io_slurp_file(const char *filepath, unsigned char **data, size_t *da
     return false;
   }
 
-  if(*data_size != io_file_read(&f, result, 1, *data_size)) {
-    io_file_close(&f);
-    IO_LOG("Failed to read: '%s': (%d) %s",
-	   filepath, io_last_error(), io_last_error_cstr());
-    return false;
+  // A read may return less than requested
+  size_t pos = 0;
+  while(pos < *data_size) {
+    size_t read = io_file_read(&f, result + pos, 1, *data_size - pos);
+    if(read == 0) {
+      io_file_close(&f);
+      free(result);
+      IO_LOG("Failed to read: '%s': (%d) %s",
+	     filepath, io_last_error(), io_last_error_cstr());
+      return false;
+    }
+    pos += read;
   }
 
   *data = result;
@@ -184,6 +488,64 @@ IO_DEF bool io_delete_file(const char *filepath) {
 #endif // _WIN32
 }
 
+// The next 'buffers' - 1 chunks are read ahead by an Io_Engine, while the callback
+// processes the oldest one. Chunk 0 goes to 'first', chunk i to 'rest' + (i - 1) * buf_size.
+static bool io_stream_file_engine(Io_File *f, Io_Stream_Callback callback, size_t buf_size, size_t buffers,
+				  unsigned char *first, unsigned char *rest, void *userdata, bool *ok) {
+  Io_Engine_Op *ops = malloc(buffers * sizeof(Io_Engine_Op));
+  Io_Engine engine;
+  if(!ops || !io_engine_init(&engine, buffers)) {
+    free(ops);
+    return false;
+  }
+
+#ifndef _WIN32
+  // Doubles the readahead of the kernel
+  posix_fadvise(f->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif //_WIN32
+
+  for(size_t i=0;i<buffers;i++) {
+    unsigned char *buf = i == 0 ? first : rest + (i - 1) * buf_size;
+    io_engine_read(&engine, &ops[i], f, buf, buf_size, i * buf_size, NULL, NULL);
+  }
+
+  *ok = false;
+  for(uint64_t k=0;;k++) {
+    Io_Engine_Op *op = &ops[k % buffers];
+    unsigned char *buf = op->buf;
+    while(!op->done) {
+      if(io_engine_wait(&engine, 1) == 0 && !op->done) break;
+    }
+    if(!op->done || op->result < 0) {
+      break;
+    }
+
+    // A short read, that is not at the end of the file, is completed here
+    size_t len = (size_t) op->result;
+    if(0 < len && len < buf_size) {
+      len += io_file_pread(f, buf + len, buf_size - len, op->offset + len);
+    }
+
+    if(len == 0) {
+      *ok = true;
+      break;
+    }
+    if(!callback(userdata, buf, len)) {
+      break;
+    }
+    if(len < buf_size) {
+      *ok = true;
+      break;
+    }
+
+    io_engine_read(&engine, op, f, buf, buf_size, (k + buffers) * buf_size, NULL, NULL);
+  }
+
+  io_engine_free(&engine);
+  free(ops);
+  return true;
+}
+
 IO_DEF bool io_stream_file(const char *filepath, Io_Stream_Callback callback, unsigned char *buf, size_t buf_size, void *userdata) {
   Io_File f;
   if(!io_file_open(&f, filepath, IO_MODE_READ)) {
@@ -192,6 +554,17 @@ IO_DEF bool io_stream_file(const char *filepath, Io_Stream_Callback callback, un
     return false;
   }
 
+  if(IO_STREAM_BUFFERS > 1 && f.size > buf_size) {
+    bool ok;
+    unsigned char *rest = malloc((IO_STREAM_BUFFERS - 1) * buf_size);
+    if(rest && io_stream_file_engine(&f, callback, buf_size, IO_STREAM_BUFFERS, buf, rest, userdata, &ok)) {
+      free(rest);
+      io_file_close(&f);
+      return ok;
+    }
+    free(rest);
+  }
+
   while(true) {
     size_t read = io_file_read(&f, buf, 1, buf_size);
     if(read == 0) {
@@ -208,6 +581,28 @@ IO_DEF bool io_stream_file(const char *filepath, Io_Stream_Callback callback, un
   return true;
 }
 
+IO_DEF bool io_stream_file_pipelined(const char *filepath, Io_Stream_Callback callback, unsigned char *buf, size_t buf_size,
+				     size_t buffers, void *userdata) {
+  Io_File f;
+  if(!io_file_open(&f, filepath, IO_MODE_READ)) {
+    IO_LOG("Failed to open '%s': (%d) %s",
+	   filepath, io_last_error(), io_last_error_cstr());
+    return false;
+  }
+
+  if(buffers < 1) buffers = 1;
+
+  bool ok;
+  if(!io_stream_file_engine(&f, callback, buf_size, buffers, buf, buf + buf_size, userdata, &ok)) {
+    io_file_close(&f);
+    IO_LOG("Failed to create an Io_Engine for '%s'", filepath);
+    return false;
+  }
+
+  io_file_close(&f);
+  return ok;
+}
+
 IO_DEF bool io_create_dir(const char *dir_path, bool *_existed) {
 #ifdef _WIN32
   
@@ -390,8 +785,9 @@ IO_DEF bool io_dir_open(Io_Dir *dir, const char *dirpath) {
   return true;
 #else
 
-  dir->name = dir_path;
-  dir->handle = opendir(dir_path);
+  dir->name = dirpath;
+  dir->name_len = strlen(dirpath);
+  dir->handle = opendir(dirpath);
   if(dir->handle == NULL) {
     return false;
   }
@@ -438,21 +834,29 @@ IO_DEF bool io_dir_next(Io_Dir *dir, Io_Dir_Entry *entry) {
   return true;
 #else
 
-  dir->ent = readdir(dir->handle);
-  if(dir->ent == NULL) {
-    return false;
-  }
+  size_t d_name_len;
+  do {
+    dir->ent = readdir(dir->handle);
+    if(dir->ent == NULL) {
+      return false;
+    }
 
-  size_t d_name_len = strlen(dir->ent->d_name);
-  entry->name = dir->ent->d_name;
+    // Names, that do not fit into 'abs_name', are skipped
+    d_name_len = strlen(dir->ent->d_name);
+  } while(dir->name_len + 1 + d_name_len >= IO_MAX_PATH);
 
-  size_t dir_name_len = strlen(dir->name);
-  memcpy(entry->abs_name, dir->name, dir_name_len);
-  entry->abs_name[dir_name_len++] = '/';
-  
-  memcpy(entry->abs_name + dir_name_len, dir->ent->d_name, d_name_len);
-  dir_name_len += d_name_len;
-  entry->abs_name[dir_name_len] = '\0';
+  size_t abs_name_len = dir->name_len;
+  memcpy(entry->abs_name, dir->name, abs_name_len);
+  entry->abs_name[abs_name_len++] = '/';
+
+  memcpy(entry->abs_name + abs_name_len, dir->ent->d_name, d_name_len + 1);
+  entry->name = entry->abs_name + abs_name_len;
+
+  // Only links (which are followed) and filesystems without d_type need a stat
+  if(dir->ent->d_type != DT_UNKNOWN && dir->ent->d_type != DT_LNK) {
+    entry->is_dir = dir->ent->d_type == DT_DIR;
+    return true;
+  }
 
   if(stat(entry->abs_name, &dir->stats) < 0) {
     return false;
@@ -473,149 +877,585 @@ IO_DEF void io_dir_close(Io_Dir *dir) {
 
 ////////////////////////////////////////////////////////////////////////////////////////
 
-IO_DEF bool io_file_open(Io_File *f, const char *filepath, Io_Mode mode) {
-#ifdef _WIN32
-  
-  wchar_t windows_filepath[MAX_PATH];
-  MultiByteToWideChar(CP_UTF8, 0, filepath, -1, windows_filepath, MAX_PATH);
-  
-  if(mode < 0 || COUNT_IO_MODE <= mode)
-    return false;
-
-  f->handle = INVALID_HANDLE_VALUE;
-
-  if(mode == IO_MODE_READ) {
-    f->handle = CreateFileW(windows_filepath, GENERIC_READ,
-			   FILE_SHARE_READ,
-			   NULL,
-			   OPEN_EXISTING,
-			   FILE_ATTRIBUTE_NORMAL,
-			   NULL);
-    if(f->handle == INVALID_HANDLE_VALUE)
-      goto error;
-
-    f->size = GetFileSize(f->handle, NULL);
-    if(f->size == INVALID_FILE_SIZE)
-      goto error;
+typedef struct{
+  char *path;
+  size_t depth;
+}Io_Walk_Job;
 
-    f->pos = 0;
-  } else {
-    f->handle = CreateFileW(windows_filepath,
-			   GENERIC_WRITE, 0, NULL,
-			   CREATE_ALWAYS,
-			   FILE_ATTRIBUTE_NORMAL,
-			   NULL);
-    if(f->handle == INVALID_HANDLE_VALUE)
-      goto error;
-    
-    f->pos = 0;
-    f->size = 0;
-  }
-  
-  return true;
- error:
+#ifndef _WIN32
 
-  if(f->handle != INVALID_HANDLE_VALUE)
-    CloseHandle(f->handle);
-  
-  return false;
-#else
-  
-  if(mode < 0 || COUNT_IO_MODE <= mode)
-    return false;
+// The record of getdents64
+typedef struct{
+  uint64_t d_ino;
+  int64_t d_off;
+  unsigned short d_reclen;
+  unsigned char d_type;
+  char d_name[];
+}Io_Dirent64;
 
-  f->fd = -1;
+typedef struct{
+  pthread_mutex_t mutex;
+  Io_Walk_Job *jobs;
+  size_t head, len, cap;
+}Io_Walk_Deque;
 
-  if(mode == IO_MODE_READ) {
-    f->fd = open(filepath, O_RDONLY);
-    if(f->fd < 0)
-      goto error;
+#endif //_WIN32
 
-    struct stat stats;
-    if(stat(filepath, &stats) < 0)
-      goto error;
+typedef struct{
+  Io_Walk_Callback callback;
+  void *userdata;
+  bool stop;
+  bool failed;
+
+#ifndef _WIN32
+  Io_Walk_Deque *deques;
+  size_t deques_len;
+  size_t pending; // queued and running jobs
+  size_t queued;
+
+  // Idle workers sleep on 'idle', until a job is pushed or the walk is done
+  pthread_mutex_t idle_mutex;
+  pthread_cond_t idle;
+  size_t waiting;
+#endif //_WIN32
+}Io_Walk;
 
-    f->size = (size_t) stats.st_size;
-    f->pos  = 0;
-  } else {
+static bool io_walk_reserve(char **path, size_t *path_cap, size_t len) {
+  if(len <= *path_cap) {
+    return true;
+  }
 
-    f->fd = open(filepath, O_CREAT|O_WRONLY|O_TRUNC, S_IRWXU | S_IRWXG | S_IRWXO);
-    if(f->fd < 0)
-      goto error;
+  size_t cap = *path_cap > 0 ? *path_cap : 256;
+  while(cap < len) cap *= 2;
 
-    f->size = 0;
-    f->pos  = 0;
+  char *new_path = realloc(*path, cap);
+  if(!new_path) {
+    return false;
   }
-
+  *path = new_path;
+  *path_cap = cap;
   return true;
- error:
-  if(f->fd >= 0) close(f->fd);
-  
-  return false;
-#endif //_WIN32  
 }
 
-IO_DEF int io_file_seek(Io_File *f, long int offset, int whence) {
 #ifdef _WIN32
-  DWORD moveMethod;
 
-  switch (whence) {
-  case SEEK_SET: {
-    moveMethod = FILE_BEGIN;    
-  } break;
-  case SEEK_CUR: {
-    moveMethod = FILE_CURRENT;    
-  } break;
-  case SEEK_END: {
-    moveMethod = FILE_END;    
-  } break;
-  default: {
-    return -1;  // Invalid whence
-  } break;
+static void io_walk_dir(Io_Walk *w, char *path, size_t depth) {
+  // io_dir_open expects a pattern
+  char pattern[IO_MAX_PATH];
+  if((size_t) snprintf(pattern, sizeof(pattern), "%s/*", path) >= sizeof(pattern)) {
+    w->failed = true;
+    return;
   }
 
-  f->pos = SetFilePointer(f->handle, offset, NULL, moveMethod);
-  if(f->pos == INVALID_SET_FILE_POINTER)
-    return -1;
+  Io_Dir dir;
+  if(!io_dir_open(&dir, pattern)) {
+    w->failed = true;
+    return;
+  }
 
-  return 0;
-#else
-  f->pos = (size_t) lseek(f->fd, offset, whence);
-  
-  return (int) f->pos;
-#endif //_WIN32
-}
+  Io_Dir_Entry entry;
+  while(!w->stop && io_dir_next(&dir, &entry)) {
+    if(strcmp(entry.name, ".") == 0 || strcmp(entry.name, "..") == 0) {
+      continue;
+    }
 
-IO_DEF long int io_file_tell(Io_File *f) {
-  return (long int) f->pos;
-}
+    Io_Walk_Entry walk_entry = { entry.abs_name, strlen(entry.abs_name), entry.name, entry.is_dir, depth };
+    if(!w->callback(w->userdata, &walk_entry)) {
+      w->stop = true;
+      break;
+    }
 
-IO_DEF void io_file_close(Io_File *f) {
-#ifdef _WIN32
-  CloseHandle(f->handle);
-#else
-  close(f->fd);
-#endif //_WIN32
+    if(entry.is_dir) {
+      io_walk_dir(w, entry.abs_name, depth + 1);
+    }
+  }
+
+  io_dir_close(&dir);
 }
 
+#else
 
-IO_DEF size_t io_file_read(Io_File *f, void *ptr, size_t size, size_t count) {
-#ifdef _WIN32
-  DWORD bytes_read;
-  DWORD bytes_to_read = (DWORD) (size * count);
+static bool io_walk_push(Io_Walk *w, Io_Walk_Deque *d, const char *path, size_t path_len, size_t depth);
 
-  if(!ReadFile(f->handle, ptr, bytes_to_read, &bytes_read, NULL))
-    return 0;
-  f->pos += bytes_read;
+// Calls the callback for every entry of the directory 'fd', whose path is 'path'[0..len).
+// Subdirectories are walked right away or, if 'own' is given, pushed onto 'own'.
+static void io_walk_dir(Io_Walk *w, Io_Walk_Deque *own, int fd, char **path, size_t *path_cap, size_t len, size_t depth) {
+  char *buffer = malloc(IO_WALK_BUFFER);
+  if(!buffer) {
+    __atomic_store_n(&w->failed, true, __ATOMIC_RELAXED);
+    return;
+  }
 
-  return (size_t) (bytes_read / size);
-#else
+  // 'root/' + 'name'
+  size_t sep = len > 0 && (*path)[len - 1] != '/' ? 1 : 0;
 
-  size_t bytes_to_read = size * count;
+  while(!__atomic_load_n(&w->stop, __ATOMIC_RELAXED)) {
+    long n = syscall(SYS_getdents64, fd, buffer, IO_WALK_BUFFER);
+    if(n < 0 && errno == EINTR) {
+      continue;
+    }
+    if(n <= 0) {
+      if(n < 0) __atomic_store_n(&w->failed, true, __ATOMIC_RELAXED);
+      break;
+    }
+
+    for(long pos=0;pos<n;) {
+      Io_Dirent64 *ent = (Io_Dirent64 *) (buffer + pos);
+      pos += ent->d_reclen;
+
+      const char *name = ent->d_name;
+      if(name[0] == '.' && (name[1] == 0 || (name[1] == '.' && name[2] == 0))) {
+	continue;
+      }
+
+      bool is_dir = ent->d_type == DT_DIR;
+      if(ent->d_type == DT_UNKNOWN) {
+	struct stat stats;
+	is_dir = fstatat(fd, name, &stats, AT_SYMLINK_NOFOLLOW) == 0 && S_ISDIR(stats.st_mode);
+      }
+
+      size_t name_len = strlen(name);
+      if(!io_walk_reserve(path, path_cap, len + sep + name_len + 1)) {
+	__atomic_store_n(&w->failed, true, __ATOMIC_RELAXED);
+	goto done;
+      }
+      char *p = *path;
+      p[len] = '/';
+      memcpy(p + len + sep, name, name_len + 1);
+
+      Io_Walk_Entry entry = { p, len + sep + name_len, p + len + sep, is_dir, depth };
+      if(!w->callback(w->userdata, &entry)) {
+	__atomic_store_n(&w->stop, true, __ATOMIC_RELAXED);
+	goto done;
+      }
+
+      if(!is_dir) {
+	continue;
+      }
+
+      if(own) {
+	if(!io_walk_push(w, own, p, entry.path_len, depth + 1)) {
+	  __atomic_store_n(&w->failed, true, __ATOMIC_RELAXED);
+	}
+	continue;
+      }
+
+      int child = openat(fd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+      if(child < 0) {
+	IO_LOG("Failed to open '%s': (%d) %s", p, io_last_error(), io_last_error_cstr());
+	w->failed = true;
+	continue;
+      }
+      io_walk_dir(w, NULL, child, path, path_cap, entry.path_len, depth + 1);
+      close(child);
+      if(w->stop) {
+	goto done;
+      }
+    }
+  }
+
+ done:
+  free(buffer);
+}
+
+static bool io_walk_push(Io_Walk *w, Io_Walk_Deque *d, const char *path, size_t path_len, size_t depth) {
+  char *copy = malloc(path_len + 1);
+  if(!copy) {
+    return false;
+  }
+  memcpy(copy, path, path_len + 1);
+
+  pthread_mutex_lock(&d->mutex);
+  if(d->len == d->cap) {
+    if(d->head > 0) {
+      // Reuse the slots, that were stolen from the front
+      memmove(d->jobs, d->jobs + d->head, (d->len - d->head) * sizeof(*d->jobs));
+      d->len -= d->head;
+      d->head = 0;
+    } else {
+      size_t cap = d->cap > 0 ? 2 * d->cap : 64;
+      Io_Walk_Job *jobs = realloc(d->jobs, cap * sizeof(*jobs));
+      if(!jobs) {
+	pthread_mutex_unlock(&d->mutex);
+	free(copy);
+	return false;
+      }
+      d->jobs = jobs;
+      d->cap = cap;
+    }
+  }
+  d->jobs[d->len++] = (Io_Walk_Job) { copy, depth };
+  __atomic_add_fetch(&w->pending, 1, __ATOMIC_SEQ_CST);
+  __atomic_add_fetch(&w->queued, 1, __ATOMIC_SEQ_CST);
+  pthread_mutex_unlock(&d->mutex);
+
+  if(__atomic_load_n(&w->waiting, __ATOMIC_SEQ_CST) > 0) {
+    pthread_mutex_lock(&w->idle_mutex);
+    pthread_cond_signal(&w->idle);
+    pthread_mutex_unlock(&w->idle_mutex);
+  }
+
+  return true;
+}
+
+// The newest job of 'self' (depth first, the path is still cached), or the oldest job of
+// another deque (the biggest subtrees are near the root)
+static bool io_walk_take(Io_Walk *w, size_t self, Io_Walk_Job *job) {
+  for(size_t i=0;i<w->deques_len;i++) {
+    Io_Walk_Deque *d = &w->deques[(self + i) % w->deques_len];
+
+    pthread_mutex_lock(&d->mutex);
+    bool found = d->head < d->len;
+    if(found) {
+      *job = i == 0 ? d->jobs[--d->len] : d->jobs[d->head++];
+      if(d->head == d->len) d->head = d->len = 0;
+      __atomic_sub_fetch(&w->queued, 1, __ATOMIC_SEQ_CST);
+    }
+    pthread_mutex_unlock(&d->mutex);
+
+    if(found) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+// Blocks until a job is queued. Returns false, if the walk is done or stopped
+static bool io_walk_wait(Io_Walk *w) {
+  pthread_mutex_lock(&w->idle_mutex);
+  __atomic_add_fetch(&w->waiting, 1, __ATOMIC_SEQ_CST);
+  // Directories, that are read right now, can still push new jobs
+  while(__atomic_load_n(&w->queued, __ATOMIC_SEQ_CST) == 0 &&
+	__atomic_load_n(&w->pending, __ATOMIC_SEQ_CST) > 0 &&
+	!__atomic_load_n(&w->stop, __ATOMIC_RELAXED)) {
+    pthread_cond_wait(&w->idle, &w->idle_mutex);
+  }
+  __atomic_sub_fetch(&w->waiting, 1, __ATOMIC_SEQ_CST);
+  bool more = __atomic_load_n(&w->pending, __ATOMIC_SEQ_CST) > 0;
+  pthread_mutex_unlock(&w->idle_mutex);
+
+  return more;
+}
+
+typedef struct{
+  Io_Walk *w;
+  size_t self;
+}Io_Walk_Worker;
+
+static void *io_walk_worker(void *_worker) {
+  Io_Walk_Worker *worker = _worker;
+  Io_Walk *w = worker->w;
+
+  char *path = NULL;
+  size_t path_cap = 0;
+
+  while(!__atomic_load_n(&w->stop, __ATOMIC_RELAXED)) {
+    Io_Walk_Job job;
+    if(!io_walk_take(w, worker->self, &job)) {
+      if(!io_walk_wait(w)) break;
+      continue;
+    }
+
+    // Only the root may be a link
+    size_t len = strlen(job.path);
+    int fd = open(job.path, O_RDONLY | O_DIRECTORY | O_CLOEXEC | (job.depth > 0 ? O_NOFOLLOW : 0));
+    if(fd < 0) {
+      IO_LOG("Failed to open '%s': (%d) %s", job.path, io_last_error(), io_last_error_cstr());
+      __atomic_store_n(&w->failed, true, __ATOMIC_RELAXED);
+    } else if(!io_walk_reserve(&path, &path_cap, len + 1)) {
+      __atomic_store_n(&w->failed, true, __ATOMIC_RELAXED);
+      close(fd);
+    } else {
+      memcpy(path, job.path, len + 1);
+      io_walk_dir(w, &w->deques[worker->self], fd, &path, &path_cap, len, job.depth);
+      close(fd);
+    }
+
+    free(job.path);
+    if(__atomic_sub_fetch(&w->pending, 1, __ATOMIC_SEQ_CST) == 0 ||
+       __atomic_load_n(&w->stop, __ATOMIC_RELAXED)) {
+      pthread_mutex_lock(&w->idle_mutex);
+      pthread_cond_broadcast(&w->idle);
+      pthread_mutex_unlock(&w->idle_mutex);
+    }
+  }
+
+  free(path);
+  return NULL;
+}
+
+#endif //_WIN32
+
+IO_DEF bool io_walk(const char *root, Io_Walk_Callback callback, void *userdata) {
+  Io_Walk w = {0};
+  w.callback = callback;
+  w.userdata = userdata;
+
+  size_t len = strlen(root);
+  while(len > 1 && (root[len - 1] == '/' || root[len - 1] == '\\')) len--;
+
+  char *path = NULL;
+  size_t path_cap = 0;
+  if(!io_walk_reserve(&path, &path_cap, len + 1)) {
+    return false;
+  }
+  memcpy(path, root, len);
+  path[len] = 0;
+
+#ifdef _WIN32
+  io_walk_dir(&w, path, 0);
+#else
+  int fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if(fd < 0) {
+    IO_LOG("Failed to open '%s': (%d) %s", path, io_last_error(), io_last_error_cstr());
+    free(path);
+    return false;
+  }
+  io_walk_dir(&w, NULL, fd, &path, &path_cap, len, 0);
+  close(fd);
+#endif //_WIN32
+
+  free(path);
+  return !w.failed;
+}
+
+IO_DEF bool io_walk_parallel(const char *root, size_t threads, Io_Walk_Callback callback, void *userdata) {
+#ifdef _WIN32
+  (void) threads;
+  return io_walk(root, callback, userdata);
+#else
+  if(threads == 0) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    threads = cpus > 0 ? (size_t) cpus : 1;
+  }
+
+  Io_Walk w = {0};
+  w.callback = callback;
+  w.userdata = userdata;
+  w.deques_len = threads;
+  w.deques = calloc(threads, sizeof(Io_Walk_Deque));
+  pthread_t *ids = malloc(threads * sizeof(pthread_t));
+  Io_Walk_Worker *workers = malloc(threads * sizeof(Io_Walk_Worker));
+  if(!w.deques || !ids || !workers) {
+    free(w.deques);
+    free(ids);
+    free(workers);
+    return false;
+  }
+  for(size_t i=0;i<threads;i++) {
+    pthread_mutex_init(&w.deques[i].mutex, NULL);
+  }
+  pthread_mutex_init(&w.idle_mutex, NULL);
+  pthread_cond_init(&w.idle, NULL);
+
+  size_t len = strlen(root);
+  while(len > 1 && root[len - 1] == '/') len--;
+
+  bool ok = false;
+  char *path = malloc(len + 1);
+  if(path) {
+    memcpy(path, root, len);
+    path[len] = 0;
+
+    // The root has to be a directory, like in io_walk
+    struct stat stats;
+    if(stat(path, &stats) < 0 || !S_ISDIR(stats.st_mode)) {
+      IO_LOG("Failed to open '%s': (%d) %s", path, io_last_error(), io_last_error_cstr());
+    } else {
+      ok = io_walk_push(&w, &w.deques[0], path, len, 0);
+    }
+    free(path);
+  }
+
+  size_t started = 0;
+  if(ok) {
+    for(;started<threads;started++) {
+      workers[started] = (Io_Walk_Worker) { &w, started };
+      if(pthread_create(&ids[started], NULL, io_walk_worker, &workers[started]) != 0) {
+	break;
+      }
+    }
+
+    if(started == 0) {
+      workers[0] = (Io_Walk_Worker) { &w, 0 };
+      io_walk_worker(&workers[0]);
+    }
+    for(size_t i=0;i<started;i++) {
+      pthread_join(ids[i], NULL);
+    }
+  }
+
+  // Jobs are left, if the walk was stopped
+  for(size_t i=0;i<threads;i++) {
+    Io_Walk_Deque *d = &w.deques[i];
+    for(size_t j=d->head;j<d->len;j++) free(d->jobs[j].path);
+    free(d->jobs);
+    pthread_mutex_destroy(&d->mutex);
+  }
+  pthread_cond_destroy(&w.idle);
+  pthread_mutex_destroy(&w.idle_mutex);
+  free(w.deques);
+  free(ids);
+  free(workers);
+
+  return ok && !w.failed;
+#endif //_WIN32
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+IO_DEF bool io_file_open(Io_File *f, const char *filepath, Io_Mode mode) {
+#ifdef _WIN32
+  
+  wchar_t windows_filepath[MAX_PATH];
+  MultiByteToWideChar(CP_UTF8, 0, filepath, -1, windows_filepath, MAX_PATH);
+  
+  if(mode < 0 || COUNT_IO_MODE <= mode)
+    return false;
+
+  f->handle = INVALID_HANDLE_VALUE;
+
+  if(mode == IO_MODE_READ) {
+    f->handle = CreateFileW(windows_filepath, GENERIC_READ,
+			   FILE_SHARE_READ,
+			   NULL,
+			   OPEN_EXISTING,
+			   FILE_ATTRIBUTE_NORMAL,
+			   NULL);
+    if(f->handle == INVALID_HANDLE_VALUE)
+      goto error;
+
+    LARGE_INTEGER size;
+    if(!GetFileSizeEx(f->handle, &size))
+      goto error;
+
+    f->size = (uint64_t) size.QuadPart;
+
+    f->pos = 0;
+  } else {
+    f->handle = CreateFileW(windows_filepath,
+			   GENERIC_WRITE, 0, NULL,
+			   CREATE_ALWAYS,
+			   FILE_ATTRIBUTE_NORMAL,
+			   NULL);
+    if(f->handle == INVALID_HANDLE_VALUE)
+      goto error;
+    
+    f->pos = 0;
+    f->size = 0;
+  }
+  
+  return true;
+ error:
+
+  if(f->handle != INVALID_HANDLE_VALUE)
+    CloseHandle(f->handle);
+  
+  return false;
+#else
+  
+  if(mode < 0 || COUNT_IO_MODE <= mode)
+    return false;
+
+  f->fd = -1;
+
+  if(mode == IO_MODE_READ) {
+    f->fd = open(filepath, O_RDONLY);
+    if(f->fd < 0)
+      goto error;
+
+    struct stat stats;
+    if(fstat(f->fd, &stats) < 0)
+      goto error;
+
+    f->size = (uint64_t) stats.st_size;
+    f->pos  = 0;
+  } else {
+
+    f->fd = open(filepath, O_CREAT|O_WRONLY|O_TRUNC, S_IRWXU | S_IRWXG | S_IRWXO);
+    if(f->fd < 0)
+      goto error;
+
+    f->size = 0;
+    f->pos  = 0;
+  }
+
+  return true;
+ error:
+  if(f->fd >= 0) close(f->fd);
+  
+  return false;
+#endif //_WIN32  
+}
+
+IO_DEF int io_file_seek(Io_File *f, int64_t offset, int whence) {
+#ifdef _WIN32
+  DWORD moveMethod;
+
+  switch (whence) {
+  case SEEK_SET: {
+    moveMethod = FILE_BEGIN;    
+  } break;
+  case SEEK_CUR: {
+    moveMethod = FILE_CURRENT;    
+  } break;
+  case SEEK_END: {
+    moveMethod = FILE_END;    
+  } break;
+  default: {
+    return -1;  // Invalid whence
+  } break;
+  }
+
+  LARGE_INTEGER distance, pos;
+  distance.QuadPart = offset;
+  if(!SetFilePointerEx(f->handle, distance, &pos, moveMethod))
+    return -1;
+
+  f->pos = (uint64_t) pos.QuadPart;
+  return 0;
+#else
+  off_t pos = lseek(f->fd, (off_t) offset, whence);
+  if(pos < 0)
+    return -1;
+
+  f->pos = (uint64_t) pos;
+  return 0;
+#endif //_WIN32
+}
+
+IO_DEF int64_t io_file_tell(Io_File *f) {
+  return (int64_t) f->pos;
+}
+
+IO_DEF void io_file_close(Io_File *f) {
+#ifdef _WIN32
+  CloseHandle(f->handle);
+#else
+  close(f->fd);
+#endif //_WIN32
+}
+
+
+IO_DEF size_t io_file_read(Io_File *f, void *ptr, size_t size, size_t count) {
+#ifdef _WIN32
+  DWORD bytes_read;
+  DWORD bytes_to_read = (DWORD) (size * count);
+
+  if(!ReadFile(f->handle, ptr, bytes_to_read, &bytes_read, NULL))
+    return 0;
+  f->pos += bytes_read;
+
+  return (size_t) (bytes_read / size);
+#else
+
+  size_t bytes_to_read = size * count;
   ssize_t bytes_read = read(f->fd, ptr, bytes_to_read);
   if(bytes_read < 0) {
     return 0;
   }
+  f->pos += (uint64_t) bytes_read;
 
   return bytes_read / size;
 #endif //_WIN32
@@ -630,8 +1470,8 @@ IO_DEF size_t io_file_write(Io_File *f, const void *ptr, size_t size, size_t nme
     return 0;
   }
 
-  f->pos += bytes_to_write;
-  f->size += bytes_to_write;
+  f->pos += bytes_written;
+  if(f->pos > f->size) f->size = f->pos;
   
   return (size_t) (bytes_written / size);
 #else
@@ -641,12 +1481,1411 @@ IO_DEF size_t io_file_write(Io_File *f, const void *ptr, size_t size, size_t nme
   if(bytes_written < 0) {
     return 0;
   }
+  f->pos += (uint64_t) bytes_written;
+  if(f->pos > f->size) f->size = f->pos;
 
   return bytes_written / size;
   
 #endif //_WIN32
 }
 
+IO_DEF size_t io_file_pread(Io_File *f, void *buf, size_t len, uint64_t offset) {
+  size_t done = 0;
+
+  while(done < len) {
+#ifdef _WIN32
+    // With an OVERLAPPED offset every call is independent of the file pointer
+    OVERLAPPED overlapped = {0};
+    overlapped.Offset = (DWORD) (offset + done);
+    overlapped.OffsetHigh = (DWORD) ((offset + done) >> 32);
+
+    size_t rest = len - done;
+    DWORD bytes_read;
+    if(!ReadFile(f->handle, (char *) buf + done, rest > 0x7ffff000 ? 0x7ffff000 : (DWORD) rest, &bytes_read, &overlapped) ||
+       bytes_read == 0) {
+      break;
+    }
+#else
+    ssize_t bytes_read = pread(f->fd, (char *) buf + done, len - done, (off_t) (offset + done));
+    if(bytes_read < 0 && errno == EINTR) {
+      continue;
+    }
+    if(bytes_read <= 0) {
+      break;
+    }
+#endif //_WIN32
+
+    done += (size_t) bytes_read;
+  }
+
+  return done;
+}
+
+IO_DEF size_t io_file_pwrite(Io_File *f, const void *buf, size_t len, uint64_t offset) {
+  size_t done = 0;
+
+  while(done < len) {
+#ifdef _WIN32
+    OVERLAPPED overlapped = {0};
+    overlapped.Offset = (DWORD) (offset + done);
+    overlapped.OffsetHigh = (DWORD) ((offset + done) >> 32);
+
+    size_t rest = len - done;
+    DWORD bytes_written;
+    if(!WriteFile(f->handle, (const char *) buf + done, rest > 0x7ffff000 ? 0x7ffff000 : (DWORD) rest, &bytes_written, &overlapped) ||
+       bytes_written == 0) {
+      break;
+    }
+#else
+    ssize_t bytes_written = pwrite(f->fd, (const char *) buf + done, len - done, (off_t) (offset + done));
+    if(bytes_written < 0 && errno == EINTR) {
+      continue;
+    }
+    if(bytes_written <= 0) {
+      break;
+    }
+#endif //_WIN32
+
+    done += (size_t) bytes_written;
+  }
+
+  return done;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+IO_DEF bool io_writer_init(Io_Writer *w, Io_File *f, unsigned char *buf, size_t cap) {
+  if(cap == 0) cap = IO_WRITER_CAP;
+
+  w->file = f;
+  w->len = 0;
+  w->cap = cap;
+  w->failed = false;
+  w->owned = buf == NULL;
+  w->buf = buf ? buf : malloc(cap);
+
+  return w->buf != NULL;
+}
+
+// Writes 'a' and 'b' completely
+static bool io_writer_write_all(Io_Writer *w, const void *a, size_t a_len, const void *b, size_t b_len) {
+#ifdef _WIN32
+  // Gathering writes need unbuffered handles
+  bool ok = (a_len == 0 || io_file_write(w->file, a, a_len, 1) == 1) &&
+    (b_len == 0 || io_file_write(w->file, b, b_len, 1) == 1);
+#else
+  struct iovec iov[2] = {
+    { (void *) a, a_len },
+    { (void *) b, b_len },
+  };
+  struct iovec *it = iov;
+  int it_len = 2;
+  bool ok = true;
+
+  while(it_len > 0) {
+    if(it->iov_len == 0) {
+      it++;
+      it_len--;
+      continue;
+    }
+
+    ssize_t written = writev(w->file->fd, it, it_len);
+    if(written < 0 && errno == EINTR) {
+      continue;
+    }
+    if(written <= 0) {
+      ok = false;
+      break;
+    }
+
+    w->file->pos += (uint64_t) written;
+    if(w->file->pos > w->file->size) w->file->size = w->file->pos;
+
+    size_t rest = (size_t) written;
+    while(it_len > 0 && rest >= it->iov_len) {
+      rest -= it->iov_len;
+      it++;
+      it_len--;
+    }
+    if(it_len > 0) {
+      it->iov_base = (char *) it->iov_base + rest;
+      it->iov_len -= rest;
+    }
+  }
+#endif //_WIN32
+
+  if(!ok) {
+    w->failed = true;
+  }
+  return ok;
+}
+
+IO_DEF bool io_writer_write(Io_Writer *w, const void *data, size_t data_len) {
+  if(w->failed) {
+    return false;
+  }
+
+  if(data_len <= w->cap - w->len) {
+    memcpy(w->buf + w->len, data, data_len);
+    w->len += data_len;
+    return true;
+  }
+
+  // Big writes pass through, with the buffer in front of them
+  if(data_len >= w->cap) {
+    bool ok = io_writer_write_all(w, w->buf, w->len, data, data_len);
+    w->len = 0;
+    return ok;
+  }
+
+  // Fill the buffer, write it and keep the rest
+  size_t fits = w->cap - w->len;
+  memcpy(w->buf + w->len, data, fits);
+  w->len = w->cap;
+  if(!io_writer_flush(w)) {
+    return false;
+  }
+
+  memcpy(w->buf, (const unsigned char *) data + fits, data_len - fits);
+  w->len = data_len - fits;
+  return true;
+}
+
+IO_DEF bool io_writer_printf(Io_Writer *w, const char *fmt, ...) {
+  if(w->failed) {
+    return false;
+  }
+
+  va_list args;
+  va_start(args, fmt);
+  int len = vsnprintf((char *) w->buf + w->len, w->cap - w->len, fmt, args);
+  va_end(args);
+  if(len < 0) {
+    return false;
+  }
+
+  if((size_t) len < w->cap - w->len) {
+    w->len += (size_t) len;
+    return true;
+  }
+
+  // It did not fit, the truncated output is overwritten
+  if(!io_writer_flush(w)) {
+    return false;
+  }
+
+  if((size_t) len < w->cap) {
+    va_start(args, fmt);
+    vsnprintf((char *) w->buf, w->cap, fmt, args);
+    va_end(args);
+    w->len = (size_t) len;
+    return true;
+  }
+
+  char *tmp = malloc((size_t) len + 1);
+  if(!tmp) {
+    return false;
+  }
+  va_start(args, fmt);
+  vsnprintf(tmp, (size_t) len + 1, fmt, args);
+  va_end(args);
+  bool ok = io_writer_write(w, tmp, (size_t) len);
+  free(tmp);
+  return ok;
+}
+
+IO_DEF bool io_writer_flush(Io_Writer *w) {
+  if(w->failed) {
+    return false;
+  }
+
+  bool ok = io_writer_write_all(w, w->buf, w->len, NULL, 0);
+  w->len = 0;
+  return ok;
+}
+
+IO_DEF void io_writer_free(Io_Writer *w) {
+  if(w->owned) {
+    free(w->buf);
+  }
+  w->buf = NULL;
+  w->len = 0;
+  w->cap = 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+IO_DEF void io_commit_init(Io_Commit *c, bool durable) {
+  c->files = NULL;
+  c->len = 0;
+  c->cap = 0;
+  c->durable = durable;
+}
+
+// Length of the directory part of 'path', including the separator
+static size_t io_commit_dir_len(const char *path) {
+  size_t len = strlen(path);
+  while(len > 0 && path[len - 1] != '/'
+#ifdef _WIN32
+	&& path[len - 1] != '\\'
+#endif //_WIN32
+	) {
+    len--;
+  }
+  return len;
+}
+
+static void io_commit_file_free(Io_Commit_File *cf, bool remove) {
+#ifdef _WIN32
+  if(cf->file.handle != INVALID_HANDLE_VALUE) CloseHandle(cf->file.handle);
+  if(remove) io_delete_file(cf->tmp_path);
+#else
+  if(cf->file.fd >= 0) close(cf->file.fd);
+  if(remove) unlink(cf->tmp_path);
+#endif //_WIN32
+  free(cf->path);
+  free(cf->tmp_path);
+  free(cf);
+}
+
+IO_DEF Io_File *io_commit_open(Io_Commit *c, const char *filepath) {
+  if(c->len == c->cap) {
+    size_t new_cap = c->cap == 0 ? 16 : 2 * c->cap;
+    Io_Commit_File **new_files = realloc(c->files, new_cap * sizeof(*new_files));
+    if(!new_files) {
+      return NULL;
+    }
+    c->files = new_files;
+    c->cap = new_cap;
+  }
+
+  Io_Commit_File *cf = calloc(1, sizeof(*cf));
+  if(!cf) {
+    return NULL;
+  }
+
+  // '<dir>/.<name>.<pid>.<n>.tmp': Same directory, so the rename does not cross filesystems
+  static unsigned int counter = 0;
+  unsigned int n = __atomic_fetch_add(&counter, 1, __ATOMIC_RELAXED);
+#ifdef _WIN32
+  unsigned long pid = (unsigned long) GetCurrentProcessId();
+#else
+  unsigned long pid = (unsigned long) getpid();
+#endif //_WIN32
+
+  size_t path_len = strlen(filepath);
+  size_t dir_len = io_commit_dir_len(filepath);
+  size_t tmp_cap = path_len + 64;
+  cf->path = malloc(path_len + 1);
+  cf->tmp_path = malloc(tmp_cap);
+  if(!cf->path || !cf->tmp_path) {
+    free(cf->path);
+    free(cf->tmp_path);
+    free(cf);
+    return NULL;
+  }
+  memcpy(cf->path, filepath, path_len + 1);
+  snprintf(cf->tmp_path, tmp_cap, "%.*s.%s.%lu.%u.tmp", (int) dir_len, filepath, filepath + dir_len, pid, n);
+
+#ifdef _WIN32
+  wchar_t windows_filepath[MAX_PATH];
+  MultiByteToWideChar(CP_UTF8, 0, cf->tmp_path, -1, windows_filepath, MAX_PATH);
+
+  cf->file.handle = CreateFileW(windows_filepath, GENERIC_WRITE, 0, NULL, CREATE_NEW, FILE_ATTRIBUTE_NORMAL, NULL);
+  if(cf->file.handle == INVALID_HANDLE_VALUE) {
+#else
+  cf->file.fd = open(cf->tmp_path, O_CREAT | O_EXCL | O_WRONLY, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH);
+  if(cf->file.fd < 0) {
+#endif //_WIN32
+    IO_LOG("Failed to create '%s': (%d) %s",
+	   cf->tmp_path, io_last_error(), io_last_error_cstr());
+    free(cf->path);
+    free(cf->tmp_path);
+    free(cf);
+    return NULL;
+  }
+  cf->file.size = 0;
+  cf->file.pos = 0;
+
+#ifndef _WIN32
+  // A replaced file keeps its permissions
+  struct stat stats;
+  if(stat(filepath, &stats) == 0) {
+    fchmod(cf->file.fd, stats.st_mode & 07777);
+  }
+#endif //_WIN32
+
+  c->files[c->len++] = cf;
+  return &cf->file;
+}
+
+IO_DEF bool io_commit_write(Io_Commit *c, const char *filepath, const unsigned char *data, size_t data_size) {
+  Io_File *f = io_commit_open(c, filepath);
+  if(!f) {
+    return false;
+  }
+
+  if(io_file_pwrite(f, data, data_size, 0) != data_size) {
+    IO_LOG("Failed to write '%s': (%d) %s",
+	   filepath, io_last_error(), io_last_error_cstr());
+    io_commit_file_free(c->files[--c->len], true);
+    return false;
+  }
+  f->pos = data_size;
+  f->size = data_size;
+
+  return true;
+}
+
+IO_DEF bool io_commit_finish(Io_Commit *c) {
+  bool ok = true;
+
+#ifdef _WIN32
+  for(size_t i=0;i<c->len;i++) {
+    Io_Commit_File *cf = c->files[i];
+    if(c->durable && !FlushFileBuffers(cf->file.handle)) {
+      ok = false;
+    }
+    CloseHandle(cf->file.handle);
+    cf->file.handle = INVALID_HANDLE_VALUE;
+  }
+
+  for(size_t i=0;ok && i<c->len;i++) {
+    Io_Commit_File *cf = c->files[i];
+
+    wchar_t windows_tmp_path[MAX_PATH];
+    wchar_t windows_filepath[MAX_PATH];
+    MultiByteToWideChar(CP_UTF8, 0, cf->tmp_path, -1, windows_tmp_path, MAX_PATH);
+    MultiByteToWideChar(CP_UTF8, 0, cf->path, -1, windows_filepath, MAX_PATH);
+
+    DWORD flags = MOVEFILE_REPLACE_EXISTING | (c->durable ? MOVEFILE_WRITE_THROUGH : 0);
+    if(!MoveFileExW(windows_tmp_path, windows_filepath, flags)) {
+      IO_LOG("Failed to replace '%s': (%d) %s",
+	     cf->path, io_last_error(), io_last_error_cstr());
+      ok = false;
+      break;
+    }
+    io_commit_file_free(cf, false);
+    c->files[i] = NULL;
+  }
+#else
+  if(c->durable) {
+#if defined(SYS_sync_file_range) && defined(SYNC_FILE_RANGE_WRITE)
+    // Queue the writeback of every file, before waiting for the first one
+    for(size_t i=0;i<c->len;i++) {
+      syscall(SYS_sync_file_range, c->files[i]->file.fd, (off_t) 0, (off_t) 0, (unsigned int) SYNC_FILE_RANGE_WRITE);
+    }
+#endif // SYS_sync_file_range
+    for(size_t i=0;i<c->len;i++) {
+      if(fdatasync(c->files[i]->file.fd) < 0) {
+	IO_LOG("Failed to sync '%s': (%d) %s",
+	       c->files[i]->tmp_path, io_last_error(), io_last_error_cstr());
+	ok = false;
+      }
+    }
+  }
+
+  for(size_t i=0;i<c->len;i++) {
+    Io_Commit_File *cf = c->files[i];
+    if(close(cf->file.fd) < 0) {
+      ok = false;
+    }
+    cf->file.fd = -1;
+  }
+
+  size_t renamed = 0;
+  for(;ok && renamed<c->len;renamed++) {
+    Io_Commit_File *cf = c->files[renamed];
+    if(rename(cf->tmp_path, cf->path) < 0) {
+      IO_LOG("Failed to replace '%s': (%d) %s",
+	     cf->path, io_last_error(), io_last_error_cstr());
+      ok = false;
+      break;
+    }
+  }
+
+  // The renames are only durable, once the directories are synced. Once per directory.
+  const char **synced = c->durable && renamed > 0 ? malloc(renamed * sizeof(*synced)) : NULL;
+  size_t *synced_lens = synced ? malloc(renamed * sizeof(*synced_lens)) : NULL;
+  size_t synced_len = 0;
+  if(c->durable && renamed > 0 && !synced_lens) {
+    ok = false;
+  }
+
+  for(size_t i=0;synced_lens && i<renamed;i++) {
+    const char *path = c->files[i]->path;
+    size_t dir_len = io_commit_dir_len(path);
+
+    bool seen = false;
+    for(size_t j=0;!seen && j<synced_len;j++) {
+      seen = synced_lens[j] == dir_len && memcmp(path, synced[j], dir_len) == 0;
+    }
+    if(seen) {
+      continue;
+    }
+    synced[synced_len] = path;
+    synced_lens[synced_len++] = dir_len;
+
+    char dir_path[IO_MAX_PATH];
+    if(dir_len == 0) {
+      memcpy(dir_path, ".", 2);
+    } else if(dir_len < sizeof(dir_path)) {
+      memcpy(dir_path, path, dir_len);
+      dir_path[dir_len] = 0;
+    } else {
+      ok = false;
+      continue;
+    }
+
+    int fd = open(dir_path, O_RDONLY | O_DIRECTORY);
+    if(fd < 0 || fsync(fd) < 0) {
+      IO_LOG("Failed to sync '%s': (%d) %s",
+	     dir_path, io_last_error(), io_last_error_cstr());
+      ok = false;
+    }
+    if(fd >= 0) close(fd);
+  }
+  free(synced);
+  free(synced_lens);
+
+  for(size_t i=0;i<renamed;i++) {
+    io_commit_file_free(c->files[i], false);
+    c->files[i] = NULL;
+  }
+#endif //_WIN32
+
+  // Whatever was not renamed, is removed
+  io_commit_abort(c);
+  return ok;
+}
+
+IO_DEF void io_commit_abort(Io_Commit *c) {
+  for(size_t i=0;i<c->len;i++) {
+    if(c->files[i]) io_commit_file_free(c->files[i], true);
+  }
+  free(c->files);
+  c->files = NULL;
+  c->len = 0;
+  c->cap = 0;
+}
+
+IO_DEF bool io_write_file_atomic(const char *filepath, const unsigned char *data, size_t data_size, bool durable) {
+  Io_Commit c;
+  io_commit_init(&c, durable);
+  if(!io_commit_write(&c, filepath, data, data_size)) {
+    io_commit_abort(&c);
+    return false;
+  }
+  return io_commit_finish(&c);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+IO_DEF bool io_mapping_open(Io_Mapping *m, const char *filepath) {
+  // Empty files can not be mapped
+  static unsigned char empty[1] = {0};
+
+#ifdef _WIN32
+
+  wchar_t windows_filepath[MAX_PATH];
+  MultiByteToWideChar(CP_UTF8, 0, filepath, -1, windows_filepath, MAX_PATH);
+
+  m->mapping = NULL;
+  m->handle = CreateFileW(windows_filepath, GENERIC_READ,
+			  FILE_SHARE_READ,
+			  NULL,
+			  OPEN_EXISTING,
+			  FILE_ATTRIBUTE_NORMAL,
+			  NULL);
+  if(m->handle == INVALID_HANDLE_VALUE)
+    return false;
+
+  LARGE_INTEGER size;
+  if(!GetFileSizeEx(m->handle, &size))
+    goto error;
+  m->size = (size_t) size.QuadPart;
+
+  if(m->size == 0) {
+    m->data = empty;
+    return true;
+  }
+
+  m->mapping = CreateFileMappingW(m->handle, NULL, PAGE_READONLY, 0, 0, NULL);
+  if(m->mapping == NULL)
+    goto error;
+
+  m->data = MapViewOfFile(m->mapping, FILE_MAP_READ, 0, 0, 0);
+  if(m->data == NULL)
+    goto error;
+
+  return true;
+ error:
+  if(m->mapping != NULL) CloseHandle(m->mapping);
+  CloseHandle(m->handle);
+
+  return false;
+#else
+
+  int fd = open(filepath, O_RDONLY);
+  if(fd < 0)
+    return false;
+
+  struct stat stats;
+  if(fstat(fd, &stats) < 0) {
+    close(fd);
+    return false;
+  }
+  m->size = (size_t) stats.st_size;
+
+  if(m->size == 0) {
+    close(fd);
+    m->data = empty;
+    return true;
+  }
+
+  // The mapping stays valid after the close
+  void *data = mmap(NULL, m->size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if(data == MAP_FAILED)
+    return false;
+
+  m->data = data;
+  return true;
+#endif //_WIN32
+}
+
+IO_DEF bool io_mapping_advise(Io_Mapping *m, size_t offset, size_t len, Io_Advice advice) {
+  if(advice < 0 || COUNT_IO_ADVICE <= advice)
+    return false;
+
+  if(m->size == 0 || offset >= m->size)
+    return true;
+  if(len > m->size - offset) len = m->size - offset;
+
+#ifdef _WIN32
+  // Views only know about prefetching
+  if(advice == IO_ADVICE_WILLNEED) {
+    WIN32_MEMORY_RANGE_ENTRY range = { m->data + offset, len };
+    return PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+  }
+
+  return true;
+#else
+
+  static const int advices[COUNT_IO_ADVICE] = {
+    [IO_ADVICE_NORMAL]     = MADV_NORMAL,
+    [IO_ADVICE_SEQUENTIAL] = MADV_SEQUENTIAL,
+    [IO_ADVICE_RANDOM]     = MADV_RANDOM,
+    [IO_ADVICE_WILLNEED]   = MADV_WILLNEED,
+    [IO_ADVICE_DONTNEED]   = MADV_DONTNEED,
+  };
+
+  // madvise wants a page-aligned address
+  size_t page = (size_t) sysconf(_SC_PAGESIZE);
+  size_t start = offset - offset % page;
+
+  return madvise(m->data + start, len + (offset - start), advices[advice]) == 0;
+#endif //_WIN32
+}
+
+IO_DEF void io_mapping_close(Io_Mapping *m) {
+#ifdef _WIN32
+  if(m->size > 0) {
+    UnmapViewOfFile(m->data);
+    CloseHandle(m->mapping);
+  }
+  CloseHandle(m->handle);
+#else
+  if(m->size > 0) {
+    munmap(m->data, m->size);
+  }
+#endif //_WIN32
+
+  m->data = NULL;
+  m->size = 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+#define IO_HASH_P1 0x9e3779b185ebca87ULL
+#define IO_HASH_P2 0xc2b2ae3d27d4eb4fULL
+#define IO_HASH_P3 0x165667b19e3779f9ULL
+#define IO_HASH_P4 0x85ebca77c2b2ae63ULL
+#define IO_HASH_P5 0x27d4eb2f165667c5ULL
+
+static uint64_t io_hash_rotl(uint64_t x, int r) {
+  return (x << r) | (x >> (64 - r));
+}
+
+static uint64_t io_hash_round(uint64_t acc, uint64_t word) {
+  acc += word * IO_HASH_P2;
+  acc = io_hash_rotl(acc, 31);
+  return acc * IO_HASH_P1;
+}
+
+static uint64_t io_hash_word(const unsigned char *p) {
+  uint64_t word;
+  memcpy(&word, p, sizeof(word));
+  return word;
+}
+
+// xxHash64 without a seed. Not cryptographic, but a few GB/s.
+IO_DEF uint64_t io_hash(const void *data, size_t data_len) {
+  const unsigned char *p = data;
+  const unsigned char *end = p + data_len;
+  uint64_t h;
+
+  if(data_len >= 32) {
+    // Four independent lanes, so the multiplications overlap
+    uint64_t a = IO_HASH_P1 + IO_HASH_P2;
+    uint64_t b = IO_HASH_P2;
+    uint64_t c = 0;
+    uint64_t d = 0 - IO_HASH_P1;
+    for(;end - p >= 32;p+=32) {
+      a = io_hash_round(a, io_hash_word(p));
+      b = io_hash_round(b, io_hash_word(p + 8));
+      c = io_hash_round(c, io_hash_word(p + 16));
+      d = io_hash_round(d, io_hash_word(p + 24));
+    }
+
+    h = io_hash_rotl(a, 1) + io_hash_rotl(b, 7) + io_hash_rotl(c, 12) + io_hash_rotl(d, 18);
+    h = (h ^ io_hash_round(0, a)) * IO_HASH_P1 + IO_HASH_P4;
+    h = (h ^ io_hash_round(0, b)) * IO_HASH_P1 + IO_HASH_P4;
+    h = (h ^ io_hash_round(0, c)) * IO_HASH_P1 + IO_HASH_P4;
+    h = (h ^ io_hash_round(0, d)) * IO_HASH_P1 + IO_HASH_P4;
+  } else {
+    h = IO_HASH_P5;
+  }
+  h += (uint64_t) data_len;
+
+  for(;end - p >= 8;p+=8) {
+    h ^= io_hash_round(0, io_hash_word(p));
+    h = io_hash_rotl(h, 27) * IO_HASH_P1 + IO_HASH_P4;
+  }
+  if(end - p >= 4) {
+    uint32_t word;
+    memcpy(&word, p, sizeof(word));
+    h ^= (uint64_t) word * IO_HASH_P1;
+    h = io_hash_rotl(h, 23) * IO_HASH_P2 + IO_HASH_P3;
+    p += 4;
+  }
+  for(;p < end;p++) {
+    h ^= (uint64_t) *p * IO_HASH_P5;
+    h = io_hash_rotl(h, 11) * IO_HASH_P1;
+  }
+
+  h ^= h >> 33;
+  h *= IO_HASH_P2;
+  h ^= h >> 29;
+  h *= IO_HASH_P3;
+  h ^= h >> 32;
+  return h;
+}
+
+IO_DEF bool io_hash_file(const char *filepath, uint64_t *hash) {
+  Io_Mapping m;
+  if(!io_mapping_open(&m, filepath)) {
+    return false;
+  }
+  io_mapping_advise(&m, 0, m.size, IO_ADVICE_SEQUENTIAL);
+
+  *hash = io_hash(m.data, m.size);
+
+  io_mapping_close(&m);
+  return true;
+}
+
+IO_DEF bool io_stamp_get(const char *filepath, Io_Stamp *stamp) {
+#ifdef _WIN32
+  wchar_t windows_filepath[MAX_PATH];
+  MultiByteToWideChar(CP_UTF8, 0, filepath, -1, windows_filepath, MAX_PATH);
+
+  HANDLE handle = CreateFileW(windows_filepath, 0, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+			      NULL, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS, NULL);
+  if(handle == INVALID_HANDLE_VALUE) {
+    return false;
+  }
+
+  BY_HANDLE_FILE_INFORMATION info;
+  bool ok = GetFileInformationByHandle(handle, &info);
+  CloseHandle(handle);
+  if(!ok) {
+    return false;
+  }
+
+  // FILETIME counts 100ns since 1601, in UTC
+  stamp->size = ((uint64_t) info.nFileSizeHigh << 32) | info.nFileSizeLow;
+  stamp->mtime_ns = (((uint64_t) info.ftLastWriteTime.dwHighDateTime << 32) | info.ftLastWriteTime.dwLowDateTime) * 100;
+  stamp->inode = ((uint64_t) info.nFileIndexHigh << 32) | info.nFileIndexLow;
+#else
+  struct stat stats;
+  if(stat(filepath, &stats) < 0) {
+    return false;
+  }
+
+  stamp->size = (uint64_t) stats.st_size;
+  stamp->mtime_ns = (uint64_t) stats.st_mtim.tv_sec * 1000000000ULL + (uint64_t) stats.st_mtim.tv_nsec;
+  stamp->inode = (uint64_t) stats.st_ino;
+#endif //_WIN32
+
+  return true;
+}
+
+static bool io_cache_index_rebuild(Io_Cache *c, size_t index_cap) {
+  size_t *index = calloc(index_cap, sizeof(*index));
+  if(!index) {
+    return false;
+  }
+
+  for(size_t i=0;i<c->len;i++) {
+    size_t k = c->items[i].path_hash & (index_cap - 1);
+    while(index[k] != 0) k = (k + 1) & (index_cap - 1);
+    index[k] = i + 1;
+  }
+
+  free(c->index);
+  c->index = index;
+  c->index_cap = index_cap;
+  return true;
+}
+
+static Io_Cache_Entry *io_cache_find(Io_Cache *c, const char *path, size_t path_len, uint64_t path_hash) {
+  if(c->index_cap == 0) {
+    return NULL;
+  }
+
+  for(size_t k = path_hash & (c->index_cap - 1);c->index[k] != 0;k = (k + 1) & (c->index_cap - 1)) {
+    Io_Cache_Entry *e = &c->items[c->index[k] - 1];
+    if(e->path_hash == path_hash && strncmp(e->path, path, path_len) == 0 && e->path[path_len] == 0) {
+      return e;
+    }
+  }
+  return NULL;
+}
+
+static Io_Cache_Entry *io_cache_insert(Io_Cache *c, const char *path, size_t path_len, uint64_t path_hash) {
+  if(c->len == c->cap) {
+    size_t new_cap = c->cap == 0 ? 64 : 2 * c->cap;
+    Io_Cache_Entry *new_items = realloc(c->items, new_cap * sizeof(*new_items));
+    if(!new_items) {
+      return NULL;
+    }
+    c->items = new_items;
+    c->cap = new_cap;
+  }
+
+  // At most half full
+  if(2 * (c->len + 1) > c->index_cap &&
+     !io_cache_index_rebuild(c, c->index_cap == 0 ? 128 : 2 * c->index_cap)) {
+    return NULL;
+  }
+
+  Io_Cache_Entry *e = &c->items[c->len];
+  memset(e, 0, sizeof(*e));
+  e->path = malloc(path_len + 1);
+  if(!e->path) {
+    return NULL;
+  }
+  memcpy(e->path, path, path_len);
+  e->path[path_len] = 0;
+  e->path_hash = path_hash;
+
+  size_t k = path_hash & (c->index_cap - 1);
+  while(c->index[k] != 0) k = (k + 1) & (c->index_cap - 1);
+  c->index[k] = ++c->len;
+
+  return e;
+}
+
+static void io_cache_clear(Io_Cache *c) {
+  for(size_t i=0;i<c->len;i++) {
+    free(c->items[i].path);
+  }
+  c->len = 0;
+  if(c->index) {
+    memset(c->index, 0, c->index_cap * sizeof(*c->index));
+  }
+}
+
+// Format, one line per file: '<size> <mtime_ns> <inode> <hash> <path>'
+IO_DEF bool io_cache_load(Io_Cache *c, const char *filepath) {
+  memset(c, 0, sizeof(*c));
+
+  size_t filepath_len = strlen(filepath);
+  c->filepath = malloc(filepath_len + 1);
+  if(!c->filepath) {
+    return false;
+  }
+  memcpy(c->filepath, filepath, filepath_len + 1);
+
+  Io_Stamp stamp;
+  Io_Mapping m;
+  if(!io_stamp_get(filepath, &stamp) || !io_mapping_open(&m, filepath)) {
+    return true;
+  }
+  c->saved_ns = stamp.mtime_ns;
+
+  const char *line = (const char *) m.data;
+  const char *end = line + m.size;
+  while(line < end) {
+    const char *line_end = memchr(line, '\n', end - line);
+    if(!line_end) {
+      break;
+    }
+
+    char *p;
+    Io_Cache_Entry e;
+    e.stamp.size = strtoull(line, &p, 10);
+    e.stamp.mtime_ns = strtoull(p, &p, 10);
+    e.stamp.inode = strtoull(p, &p, 10);
+    e.hash = strtoull(p, &p, 16);
+    if(p >= line_end || *p != ' ' || p + 1 == line_end) {
+      // Corrupt, start from scratch
+      io_cache_clear(c);
+      break;
+    }
+    p++;
+
+    size_t path_len = line_end - p;
+    uint64_t path_hash = io_hash(p, path_len);
+    Io_Cache_Entry *inserted = io_cache_find(c, p, path_len, path_hash);
+    if(!inserted) inserted = io_cache_insert(c, p, path_len, path_hash);
+    if(!inserted) {
+      io_mapping_close(&m);
+      return false;
+    }
+    inserted->stamp = e.stamp;
+    inserted->hash = e.hash;
+
+    line = line_end + 1;
+  }
+
+  io_mapping_close(&m);
+  return true;
+}
+
+IO_DEF bool io_cache_check(Io_Cache *c, const char *filepath, bool *changed) {
+  size_t path_len = strlen(filepath);
+  uint64_t path_hash = io_hash(filepath, path_len);
+  Io_Cache_Entry *e = io_cache_find(c, filepath, path_len, path_hash);
+  if(e) {
+    e->seen = true;
+  }
+
+  Io_Stamp stamp;
+  if(!io_stamp_get(filepath, &stamp)) {
+    *changed = true;
+    return true;
+  }
+
+  if(e && e->stamp.size == stamp.size && e->stamp.mtime_ns == stamp.mtime_ns && e->stamp.inode == stamp.inode &&
+     stamp.mtime_ns + IO_CACHE_RACY_NS < c->saved_ns) {
+    *changed = false;
+    return true;
+  }
+
+  uint64_t hash;
+  if(!io_hash_file(filepath, &hash)) {
+    return false;
+  }
+
+  if(!e) {
+    e = io_cache_insert(c, filepath, path_len, path_hash);
+    if(!e) {
+      return false;
+    }
+    e->seen = true;
+    *changed = true;
+  } else {
+    *changed = e->stamp.size != stamp.size || e->hash != hash;
+  }
+
+  e->stamp = stamp;
+  e->hash = hash;
+  c->dirty = true;
+  return true;
+}
+
+IO_DEF size_t io_cache_prune(Io_Cache *c) {
+  size_t len = 0;
+  for(size_t i=0;i<c->len;i++) {
+    if(c->items[i].seen) {
+      c->items[len++] = c->items[i];
+    } else {
+      free(c->items[i].path);
+    }
+  }
+
+  size_t pruned = c->len - len;
+  c->len = len;
+  if(pruned > 0) {
+    c->dirty = true;
+    if(c->index_cap > 0 && !io_cache_index_rebuild(c, c->index_cap)) {
+      // Without an index, nothing is found, so everything is reported as changed
+      io_cache_clear(c);
+    }
+  }
+  return pruned;
+}
+
+IO_DEF bool io_cache_save(Io_Cache *c) {
+  if(!c->dirty) {
+    return true;
+  }
+
+  Io_Commit commit;
+  io_commit_init(&commit, false);
+  Io_File *f = io_commit_open(&commit, c->filepath);
+  if(!f) {
+    return false;
+  }
+
+  Io_Writer w;
+  if(!io_writer_init(&w, f, NULL, 0)) {
+    io_commit_abort(&commit);
+    return false;
+  }
+
+  for(size_t i=0;i<c->len;i++) {
+    Io_Cache_Entry *e = &c->items[i];
+    io_writer_printf(&w, "%llu %llu %llu %016llx %s\n",
+		     (unsigned long long) e->stamp.size,
+		     (unsigned long long) e->stamp.mtime_ns,
+		     (unsigned long long) e->stamp.inode,
+		     (unsigned long long) e->hash,
+		     e->path);
+  }
+
+  bool ok = io_writer_flush(&w);
+  io_writer_free(&w);
+  if(!ok) {
+    io_commit_abort(&commit);
+    return false;
+  }
+
+  if(!io_commit_finish(&commit)) {
+    return false;
+  }
+  c->dirty = false;
+  return true;
+}
+
+IO_DEF void io_cache_free(Io_Cache *c) {
+  for(size_t i=0;i<c->len;i++) {
+    free(c->items[i].path);
+  }
+  free(c->items);
+  free(c->index);
+  free(c->filepath);
+  memset(c, 0, sizeof(*c));
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+// Runs 'op' on this thread
+static void io_engine_transfer(Io_Engine_Op *op) {
+#ifdef _WIN32
+  OVERLAPPED overlapped = {0};
+  overlapped.Offset = (DWORD) op->offset;
+  overlapped.OffsetHigh = (DWORD) (op->offset >> 32);
+
+  DWORD len = op->len > 0x7ffff000 ? 0x7ffff000 : (DWORD) op->len;
+  DWORD transferred;
+  BOOL ok = op->write
+    ? WriteFile(op->file->handle, op->buf, len, &transferred, &overlapped)
+    : ReadFile(op->file->handle, op->buf, len, &transferred, &overlapped);
+  if(ok) {
+    op->result = (int64_t) transferred;
+  } else if(GetLastError() == ERROR_HANDLE_EOF) {
+    op->result = 0;
+  } else {
+    op->result = -1;
+    op->error = (int) GetLastError();
+  }
+#else
+  ssize_t ret;
+  do {
+    ret = op->write
+      ? pwrite(op->file->fd, op->buf, op->len, (off_t) op->offset)
+      : pread(op->file->fd, op->buf, op->len, (off_t) op->offset);
+  } while(ret < 0 && errno == EINTR);
+
+  op->result = (int64_t) ret;
+  if(ret < 0) op->error = errno;
+#endif //_WIN32
+}
+
+static void io_engine_push(Io_Engine_Op **first, Io_Engine_Op **last, Io_Engine_Op *op) {
+  op->next = NULL;
+  if(*last) (*last)->next = op;
+  else *first = op;
+  *last = op;
+}
+
+#ifdef IO_URING
+
+// IORING_OP_READ and IORING_OP_WRITE exist since 5.6, like IORING_REGISTER_PROBE. Before
+// that io_uring_setup succeeds, but every operation completes with -EINVAL.
+static bool io_engine_uring_probe(int ring) {
+  size_t size = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+  struct io_uring_probe *probe = calloc(1, size);
+  if(!probe) {
+    return false;
+  }
+
+  bool ok = false;
+  if(syscall(__NR_io_uring_register, ring, IORING_REGISTER_PROBE, probe, 256) == 0) {
+    ok = probe->last_op >= IORING_OP_READ && probe->last_op >= IORING_OP_WRITE &&
+      (probe->ops[IORING_OP_READ].flags & IO_URING_OP_SUPPORTED) &&
+      (probe->ops[IORING_OP_WRITE].flags & IO_URING_OP_SUPPORTED);
+  }
+
+  free(probe);
+  return ok;
+}
+
+static bool io_engine_uring_init(Io_Engine *e) {
+  struct io_uring_params params;
+  memset(&params, 0, sizeof(params));
+
+  int ring = (int) syscall(__NR_io_uring_setup, (unsigned) e->depth, &params);
+  if(ring < 0) {
+    return false;
+  }
+  if(!io_engine_uring_probe(ring)) {
+    close(ring);
+    return false;
+  }
+
+  e->ring = ring;
+  e->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  e->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  e->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+
+  // Since 5.4 both rings share one mapping
+  bool single = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+  if(single) {
+    if(e->cq_ring_size > e->sq_ring_size) e->sq_ring_size = e->cq_ring_size;
+    e->cq_ring_size = e->sq_ring_size;
+  }
+
+  e->sq_ring = mmap(NULL, e->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+		    ring, IORING_OFF_SQ_RING);
+  e->cq_ring = single ? e->sq_ring
+    : mmap(NULL, e->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring, IORING_OFF_CQ_RING);
+  e->sqes = mmap(NULL, e->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+		 ring, IORING_OFF_SQES);
+  if(e->sq_ring == MAP_FAILED || e->cq_ring == MAP_FAILED || e->sqes == MAP_FAILED) {
+    if(e->sq_ring != MAP_FAILED) munmap(e->sq_ring, e->sq_ring_size);
+    if(!single && e->cq_ring != MAP_FAILED) munmap(e->cq_ring, e->cq_ring_size);
+    if(e->sqes != MAP_FAILED) munmap(e->sqes, e->sqes_size);
+    close(ring);
+    return false;
+  }
+
+  char *sq = e->sq_ring;
+  e->sq_head = (unsigned *) (sq + params.sq_off.head);
+  e->sq_tail = (unsigned *) (sq + params.sq_off.tail);
+  e->sq_mask = (unsigned *) (sq + params.sq_off.ring_mask);
+  e->sq_array = (unsigned *) (sq + params.sq_off.array);
+
+  char *cq = e->cq_ring;
+  e->cq_head = (unsigned *) (cq + params.cq_off.head);
+  e->cq_tail = (unsigned *) (cq + params.cq_off.tail);
+  e->cq_mask = (unsigned *) (cq + params.cq_off.ring_mask);
+  e->cqes = cq + params.cq_off.cqes;
+
+  // The completion queue is twice as big, so it can not overflow
+  if(e->depth > params.sq_entries) e->depth = params.sq_entries;
+  e->uring = true;
+  return true;
+}
+
+static bool io_engine_uring_submit(Io_Engine *e) {
+  unsigned tail = *e->sq_tail;
+  unsigned count = 0;
+
+  while(e->queue && e->inflight < e->depth) {
+    Io_Engine_Op *op = e->queue;
+    e->queue = op->next;
+    if(!e->queue) e->queue_last = NULL;
+
+    unsigned index = tail & *e->sq_mask;
+    struct io_uring_sqe *sqe = (struct io_uring_sqe *) e->sqes + index;
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = op->write ? IORING_OP_WRITE : IORING_OP_READ;
+    sqe->fd = op->file->fd;
+    sqe->addr = (uint64_t) (uintptr_t) op->buf;
+    sqe->len = op->len > 0x7ffff000 ? 0x7ffff000 : (uint32_t) op->len;
+    sqe->off = op->offset;
+    sqe->user_data = (uint64_t) (uintptr_t) op;
+    e->sq_array[index] = index;
+
+    tail++;
+    count++;
+    e->inflight++;
+  }
+  __atomic_store_n(e->sq_tail, tail, __ATOMIC_RELEASE);
+  e->to_submit += count;
+
+  while(e->to_submit > 0) {
+    int ret = (int) syscall(__NR_io_uring_enter, e->ring, e->to_submit, 0, 0, NULL, 0);
+    if(ret < 0) {
+      if(errno == EINTR) continue;
+      // Out of resources for now, the next io_uring_enter submits the rest
+      if(errno == EAGAIN || errno == EBUSY) break;
+      IO_LOG("io_uring_enter failed: (%d) %s", io_last_error(), io_last_error_cstr());
+      return false;
+    }
+    if(ret == 0) break;
+    e->to_submit -= (unsigned) ret;
+  }
+
+  return true;
+}
+
+static void io_engine_uring_reap(Io_Engine *e) {
+  unsigned head = *e->cq_head;
+  unsigned tail = __atomic_load_n(e->cq_tail, __ATOMIC_ACQUIRE);
+
+  while(head != tail) {
+    struct io_uring_cqe *cqe = (struct io_uring_cqe *) e->cqes + (head & *e->cq_mask);
+    Io_Engine_Op *op = (Io_Engine_Op *) (uintptr_t) cqe->user_data;
+    op->result = cqe->res < 0 ? -1 : cqe->res;
+    if(cqe->res < 0) op->error = -cqe->res;
+    io_engine_push(&e->done, &e->done_last, op);
+    head++;
+  }
+
+  __atomic_store_n(e->cq_head, head, __ATOMIC_RELEASE);
+}
+
+#endif // IO_URING
+
+#ifndef _WIN32
+
+static void *io_engine_worker(void *_e) {
+  Io_Engine *e = _e;
+
+  pthread_mutex_lock(&e->mutex);
+  while(true) {
+    while(!e->work && !e->stop) pthread_cond_wait(&e->work_cond, &e->mutex);
+    if(!e->work) break;
+
+    Io_Engine_Op *op = e->work;
+    e->work = op->next;
+    if(!e->work) e->work_last = NULL;
+
+    pthread_mutex_unlock(&e->mutex);
+    io_engine_transfer(op);
+    pthread_mutex_lock(&e->mutex);
+
+    io_engine_push(&e->done, &e->done_last, op);
+    pthread_cond_signal(&e->done_cond);
+  }
+  pthread_mutex_unlock(&e->mutex);
+
+  return NULL;
+}
+
+#endif //_WIN32
+
+IO_DEF bool io_engine_init(Io_Engine *e, size_t depth) {
+  memset(e, 0, sizeof(*e));
+  e->depth = depth > 0 ? depth : 1;
+
+#ifdef _WIN32
+  return true;
+#else
+
+#ifdef IO_URING
+  if(io_engine_uring_init(e)) {
+    return true;
+  }
+#endif // IO_URING
+
+  pthread_mutex_init(&e->mutex, NULL);
+  pthread_cond_init(&e->work_cond, NULL);
+  pthread_cond_init(&e->done_cond, NULL);
+
+  size_t threads = e->depth < IO_ENGINE_THREADS ? e->depth : IO_ENGINE_THREADS;
+  for(;e->threads_len<threads;e->threads_len++) {
+    if(pthread_create(&e->threads[e->threads_len], NULL, io_engine_worker, e) != 0) {
+      break;
+    }
+  }
+
+  if(e->threads_len == 0) {
+    pthread_cond_destroy(&e->done_cond);
+    pthread_cond_destroy(&e->work_cond);
+    pthread_mutex_destroy(&e->mutex);
+    return false;
+  }
+
+  return true;
+#endif //_WIN32
+}
+
+IO_DEF void io_engine_read(Io_Engine *e, Io_Engine_Op *op, Io_File *f, void *buf, size_t len, uint64_t offset,
+			   Io_Engine_Callback callback, void *userdata) {
+  op->write = false;
+  op->file = f;
+  op->buf = buf;
+  op->len = len;
+  op->offset = offset;
+  op->callback = callback;
+  op->userdata = userdata;
+  op->done = false;
+  op->result = 0;
+  op->error = 0;
+  io_engine_push(&e->queue, &e->queue_last, op);
+}
+
+IO_DEF void io_engine_write(Io_Engine *e, Io_Engine_Op *op, Io_File *f, const void *buf, size_t len, uint64_t offset,
+			    Io_Engine_Callback callback, void *userdata) {
+  io_engine_read(e, op, f, (void *) buf, len, offset, callback, userdata);
+  op->write = true;
+}
+
+IO_DEF bool io_engine_submit(Io_Engine *e) {
+#ifdef _WIN32
+  while(e->queue) {
+    Io_Engine_Op *op = e->queue;
+    e->queue = op->next;
+    io_engine_transfer(op);
+    io_engine_push(&e->done, &e->done_last, op);
+    e->inflight++;
+  }
+  e->queue_last = NULL;
+
+  return true;
+#else
+
+#ifdef IO_URING
+  if(e->uring) {
+    return io_engine_uring_submit(e);
+  }
+#endif // IO_URING
+
+  if(!e->queue) {
+    return true;
+  }
+
+  pthread_mutex_lock(&e->mutex);
+  while(e->queue && e->inflight < e->depth) {
+    Io_Engine_Op *op = e->queue;
+    e->queue = op->next;
+    io_engine_push(&e->work, &e->work_last, op);
+    e->inflight++;
+  }
+  if(!e->queue) e->queue_last = NULL;
+  pthread_cond_broadcast(&e->work_cond);
+  pthread_mutex_unlock(&e->mutex);
+
+  return true;
+#endif //_WIN32
+}
+
+IO_DEF size_t io_engine_wait(Io_Engine *e, size_t min_complete) {
+  size_t completed = 0;
+
+  while(true) {
+    // Take the completions
+    Io_Engine_Op *done;
+#ifdef _WIN32
+    done = e->done;
+    e->done = NULL;
+    e->done_last = NULL;
+#else
+
+#ifdef IO_URING
+    if(e->uring) io_engine_uring_reap(e);
+#endif // IO_URING
+
+    if(!e->uring) pthread_mutex_lock(&e->mutex);
+    done = e->done;
+    e->done = NULL;
+    e->done_last = NULL;
+    if(!e->uring) pthread_mutex_unlock(&e->mutex);
+#endif //_WIN32
+
+    while(done) {
+      Io_Engine_Op *op = done;
+      done = op->next;
+
+      op->done = true;
+      e->inflight--;
+      completed++;
+      if(op->callback) {
+	op->callback(op->userdata, op);
+      }
+    }
+
+    // Callbacks may have queued further operations
+    if(!io_engine_submit(e)) {
+      return completed;
+    }
+    if(completed >= min_complete || e->inflight == 0) {
+      return completed;
+    }
+
+    // Block until the next completion
+#ifndef _WIN32
+#ifdef IO_URING
+    if(e->uring) {
+      int ret = (int) syscall(__NR_io_uring_enter, e->ring, e->to_submit, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+      if(ret >= 0) {
+	e->to_submit -= (unsigned) ret;
+      } else if(errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+	IO_LOG("io_uring_enter failed: (%d) %s", io_last_error(), io_last_error_cstr());
+	return completed;
+      }
+      continue;
+    }
+#endif // IO_URING
+
+    pthread_mutex_lock(&e->mutex);
+    while(!e->done) pthread_cond_wait(&e->done_cond, &e->mutex);
+    pthread_mutex_unlock(&e->mutex);
+#endif //_WIN32
+  }
+}
+
+IO_DEF void io_engine_free(Io_Engine *e) {
+  // Queued operations are dropped, submitted ones have to finish
+  e->queue = NULL;
+  e->queue_last = NULL;
+  while(e->inflight > 0) {
+    // Only a failing io_uring_enter returns without a completion. Closing the ring
+    // cancels, what is left.
+    if(io_engine_wait(e, e->inflight) == 0) break;
+  }
+
+#ifndef _WIN32
+#ifdef IO_URING
+  if(e->uring) {
+    munmap(e->sqes, e->sqes_size);
+    if(e->cq_ring != e->sq_ring) munmap(e->cq_ring, e->cq_ring_size);
+    munmap(e->sq_ring, e->sq_ring_size);
+    close(e->ring);
+    return;
+  }
+#endif // IO_URING
+
+  pthread_mutex_lock(&e->mutex);
+  e->stop = true;
+  pthread_cond_broadcast(&e->work_cond);
+  pthread_mutex_unlock(&e->mutex);
+  for(size_t i=0;i<e->threads_len;i++) {
+    pthread_join(e->threads[i], NULL);
+  }
+
+  pthread_cond_destroy(&e->done_cond);
+  pthread_cond_destroy(&e->work_cond);
+  pthread_mutex_destroy(&e->mutex);
+#endif //_WIN32
+}
+
 ////////////////////////////////////////////////////////////////////////////////////////
 
 IO_DEF int io_last_error() {
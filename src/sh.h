@@ -5,14 +5,32 @@
 #  define SH_DEF static inline
 #endif // SH_DEF
 
+// Inputs, that were modified less than this before the build database was saved, are hashed
+// again, even if size and time match. They could have changed again in the same tick.
+#ifndef SH_BUILD_RACY_NS
+#  define SH_BUILD_RACY_NS 2000000000ULL
+#endif // SH_BUILD_RACY_NS
+
 #include <stdio.h>
 #include <stdbool.h>
 #include <stdarg.h>
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <stdint.h>
 
-#include <windows.h>
+#ifdef _WIN32
+#  include <windows.h>
+#  define SH_MAX_PATH MAX_PATH
+#else
+#  include <errno.h>
+#  include <unistd.h>
+#  include <spawn.h>
+#  include <sys/wait.h>
+#  include <sys/stat.h>
+#  include <linux/limits.h>
+#  define SH_MAX_PATH PATH_MAX
+#endif //_WIN32
 
 #define sh_da_append_many(n, xs, xs_len) do{				\
     size_t new_cap = (n)->cap;						\
@@ -42,7 +60,8 @@ typedef enum{
 
 SH_DEF void sh_log(Sh_Log_Type type, const char *fmt, ...);
 
-typedef SYSTEMTIME Sh_Time;
+// Last modification, in nanoseconds. Only comparable with other Sh_Times.
+typedef uint64_t Sh_Time;
 
 SH_DEF bool sh_time_get(const char *file_path, Sh_Time *time);
 SH_DEF int sh_time_compare(const Sh_Time *a, const Sh_Time *b);
@@ -54,13 +73,132 @@ typedef struct{
 }Sh;
 
 SH_DEF void sh_append_impl(Sh *sh, ...);
+// Returns the exit code, or -1 if the process could not be started
 SH_DEF int sh_run(Sh *sh);
 
 #define sh_append(sh, ...) sh_append_impl(sh, __VA_ARGS__, NULL)
 
+// Runs up to 'max' commands at once. A failed command stops the start of new ones,
+// the running ones are still waited for.
+//
+// On POSIX the jobs are reaped with waitpid(-1, ...), so they should be the only
+// children of the process, while jobs are running.
+
+typedef struct{
+#ifdef _WIN32
+  HANDLE process;
+#else
+  pid_t pid;
+#endif //_WIN32
+  size_t id;
+  char *cmd;
+}Sh_Job;
+
+typedef struct{
+  Sh_Job *items;
+  size_t len;
+  size_t cap;
+
+  size_t max;
+  size_t started;
+
+  bool failed;
+  // The first failure
+  size_t failed_id;
+  int failed_code;
+}Sh_Jobs;
+
+// 'max' 0 means one job per processor
+SH_DEF void sh_jobs_init(Sh_Jobs *jobs, size_t max);
+// Starts 'sh' in the background, without waiting for a free slot. 'id' is reported by sh_jobs_next.
+SH_DEF bool sh_jobs_start(Sh_Jobs *jobs, Sh *sh, size_t id);
+// Waits for any job to finish. Returns false, if no job is running.
+SH_DEF bool sh_jobs_next(Sh_Jobs *jobs, size_t *id, int *exit_code);
+// Waits for a free slot, then starts 'sh'. Returns false, once a job failed.
+SH_DEF bool sh_jobs_run(Sh_Jobs *jobs, Sh *sh);
+// Waits for all jobs. Returns false, if any job failed.
+SH_DEF bool sh_jobs_wait(Sh_Jobs *jobs);
+SH_DEF void sh_jobs_free(Sh_Jobs *jobs);
+
+// A dependency graph of targets, each built by one command from its inputs.
+//
+//   Sh_Build b;
+//   sh_build_init(&b, ".sh_build", SH_BUILD_TIME);
+//   Sh_Target *t = sh_build_target(&b, "build/main.o");
+//   sh_target_inputs(t, "main.c", "main.h");
+//   sh_append(&t->cmd, "gcc", "-c", "-o", "build/main.o", "main.c");
+//   ...
+//   if(!sh_build_run(&b, NULL, 0)) return 1;
+//
+// Inputs, that are the path of another target, are built first. Independent targets are
+// built in parallel. A target is rebuilt, if its file is missing, if its command line
+// differs from the one it was last built with, or if an input changed: With SH_BUILD_TIME
+// an input is newer than the target, with SH_BUILD_HASH the content of an input differs
+// from the last build (so a touched file or a rebuilt, but identical input, is ignored).
+//
+// Command lines and input hashes are kept in 'db_path'. A target without a command only
+// groups its inputs.
+
+typedef enum{
+  SH_BUILD_TIME = 0,
+  SH_BUILD_HASH,
+}Sh_Build_Mode;
+
+typedef struct{
+  char *path;
+  uint64_t size;
+  Sh_Time time;
+  uint64_t hash;
+}Sh_Build_Input;
+
+typedef struct{
+  char *path;
+  char *cmd;
+  struct{ Sh_Build_Input *items; size_t len; size_t cap; }inputs;
+}Sh_Build_Record;
+
+typedef struct{
+  char *path;
+  struct{ char **items; size_t len; size_t cap; }inputs;
+  Sh cmd;
+
+  // State of sh_build_run
+  struct{ size_t *items; size_t len; size_t cap; }dependents;
+  size_t pending;
+  size_t record;
+  bool needed;
+  bool phony;
+  Sh_Build_Record next;
+}Sh_Target;
+
+typedef struct{
+  Sh_Target **items;
+  size_t len;
+  size_t cap;
+
+  Sh_Build_Mode mode;
+  char *db_path;
+  // When 'db_path' was last written
+  Sh_Time saved;
+  struct{ Sh_Build_Record *items; size_t len; size_t cap; }records;
+}Sh_Build;
+
+// Loads 'db_path', if it exists. 'db_path' can be NULL, then nothing is remembered.
+SH_DEF void sh_build_init(Sh_Build *b, const char *db_path, Sh_Build_Mode mode);
+// The target is valid until sh_build_free
+SH_DEF Sh_Target *sh_build_target(Sh_Build *b, const char *path);
+SH_DEF void sh_target_inputs_impl(Sh_Target *t, ...);
+// Builds 'goal' and everything it depends on, or every target, if 'goal' is NULL.
+// 'jobs' commands run at once, 0 means one per processor.
+SH_DEF bool sh_build_run(Sh_Build *b, const char *goal, size_t jobs);
+SH_DEF void sh_build_free(Sh_Build *b);
+
+#define sh_target_inputs(t, ...) sh_target_inputs_impl(t, __VA_ARGS__, NULL)
+
 #ifdef SH_IMPLEMENTATION
 
 SH_DEF const char *sh_last_error_cstr() {
+#ifdef _WIN32
 
   DWORD error = GetLastError();
   static char buffer[1024];
@@ -79,6 +217,9 @@ SH_DEF const char *sh_last_error_cstr() {
   }
   
   return buffer;
+#else
+  return strerror(errno);
+#endif //_WIN32
 }
 
 #ifdef _MSC_VER
@@ -92,6 +233,8 @@ SH_DEF const char *sh_last_error_cstr() {
   }while(0)
 #endif
 
+#ifdef _WIN32
+
 #define sh_keep_updated(argc, argv) do{					\
 									\
   char dst[MAX_PATH];							\
@@ -147,12 +290,62 @@ SH_DEF const char *sh_last_error_cstr() {
   }									\
 }while(0)
 
+#else
+
+#define sh_keep_updated(argc, argv) do{					\
+									\
+  const char *dst = argv[0];						\
+  char dst_old[SH_MAX_PATH];						\
+  if((size_t) snprintf(dst_old, sizeof(dst_old), "%s.old", dst) >= sizeof(dst_old)) { \
+    sh_log(SH_ERROR, "Path is too long: '%s'", dst);			\
+    return 1;								\
+  }									\
+									\
+  const char *src = __FILE__;						\
+									\
+  Sh_Time src_time, dst_time;						\
+  if(!sh_time_get(src, &src_time)) return 1;				\
+  if(!sh_time_get(dst, &dst_time)) return 1;				\
+  if(sh_time_compare(&src_time, &dst_time) > 0) {			\
+									\
+    if(rename(dst, dst_old) < 0) {					\
+      sh_log(SH_ERROR, "Can not move file '%s' to '%s': %s",		\
+	     dst, dst_old, sh_last_error_cstr());			\
+      return 1;								\
+    }									\
+									\
+    Sh sh = {0};							\
+    __sh_keep_updated_compiler();					\
+    int exit_code = sh_run(&sh);					\
+    if(exit_code != 0) {						\
+									\
+      if(rename(dst_old, dst) < 0) {					\
+	sh_log(SH_ERROR, "Failed to move file: '%s' to '%s' : %s\n",	\
+	       dst_old, dst, sh_last_error_cstr());			\
+	return 1;							\
+      }									\
+									\
+      return exit_code;							\
+    }									\
+									\
+    sh.len = 0;								\
+    sh_append(&sh, dst);						\
+    for(int i=1;i<argc;i++) {						\
+      sh_append(&sh, argv[i]);						\
+    }									\
+									\
+    return sh_run(&sh);							\
+  }									\
+}while(0)
+
+#endif //_WIN32
+
 SH_DEF const char *sh_next(int *argc, char ***argv) {
   if((*argc) == 0) return NULL;
 
   const char *next = (*argv)[0];
 
-  *argc = (*argc) + 1;
+  *argc = (*argc) - 1;
   *argv = (*argv) + 1;
 
   return next;
@@ -190,6 +383,7 @@ SH_DEF void sh_log(Sh_Log_Type type, const char *fmt, ...) {
 }
 
 SH_DEF bool sh_time_get(const char *file_path, Sh_Time *time) {
+#ifdef _WIN32
   HANDLE handle = CreateFile(file_path, GENERIC_READ, FILE_SHARE_READ,
 			     NULL, OPEN_EXISTING, 0, NULL);
   if(handle == INVALID_HANDLE_VALUE) {
@@ -197,37 +391,33 @@ SH_DEF bool sh_time_get(const char *file_path, Sh_Time *time) {
   }
 
   FILETIME written;
-  SYSTEMTIME system_time;
   bool result = GetFileTime(handle, NULL, NULL, &written);
   
   CloseHandle(handle);
 
   if(result) {
 
-    FileTimeToSystemTime(&written, &system_time);
-    SystemTimeToTzSpecificLocalTime(NULL, &system_time, time);
+    // 100ns ticks in UTC. The local time would depend on the timezone and only has milliseconds.
+    *time = (((uint64_t) written.dwHighDateTime << 32) | written.dwLowDateTime) * 100;
 
     return true;    
   } else {
     return false;
   }
+#else
+  struct stat stats;
+  if(stat(file_path, &stats) < 0) {
+    return false;
+  }
+
+  *time = (uint64_t) stats.st_mtim.tv_sec * 1000000000ULL + (uint64_t) stats.st_mtim.tv_nsec;
+  return true;
+#endif //_WIN32
 }
 
 SH_DEF int sh_time_compare(const Sh_Time *a, const Sh_Time *b) {
-  if(a->wYear < b->wYear) return -1;
-  if(a->wYear > b->wYear) return  1;
-  if(a->wMonth < b->wMonth) return -1;
-  if(a->wMonth > b->wMonth) return  1;
-  if(a->wDay < b->wDay) return -1;
-  if(a->wDay > b->wDay) return  1;
-  if(a->wHour < b->wHour) return -1;
-  if(a->wHour > b->wHour) return  1;
-  if(a->wMinute < b->wMinute) return -1;
-  if(a->wMinute > b->wMinute) return  1;
-  if(a->wSecond < b->wSecond) return -1;
-  if(a->wSecond > b->wSecond) return  1;
-  if(a->wMilliseconds < b->wMilliseconds) return -1;
-  if(a->wMilliseconds > b->wMilliseconds) return  1;
+  if(*a < *b) return -1;
+  if(*a > *b) return  1;
   return 0;
 }
 
@@ -247,15 +437,65 @@ SH_DEF void sh_append_impl(Sh *sh, ...) {
   va_end(argv);
 }
 
-SH_DEF int sh_run(Sh *sh) {
+#ifndef _WIN32
+
+extern char **environ;
+
+// Splits the command line at spaces. "..." groups, \" is a literal quote.
+static char **sh_split(const char *cmd) {
+  size_t cmd_len = strlen(cmd);
+  size_t argv_cap = cmd_len / 2 + 2;
+  char **argv = malloc(argv_cap * sizeof(*argv) + cmd_len + 1);
+  if(!argv) {
+    return NULL;
+  }
+  char *out = (char *) (argv + argv_cap);
+
+  size_t argc = 0;
+  const char *p = cmd;
+  for(;;) {
+    while(*p == ' ' || *p == '\t') p++;
+    if(!*p) break;
+
+    argv[argc++] = out;
+    bool quoted = false;
+    for(;*p && (quoted || (*p != ' ' && *p != '\t'));p++) {
+      if(*p == '\\' && p[1] == '"') {
+	*out++ = '"';
+	p++;
+      } else if(*p == '"') {
+	quoted = !quoted;
+      } else {
+	*out++ = *p;
+      }
+    }
+    *out++ = 0;
+  }
+  argv[argc] = NULL;
+
+  return argv;
+}
+
+static int sh_exit_code(int status) {
+  if(WIFEXITED(status)) return WEXITSTATUS(status);
+  if(WIFSIGNALED(status)) return 128 + WTERMSIG(status);
+  return -1;
+}
+
+#endif //_WIN32
+
+// Starts the command line in 'sh' (which is zero terminated afterwards)
+static bool sh_spawn(Sh *sh, Sh_Job *job) {
 
   if(sh->len == 0) {
     sh_log(SH_ERROR, "Cannot start empty process!");
-    return -1;
+    return false;
   }
 
   sh_da_append_many(sh, "\0", 1);
   sh_log(SH_CMD, "%s", sh->items);
+
+#ifdef _WIN32
   
   STARTUPINFO si;
   memset(&si, 0, sizeof(si));
@@ -267,14 +507,650 @@ SH_DEF int sh_run(Sh *sh) {
   if(!CreateProcess(NULL, sh->items, NULL, NULL, FALSE, 0, NULL, NULL, &si, &pi)) {
     sh_log(SH_ERROR, "Cannot start process '%s': %s",
 	   sh->items, sh_last_error_cstr());
+    return false;
+  }
+
+  CloseHandle(pi.hThread);
+  job->process = pi.hProcess;
+#else
+
+  char **argv = sh_split(sh->items);
+  if(!argv || !argv[0]) {
+    free(argv);
+    sh_log(SH_ERROR, "Cannot start empty process!");
+    return false;
+  }
+
+  int error = posix_spawnp(&job->pid, argv[0], NULL, NULL, argv, environ);
+  free(argv);
+  if(error != 0) {
+    sh_log(SH_ERROR, "Cannot start process '%s': %s",
+	   sh->items, strerror(error));
+    return false;
+  }
+#endif //_WIN32
+
+  return true;
+}
+
+SH_DEF int sh_run(Sh *sh) {
+  Sh_Job job;
+  if(!sh_spawn(sh, &job)) {
     return -1;
   }
 
-  WaitForSingleObject(pi.hProcess, INFINITE);
+#ifdef _WIN32
+  WaitForSingleObject(job.process, INFINITE);
   DWORD code;
-  GetExitCodeProcess(pi.hProcess, &code);
+  GetExitCodeProcess(job.process, &code);
+  CloseHandle(job.process);
   
   return (int) code;
+#else
+  int status;
+  while(waitpid(job.pid, &status, 0) < 0) {
+    if(errno != EINTR) {
+      sh_log(SH_ERROR, "Cannot wait for process '%s': %s",
+	     sh->items, sh_last_error_cstr());
+      return -1;
+    }
+  }
+
+  return sh_exit_code(status);
+#endif //_WIN32
+}
+
+SH_DEF void sh_jobs_init(Sh_Jobs *jobs, size_t max) {
+  memset(jobs, 0, sizeof(*jobs));
+
+  if(max == 0) {
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    max = (size_t) info.dwNumberOfProcessors;
+#else
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    max = n > 0 ? (size_t) n : 1;
+#endif //_WIN32
+  }
+
+#ifdef _WIN32
+  // WaitForMultipleObjects waits for at most that many
+  if(max > MAXIMUM_WAIT_OBJECTS) max = MAXIMUM_WAIT_OBJECTS;
+#endif //_WIN32
+
+  jobs->max = max;
+}
+
+SH_DEF bool sh_jobs_start(Sh_Jobs *jobs, Sh *sh, size_t id) {
+  Sh_Job job;
+  job.id = id;
+  if(!sh_spawn(sh, &job)) {
+    if(!jobs->failed) {
+      jobs->failed = true;
+      jobs->failed_id = id;
+      jobs->failed_code = -1;
+    }
+    return false;
+  }
+
+  // For the report, 'sh' may be reused
+  job.cmd = malloc(sh->len);
+  if(job.cmd) memcpy(job.cmd, sh->items, sh->len);
+
+  sh_da_append_many(jobs, &job, 1);
+  return true;
+}
+
+SH_DEF bool sh_jobs_next(Sh_Jobs *jobs, size_t *id, int *exit_code) {
+  if(jobs->len == 0) {
+    return false;
+  }
+
+  size_t i = 0;
+  int code = -1;
+
+#ifdef _WIN32
+  HANDLE processes[MAXIMUM_WAIT_OBJECTS];
+  size_t processes_len = jobs->len < MAXIMUM_WAIT_OBJECTS ? jobs->len : MAXIMUM_WAIT_OBJECTS;
+  for(size_t j=0;j<processes_len;j++) processes[j] = jobs->items[j].process;
+
+  DWORD result = WaitForMultipleObjects((DWORD) processes_len, processes, FALSE, INFINITE);
+  if(result >= WAIT_OBJECT_0 + processes_len) {
+    sh_log(SH_ERROR, "Cannot wait for processes: %s", sh_last_error_cstr());
+    return false;
+  }
+  i = result - WAIT_OBJECT_0;
+
+  DWORD process_code;
+  if(GetExitCodeProcess(jobs->items[i].process, &process_code)) {
+    code = (int) process_code;
+  }
+  CloseHandle(jobs->items[i].process);
+#else
+  for(;;) {
+    int status;
+    pid_t pid = waitpid(-1, &status, 0);
+    if(pid < 0) {
+      if(errno == EINTR) continue;
+      sh_log(SH_ERROR, "Cannot wait for processes: %s", sh_last_error_cstr());
+      return false;
+    }
+
+    // Children, that are not jobs, are ignored
+    for(i=0;i<jobs->len && jobs->items[i].pid != pid;i++) ;
+    if(i < jobs->len) {
+      code = sh_exit_code(status);
+      break;
+    }
+  }
+#endif //_WIN32
+
+  Sh_Job *job = &jobs->items[i];
+  if(code != 0 && !jobs->failed) {
+    sh_log(SH_ERROR, "'%s' failed with exit code %d",
+	   job->cmd ? job->cmd : "?", code);
+    jobs->failed = true;
+    jobs->failed_id = job->id;
+    jobs->failed_code = code;
+  }
+
+  *id = job->id;
+  *exit_code = code;
+  free(job->cmd);
+  *job = jobs->items[--jobs->len];
+
+  return true;
+}
+
+SH_DEF bool sh_jobs_run(Sh_Jobs *jobs, Sh *sh) {
+  size_t id;
+  int exit_code;
+  while(!jobs->failed && jobs->len >= jobs->max && sh_jobs_next(jobs, &id, &exit_code)) ;
+
+  if(jobs->failed) {
+    return false;
+  }
+
+  // The index of the command, in the order they were run
+  return sh_jobs_start(jobs, sh, jobs->started++);
+}
+
+SH_DEF bool sh_jobs_wait(Sh_Jobs *jobs) {
+  size_t id;
+  int exit_code;
+  while(sh_jobs_next(jobs, &id, &exit_code)) ;
+
+  return !jobs->failed;
+}
+
+SH_DEF void sh_jobs_free(Sh_Jobs *jobs) {
+  for(size_t i=0;i<jobs->len;i++) {
+    free(jobs->items[i].cmd);
+  }
+  free(jobs->items);
+  memset(jobs, 0, sizeof(*jobs));
+}
+
+static uint64_t sh_hash_word(uint64_t h, uint64_t word) {
+  h ^= word * 0x9e3779b185ebca87ULL;
+  h = (h << 31) | (h >> 33);
+  return h * 0xc2b2ae3d27d4eb4fULL;
+}
+
+// Not cryptographic, only to notice changed content. This is not io_hash of io.h (sh.h
+// does not depend on it), so the hashes in a build database and in an Io_Cache differ.
+static bool sh_hash_file(const char *file_path, uint64_t *hash) {
+  FILE *f = fopen(file_path, "rb");
+  if(!f) {
+    return false;
+  }
+
+  static unsigned char buf[64 << 10];
+  uint64_t h = 0x27d4eb2f165667c5ULL;
+  uint64_t total = 0;
+  size_t n;
+  // Full reads are a multiple of 8, only the last one has a tail
+  while((n = fread(buf, 1, sizeof(buf), f)) > 0) {
+    size_t i = 0;
+    for(;i + 8 <= n;i+=8) {
+      uint64_t word;
+      memcpy(&word, buf + i, sizeof(word));
+      h = sh_hash_word(h, word);
+    }
+    if(i < n) {
+      uint64_t word = 0;
+      memcpy(&word, buf + i, n - i);
+      h = sh_hash_word(h, word);
+    }
+    total += n;
+  }
+  bool ok = !ferror(f);
+  fclose(f);
+
+  h = sh_hash_word(h, total);
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  *hash = h;
+  return ok;
+}
+
+static bool sh_file_size(const char *file_path, uint64_t *size) {
+#ifdef _WIN32
+  WIN32_FILE_ATTRIBUTE_DATA data;
+  if(!GetFileAttributesEx(file_path, GetFileExInfoStandard, &data)) {
+    return false;
+  }
+  *size = ((uint64_t) data.nFileSizeHigh << 32) | data.nFileSizeLow;
+#else
+  struct stat stats;
+  if(stat(file_path, &stats) < 0) {
+    return false;
+  }
+  *size = (uint64_t) stats.st_size;
+#endif //_WIN32
+  return true;
+}
+
+static char *sh_strdup(const char *cstr, size_t cstr_len) {
+  char *copy = malloc(cstr_len + 1);
+  assert(copy);
+  memcpy(copy, cstr, cstr_len);
+  copy[cstr_len] = 0;
+  return copy;
+}
+
+static void sh_build_record_free(Sh_Build_Record *r) {
+  for(size_t i=0;i<r->inputs.len;i++) {
+    free(r->inputs.items[i].path);
+  }
+  free(r->inputs.items);
+  free(r->path);
+  free(r->cmd);
+  memset(r, 0, sizeof(*r));
+}
+
+// Format:
+//   t <target>
+//   c <command line>
+//   i <size> <time> <hash> <input>
+static void sh_build_load(Sh_Build *b) {
+  FILE *f = fopen(b->db_path, "rb");
+  if(!f) {
+    return;
+  }
+
+  char *data = NULL;
+  long data_len = -1;
+  if(fseek(f, 0, SEEK_END) == 0 && (data_len = ftell(f)) >= 0 && fseek(f, 0, SEEK_SET) == 0) {
+    data = malloc((size_t) data_len + 1);
+    if(data && fread(data, 1, (size_t) data_len, f) != (size_t) data_len) {
+      free(data);
+      data = NULL;
+    }
+  }
+  fclose(f);
+  if(!data) {
+    return;
+  }
+  data[data_len] = 0;
+
+  Sh_Build_Record *r = NULL;
+  char *line = data;
+  while(*line) {
+    char *line_end = strchr(line, '\n');
+    if(!line_end) break;
+    *line_end = 0;
+
+    if(line[0] == 't' && line[1] == ' ') {
+      Sh_Build_Record record = {0};
+      record.path = sh_strdup(line + 2, line_end - line - 2);
+      sh_da_append_many(&b->records, &record, 1);
+      r = &b->records.items[b->records.len - 1];
+    } else if(r && line[0] == 'c' && line[1] == ' ') {
+      free(r->cmd);
+      r->cmd = sh_strdup(line + 2, line_end - line - 2);
+    } else if(r && line[0] == 'i' && line[1] == ' ') {
+      char *p;
+      Sh_Build_Input input;
+      input.size = strtoull(line + 2, &p, 10);
+      input.time = strtoull(p, &p, 10);
+      input.hash = strtoull(p, &p, 16);
+      if(*p == ' ') {
+	input.path = sh_strdup(p + 1, line_end - p - 1);
+	sh_da_append_many(&r->inputs, &input, 1);
+      }
+    }
+
+    line = line_end + 1;
+  }
+
+  free(data);
+}
+
+static bool sh_build_save(Sh_Build *b) {
+  char tmp_path[SH_MAX_PATH];
+  if((size_t) snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", b->db_path) >= sizeof(tmp_path)) {
+    return false;
+  }
+
+  FILE *f = fopen(tmp_path, "wb");
+  if(!f) {
+    sh_log(SH_ERROR, "Can not open '%s': %s", tmp_path, sh_last_error_cstr());
+    return false;
+  }
+
+  for(size_t i=0;i<b->records.len;i++) {
+    Sh_Build_Record *r = &b->records.items[i];
+    fprintf(f, "t %s\n", r->path);
+    if(r->cmd) fprintf(f, "c %s\n", r->cmd);
+    for(size_t j=0;j<r->inputs.len;j++) {
+      Sh_Build_Input *input = &r->inputs.items[j];
+      fprintf(f, "i %llu %llu %016llx %s\n",
+	      (unsigned long long) input->size,
+	      (unsigned long long) input->time,
+	      (unsigned long long) input->hash,
+	      input->path);
+    }
+  }
+
+  bool ok = !ferror(f);
+  ok = fclose(f) == 0 && ok;
+#ifdef _WIN32
+  ok = ok && MoveFileExA(tmp_path, b->db_path, MOVEFILE_REPLACE_EXISTING);
+#else
+  ok = ok && rename(tmp_path, b->db_path) == 0;
+#endif //_WIN32
+  if(!ok) {
+    sh_log(SH_ERROR, "Can not write '%s': %s", b->db_path, sh_last_error_cstr());
+    remove(tmp_path);
+  }
+  return ok;
+}
+
+SH_DEF void sh_build_init(Sh_Build *b, const char *db_path, Sh_Build_Mode mode) {
+  memset(b, 0, sizeof(*b));
+  b->mode = mode;
+  if(db_path) {
+    b->db_path = sh_strdup(db_path, strlen(db_path));
+    if(sh_time_get(db_path, &b->saved)) {
+      sh_build_load(b);
+    }
+  }
+}
+
+SH_DEF Sh_Target *sh_build_target(Sh_Build *b, const char *path) {
+  Sh_Target *t = calloc(1, sizeof(*t));
+  assert(t);
+  t->path = sh_strdup(path, strlen(path));
+  sh_da_append_many(b, &t, 1);
+  return t;
+}
+
+SH_DEF void sh_target_inputs_impl(Sh_Target *t, ...) {
+  va_list argv;
+  va_start(argv, t);
+
+  for(;;) {
+    char *item = va_arg(argv, char *);
+    if(!item) break;
+
+    char *copy = sh_strdup(item, strlen(item));
+    sh_da_append_many(&t->inputs, &copy, 1);
+  }
+
+  va_end(argv);
+}
+
+static Sh_Target *sh_build_find(Sh_Build *b, const char *path, size_t *index) {
+  for(size_t i=0;i<b->len;i++) {
+    if(strcmp(b->items[i]->path, path) == 0) {
+      if(index) *index = i;
+      return b->items[i];
+    }
+  }
+  return NULL;
+}
+
+static Sh_Build_Input *sh_build_record_input(Sh_Build_Record *r, const char *path) {
+  for(size_t i=0;r && i<r->inputs.len;i++) {
+    if(strcmp(r->inputs.items[i].path, path) == 0) {
+      return &r->inputs.items[i];
+    }
+  }
+  return NULL;
+}
+
+// Decides, if 't' has to be built. Collects the state of the inputs into 't->next'.
+static bool sh_build_dirty(Sh_Build *b, Sh_Target *t, bool *dirty) {
+  Sh_Build_Record *last = t->record < b->records.len ? &b->records.items[t->record] : NULL;
+
+  size_t cmd_len = t->cmd.len;
+  while(cmd_len > 0 && t->cmd.items[cmd_len - 1] == 0) cmd_len--;
+  sh_build_record_free(&t->next);
+  t->next.path = sh_strdup(t->path, strlen(t->path));
+  t->next.cmd = sh_strdup(cmd_len > 0 ? t->cmd.items : "", cmd_len);
+
+  Sh_Time target_time = 0;
+  bool target_exists = sh_time_get(t->path, &target_time);
+  *dirty = !target_exists;
+  if(!last || !last->cmd || strcmp(last->cmd, t->next.cmd) != 0) {
+    *dirty = true;
+  }
+
+  for(size_t i=0;i<t->inputs.len;i++) {
+    const char *path = t->inputs.items[i];
+
+    Sh_Target *dependency = sh_build_find(b, path, NULL);
+    if(dependency && dependency->phony) {
+      continue;
+    }
+
+    Sh_Build_Input input = {0};
+    if(!sh_time_get(path, &input.time) || !sh_file_size(path, &input.size)) {
+      sh_log(SH_ERROR, "'%s', needed by '%s', does not exist", path, t->path);
+      return false;
+    }
+
+    // Only the hashes are remembered
+    if(b->mode == SH_BUILD_TIME) {
+      if(target_exists && input.time > target_time) *dirty = true;
+      continue;
+    }
+
+    // Only read the file, if it changed since the last build. The stamps are taken before the
+    // command runs, so an input about as new as the database may have changed since.
+    Sh_Build_Input *known = sh_build_record_input(last, path);
+    if(known && known->size == input.size && known->time == input.time &&
+       input.time + SH_BUILD_RACY_NS < b->saved) {
+      input.hash = known->hash;
+    } else if(!sh_hash_file(path, &input.hash)) {
+      sh_log(SH_ERROR, "Can not read '%s': %s", path, sh_last_error_cstr());
+      return false;
+    }
+    if(!known || known->size != input.size || known->hash != input.hash) *dirty = true;
+
+    input.path = sh_strdup(path, strlen(path));
+    sh_da_append_many(&t->next.inputs, &input, 1);
+  }
+
+  return true;
+}
+
+// 't' was built, 't->next' replaces what is remembered
+static void sh_build_remember(Sh_Build *b, Sh_Target *t) {
+  if(t->record < b->records.len) {
+    sh_build_record_free(&b->records.items[t->record]);
+    b->records.items[t->record] = t->next;
+  } else {
+    t->record = b->records.len;
+    sh_da_append_many(&b->records, &t->next, 1);
+  }
+  memset(&t->next, 0, sizeof(t->next));
+}
+
+SH_DEF bool sh_build_run(Sh_Build *b, const char *goal, size_t jobs_max) {
+  bool ok = true;
+
+  for(size_t i=0;i<b->len;i++) {
+    Sh_Target *t = b->items[i];
+    t->dependents.len = 0;
+    t->pending = 0;
+    t->needed = goal == NULL;
+    t->phony = t->cmd.len == 0;
+
+    t->record = (size_t) -1;
+    for(size_t j=0;j<b->records.len;j++) {
+      if(strcmp(b->records.items[j].path, t->path) == 0) {
+	t->record = j;
+	break;
+      }
+    }
+  }
+
+  size_t *stack = malloc((b->len + 1) * sizeof(*stack));
+  assert(stack);
+  size_t stack_len = 0;
+
+  // Everything, that the goal depends on
+  if(goal) {
+    size_t index;
+    if(!sh_build_find(b, goal, &index)) {
+      sh_log(SH_ERROR, "Unknown target '%s'", goal);
+      free(stack);
+      return false;
+    }
+    b->items[index]->needed = true;
+    stack[stack_len++] = index;
+    while(stack_len > 0) {
+      Sh_Target *t = b->items[stack[--stack_len]];
+      for(size_t i=0;i<t->inputs.len;i++) {
+	Sh_Target *dependency = sh_build_find(b, t->inputs.items[i], &index);
+	if(dependency && !dependency->needed) {
+	  dependency->needed = true;
+	  stack[stack_len++] = index;
+	}
+      }
+    }
+  }
+
+  size_t needed = 0;
+  for(size_t i=0;i<b->len;i++) {
+    Sh_Target *t = b->items[i];
+    if(!t->needed) continue;
+    needed++;
+
+    for(size_t j=0;j<t->inputs.len;j++) {
+      size_t index;
+      Sh_Target *dependency = sh_build_find(b, t->inputs.items[j], &index);
+      if(dependency) {
+	sh_da_append_many(&dependency->dependents, &i, 1);
+	t->pending++;
+      }
+    }
+  }
+
+  for(size_t i=0;i<b->len;i++) {
+    if(b->items[i]->needed && b->items[i]->pending == 0) stack[stack_len++] = i;
+  }
+
+  Sh_Jobs jobs;
+  sh_jobs_init(&jobs, jobs_max);
+
+  // Pops ready targets, until the job pool is full. Whenever a job finishes, its
+  // dependents may become ready.
+  size_t done = 0;
+  for(;;) {
+    while(ok && stack_len > 0 && jobs.len < jobs.max) {
+      size_t i = stack[--stack_len];
+      Sh_Target *t = b->items[i];
+
+      bool dirty = false;
+      if(!t->phony && !sh_build_dirty(b, t, &dirty)) {
+	ok = false;
+	break;
+      }
+      if(dirty) {
+	if(!sh_jobs_start(&jobs, &t->cmd, i)) ok = false;
+	continue;
+      }
+
+      // Up to date. New times of unchanged inputs spare hashing them next time.
+      if(!t->phony) sh_build_remember(b, t);
+      done++;
+      for(size_t j=0;j<t->dependents.len;j++) {
+	size_t d = t->dependents.items[j];
+	if(--b->items[d]->pending == 0) stack[stack_len++] = d;
+      }
+    }
+
+    size_t i;
+    int exit_code;
+    if(!sh_jobs_next(&jobs, &i, &exit_code)) {
+      break;
+    }
+    Sh_Target *t = b->items[i];
+    if(exit_code != 0) {
+      // The output may be half written, it is rebuilt next time
+      if(t->record < b->records.len) {
+	free(b->records.items[t->record].cmd);
+	b->records.items[t->record].cmd = NULL;
+      }
+      ok = false;
+      continue;
+    }
+
+    sh_build_remember(b, t);
+    done++;
+    for(size_t j=0;j<t->dependents.len;j++) {
+      size_t d = t->dependents.items[j];
+      if(--b->items[d]->pending == 0) stack[stack_len++] = d;
+    }
+  }
+
+  if(ok && done < needed) {
+    for(size_t i=0;i<b->len;i++) {
+      if(b->items[i]->needed && b->items[i]->pending > 0) {
+	sh_log(SH_ERROR, "'%s' is part of a dependency cycle", b->items[i]->path);
+	break;
+      }
+    }
+    ok = false;
+  }
+
+  sh_jobs_free(&jobs);
+  free(stack);
+
+  // Even after a failure, the targets, that were built, are remembered
+  if(b->db_path && !sh_build_save(b)) {
+    ok = false;
+  }
+
+  return ok;
+}
+
+SH_DEF void sh_build_free(Sh_Build *b) {
+  for(size_t i=0;i<b->len;i++) {
+    Sh_Target *t = b->items[i];
+    for(size_t j=0;j<t->inputs.len;j++) {
+      free(t->inputs.items[j]);
+    }
+    free(t->inputs.items);
+    free(t->dependents.items);
+    free(t->cmd.items);
+    sh_build_record_free(&t->next);
+    free(t->path);
+    free(t);
+  }
+  free(b->items);
+
+  for(size_t i=0;i<b->records.len;i++) {
+    sh_build_record_free(&b->records.items[i]);
+  }
+  free(b->records.items);
+  free(b->db_path);
+  memset(b, 0, sizeof(*b));
 }
 
 #endif // SH_IMPLEMENTATION
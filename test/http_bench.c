@@ -0,0 +1,403 @@
+#define LIBSTD_IMPLEMENTATION
+#  define TYPES_ENABLE
+#  define THREAD_ENABLE
+#  define HTTP_ENABLE
+#    define HTTP_QUIET
+#include "../libstd.h"
+
+// Loopback load test for http.h
+//
+//   http_bench keep-alive [workers] [connections] [seconds] [response-size] [request-size]
+//       wrk-style: every connection sends requests back to back for 'seconds'
+//
+//   http_bench close [workers] [connections] [seconds] [response-size] [request-size]
+//       like keep-alive, but every request opens (and closes) its own connection
+//
+//   http_bench engine [workers] [requests] [response-size]
+//       submits all 'requests' at once to one Http_Engine
+//
+//   http_bench headers [iterations]
+//       parses a typical response-head from memory, without sockets
+//
+//   http_bench download [workers] [connections] [size-mb] [latency-ms]
+//       http_download of a file, that the server delays by 'latency-ms' per request. Compares
+//       1 and 'connections' connections, then interrupts a download and resumes it
+//
+// 'request-size' bytes are POSTed with every request (GET if 0). Every mode, that uses sockets,
+// reports the latency percentiles, the recv/send calls per request of the client and the
+// phases, that http.h recorded (see: http_metrics_dump).
+
+typedef struct{
+  Thread id;
+  u64 requests;
+  u64 bytes;
+  u64 errors;
+  u64 syscalls;
+}Client;
+
+static Http_Server server;
+static volatile bool running = true;
+static bool keep_alive = true;
+
+static char *response_body = NULL;
+static size_t response_size = 13;
+static char *request_body = NULL;
+static size_t request_size = 0;
+
+// Latency of every request, in ns
+static Http_Histogram latency = {0};
+
+// download-mode
+static const char *download_source = "http_bench.bin";
+static const char *download_target = "http_bench.out";
+static int download_latency_ms = 20;
+static volatile long download_fail_after = -1;
+static volatile long download_requests = 0;
+
+bool handler(Http_Server_Conn *conn, void *userdata) {
+  (void) userdata;
+
+  char *data;
+  size_t data_len;
+  while(http_next_body(&conn->request, &data, &data_len)) ;
+
+  if(strcmp(conn->request.route, "/download") == 0) {
+    thread_sleep(download_latency_ms);
+    long n = __atomic_add_fetch(&download_requests, 1, __ATOMIC_SEQ_CST);
+    if(download_fail_after >= 0 && n > download_fail_after) {
+      return http_server_respond(conn, 503, NULL, NULL, 0);
+    }
+    return http_server_respond_file(conn, 200, "ETag: \"http_bench\"\r\n", download_source);
+  }
+
+  return http_server_respond(conn, 200, "Content-Type: text/plain\r\n", response_body, response_size);
+}
+
+// One request on 'http', including the body of the response
+static bool client_request(Client *client, Http *http, u64 start) {
+  Http_Request request;
+  if(!http_request_from(http, "/", request_size > 0 ? "POST" : "GET", NULL,
+			(unsigned char *) request_body, request_size, &request)) {
+    return false;
+  }
+
+  char *data;
+  size_t data_len;
+  while(http_next_body(&request, &data, &data_len)) {
+    client->bytes += data_len;
+  }
+  if(request.state != HTTP_REQUEST_STATE_DONE) {
+    return false;
+  }
+
+  http_histogram_record(&latency, http_now_ns() - start);
+  client->requests++;
+  return true;
+}
+
+void *client_func(void *arg) {
+  Client *client = arg;
+
+  Http http;
+  if(keep_alive) {
+    if(!http_init("127.0.0.1", server.port, false, &http)) {
+      client->errors++;
+      http_free(&http);
+      return NULL;
+    }
+
+    while(running) {
+      if(!client_request(client, &http, http_now_ns())) {
+	client->errors++;
+	break;
+      }
+    }
+
+    client->syscalls += http.reads + http.writes;
+    http_free(&http);
+    return NULL;
+  }
+
+  // Without keep-alive, the connect is part of the latency
+  while(running) {
+    u64 start = http_now_ns();
+    if(!http_init("127.0.0.1", server.port, false, &http)) {
+      client->errors++;
+      http_free(&http);
+      break;
+    }
+    if(!client_request(client, &http, start)) {
+      client->errors++;
+    }
+    client->syscalls += http.reads + http.writes;
+    http_free(&http);
+  }
+
+  return NULL;
+}
+
+typedef struct{
+  u64 bytes;
+  u64 syscalls;
+}Engine_Stats;
+
+bool on_body(void *userdata, Http_Request *request, char *data, size_t data_len) {
+  (void) request;
+  (void) data;
+  ((Engine_Stats *) userdata)->bytes += data_len;
+  return true;
+}
+
+void on_done(void *userdata, Http_Request *request, bool ok) {
+  Engine_Stats *stats = userdata;
+  stats->syscalls += request->http->reads + request->http->writes;
+  if(ok) {
+    http_histogram_record(&latency, request->timings.total_ns);
+  }
+}
+
+static void print_latency(u64 requests, u64 syscalls) {
+  printf("  Latency:      p50 %.1fus, p99 %.1fus, p999 %.1fus, max %.1fus\n",
+	 (f64) http_histogram_quantile(&latency, 0.5) / 1e3,
+	 (f64) http_histogram_quantile(&latency, 0.99) / 1e3,
+	 (f64) http_histogram_quantile(&latency, 0.999) / 1e3,
+	 (f64) latency.max / 1e3);
+  printf("  Syscalls/req: %.2f (recv + send of the client)\n",
+	 requests > 0 ? (f64) syscalls / (f64) requests : 0.0);
+  printf("\n");
+  http_metrics_dump(stdout);
+}
+
+static const char response_head[] =
+  "HTTP/1.1 200 OK\r\n"
+  "Date: Mon, 19 Oct 2026 10:00:00 GMT\r\n"
+  "Server: nginx/1.24.0\r\n"
+  "Content-Type: application/json; charset=utf-8\r\n"
+  "Content-Length: 0\r\n"
+  "Connection: keep-alive\r\n"
+  "Cache-Control: private, max-age=0, must-revalidate\r\n"
+  "ETag: \"5d8c72a5edda8d6a:3239\"\r\n"
+  "Vary: Accept-Encoding, Origin\r\n"
+  "Set-Cookie: session=6f1c2a9e0b3d4e5f8a7b6c5d4e3f2a1b; Path=/; HttpOnly; Secure\r\n"
+  "Strict-Transport-Security: max-age=31536000; includeSubDomains\r\n"
+  "X-Content-Type-Options: nosniff\r\n"
+  "X-Request-Id: 0f3e6c1a-9b2d-4c8e-a1f7-5d3b2e9c6a4f\r\n"
+  "\r\n";
+
+int headers_bench(int iterations) {
+  Http http = {0};
+  Http_Request request;
+  request.http = &http;
+  request.server = false;
+
+  u64 headers = 0, bytes = 0;
+  u64 start = http_now_ns();
+  for(int i=0;i<iterations;i++) {
+    http.keep_alive = true;
+    http_request_reset(&request);
+    memcpy(request.buffer, response_head, sizeof(response_head) - 1);
+    request.buffer_pos = 0;
+    request.buffer_size = sizeof(response_head) - 1;
+
+    Http_Header header;
+    while(http_next_header(&request, &header)) {
+      headers++;
+      bytes += header.value_len;
+    }
+    if(request.state != HTTP_REQUEST_STATE_DONE) {
+      panicf("Failed to parse response-head");
+    }
+  }
+  f64 elapsed = (f64) (http_now_ns() - start) / 1e9;
+
+  printf("%d response-heads (%zu bytes, %llu headers), %.2fs\n",
+	 iterations, sizeof(response_head) - 1, (unsigned long long) headers / iterations, elapsed);
+  printf("  Heads/sec:    %.0f\n", (f64) iterations / elapsed);
+  printf("  MB/sec:       %.2f\n", (f64) iterations * (sizeof(response_head) - 1) / elapsed / 1e6);
+  printf("  ns/header:    %.1f\n", elapsed * 1e9 / (f64) headers);
+  printf("  (checksum %llu)\n", (unsigned long long) bytes);
+  return 0;
+}
+
+static bool same_files(const char *a, const char *b) {
+  FILE *f = fopen(a, "rb");
+  FILE *g = fopen(b, "rb");
+  bool same = f && g;
+  static char x[1 << 16], y[1 << 16];
+  while(same) {
+    size_t n = fread(x, 1, sizeof(x), f);
+    size_t m = fread(y, 1, sizeof(y), g);
+    same = n == m && memcmp(x, y, n) == 0;
+    if(n == 0) break;
+  }
+  if(f) fclose(f);
+  if(g) fclose(g);
+  return same;
+}
+
+static void download_run(const char *label, size_t connections, bool expect_ok) {
+  Http_Pool pool;
+  http_pool_init(&pool, connections, 10000);
+
+  Http_Download_Stats stats;
+  bool ok = http_download(&pool, "127.0.0.1", server.port, false, "/download", download_target,
+			  connections, &stats);
+  if(ok != expect_ok || (ok && !same_files(download_source, download_target))) {
+    panicf("%s: download %s", label, ok ? "differs" : "failed");
+  }
+
+  f64 elapsed = (f64) stats.elapsed_ns / 1e9;
+  printf("  %-12s %zu connections, %zu ranges, %.2fs, %.2f MB/s, %.1f MB resumed%s\n",
+	 label, stats.connections, stats.ranges, elapsed,
+	 (f64) stats.downloaded / elapsed / 1e6, (f64) stats.resumed / 1e6,
+	 ok ? "" : " (interrupted)");
+  http_pool_free(&pool);
+}
+
+int download_bench(int connections, int size_mb) {
+  FILE *f = fopen(download_source, "wb");
+  if(!f) {
+    panicf("Can not create '%s'", download_source);
+  }
+  u64 x = 88172645463325252ULL;
+  static u64 block[1 << 13];
+  for(int i=0;i<size_mb * 16;i++) {
+    for(size_t j=0;j<sizeof(block)/sizeof(*block);j++) {
+      x ^= x << 13;
+      x ^= x >> 7;
+      x ^= x << 17;
+      block[j] = x;
+    }
+    fwrite(block, sizeof(block), 1, f);
+  }
+  fclose(f);
+
+  printf("%d MB, %dms per request, %d byte ranges\n", size_mb, download_latency_ms, HTTP_DOWNLOAD_RANGE_SIZE);
+  remove(download_target);
+  download_run("sequential", 1, true);
+  remove(download_target);
+  download_run("parallel", (size_t) connections, true);
+
+  // The server fails after half of the ranges, the next call only fetches the rest
+  remove(download_target);
+  download_requests = 0;
+  download_fail_after = 1 + ((long) size_mb << 20) / HTTP_DOWNLOAD_RANGE_SIZE / 2;
+  download_run("interrupted", (size_t) connections, false);
+  download_fail_after = -1;
+  download_run("resumed", (size_t) connections, true);
+
+  remove(download_source);
+  remove(download_target);
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  const char *mode = argc > 1 ? argv[1] : "keep-alive";
+  if(strcmp(mode, "headers") == 0) {
+    return headers_bench(argc > 2 ? atoi(argv[2]) : 1000000);
+  }
+  int workers = argc > 2 ? atoi(argv[2]) : 4;
+  bool engine_mode = strcmp(mode, "engine") == 0;
+  bool download_mode = strcmp(mode, "download") == 0;
+  if(!engine_mode && !download_mode && strcmp(mode, "keep-alive") != 0 && strcmp(mode, "close") != 0) {
+    panicf("Unknown mode: '%s'", mode);
+  }
+  keep_alive = strcmp(mode, "close") != 0;
+
+  int size_arg = engine_mode ? 4 : 5;
+  if(!download_mode && argc > size_arg) response_size = (size_t) atoll(argv[size_arg]);
+  if(!engine_mode && argc > 6) request_size = (size_t) atoll(argv[6]);
+  response_body = malloc(response_size + 1);
+  request_body = malloc(request_size + 1);
+  if(!response_body || !request_body) {
+    panicf("Can not allocate the bodies");
+  }
+  memset(response_body, 'x', response_size);
+  memset(request_body, 'y', request_size);
+
+  if(!http_server_init(&server, "127.0.0.1", 0, handler, NULL)) {
+    panicf("http_server_init");
+  }
+
+  Thread worker_ids[64];
+  if(workers < 1 || workers > 64) {
+    panicf("workers must be in 1..64");
+  }
+  for(int i=0;i<workers;i++) {
+    thread_create(&worker_ids[i], http_server_worker, &server);
+  }
+
+  if(download_mode) {
+    if(argc > 5) download_latency_ms = atoi(argv[5]);
+    download_bench(argc > 3 ? atoi(argv[3]) : 8, argc > 4 ? atoi(argv[4]) : 64);
+
+  } else if(!engine_mode) {
+    int connections = argc > 3 ? atoi(argv[3]) : 16;
+    int seconds = argc > 4 ? atoi(argv[4]) : 5;
+
+    Client *clients = calloc(connections, sizeof(Client));
+    u64 start = http_now_ns();
+    for(int i=0;i<connections;i++) {
+      thread_create(&clients[i].id, client_func, &clients[i]);
+    }
+    thread_sleep(seconds * 1000);
+    running = false;
+
+    u64 requests = 0, bytes = 0, errors = 0, syscalls = 0;
+    for(int i=0;i<connections;i++) {
+      thread_join(clients[i].id);
+      requests += clients[i].requests;
+      bytes += clients[i].bytes;
+      errors += clients[i].errors;
+      syscalls += clients[i].syscalls;
+    }
+    f64 elapsed = (f64) (http_now_ns() - start) / 1e9;
+
+    printf("%d workers, %d connections (%s), %zu/%zu byte bodies, %.2fs\n",
+	   workers, connections, keep_alive ? "keep-alive" : "close",
+	   request_size, response_size, elapsed);
+    printf("  Requests/sec: %.0f\n", (f64) requests / elapsed);
+    printf("  Transfer/sec: %.2f KB (body)\n", (f64) bytes / elapsed / 1024.0);
+    printf("  Errors:       %llu\n", (unsigned long long) errors);
+    print_latency(requests, syscalls);
+    free(clients);
+
+  } else {
+    int requests = argc > 3 ? atoi(argv[3]) : 10000;
+
+    Http_Engine engine;
+    if(!http_engine_init(&engine)) {
+      panicf("http_engine_init");
+    }
+
+    Engine_Stats stats = {0};
+    u64 start = http_now_ns();
+    for(int i=0;i<requests;i++) {
+      if(!http_engine_submit(&engine, "127.0.0.1", server.port, "/", "GET", NULL, NULL, 0,
+			     on_body, on_done, &stats)) {
+	panicf("http_engine_submit: %d", i);
+      }
+    }
+    size_t in_flight = engine.active;
+    http_engine_run(&engine);
+    f64 elapsed = (f64) (http_now_ns() - start) / 1e9;
+
+    printf("%d workers, %zu requests in flight on one thread, %.2fs\n", workers, in_flight, elapsed);
+    printf("  Completed:    %llu\n", (unsigned long long) engine.completed);
+    printf("  Failed:       %llu\n", (unsigned long long) engine.failed);
+    printf("  Requests/sec: %.0f\n", (f64) engine.completed / elapsed);
+    printf("  Transfer/sec: %.2f KB (body)\n", (f64) stats.bytes / elapsed / 1024.0);
+    print_latency(engine.completed, stats.syscalls);
+    http_engine_free(&engine);
+  }
+
+  http_server_stop(&server);
+  for(int i=0;i<workers;i++) {
+    thread_join(worker_ids[i]);
+  }
+  http_server_free(&server);
+  free(response_body);
+  free(request_body);
+
+  return 0;
+}
@@ -0,0 +1,169 @@
+#define LIBSTD_IMPLEMENTATION
+#  define TYPES_ENABLE
+#  define THREAD_ENABLE
+#  define HTTP_ENABLE
+#    define HTTP_QUIET
+#include "../libstd.h"
+
+// Loopback test for keep-alive and pipelining of http.h
+//
+//   http_pipeline
+//       sends a content-length body, a HEAD, a chunked response and a chunked upload back
+//       to back on one connection, reads every response with http_request_begin/http_request_next
+//       and repeats that a few times on the same connection
+
+static Http_Server server;
+
+// Every connection, that the handler has seen
+static Http_Server_Conn *conns[16];
+static size_t conns_len = 0;
+
+static void remember(Http_Server_Conn *conn) {
+  for(size_t i=0;i<conns_len;i++) {
+    if(conns[i] == conn) return;
+  }
+  if(conns_len < sizeof(conns)/sizeof(*conns)) {
+    conns[conns_len++] = conn;
+  }
+}
+
+bool handler(Http_Server_Conn *conn, void *userdata) {
+  (void) userdata;
+  remember(conn);
+
+  // Content-Length or chunked, the request-body is echoed
+  char body[4096];
+  size_t body_len = 0;
+  char *data;
+  size_t data_len;
+  while(http_next_body(&conn->request, &data, &data_len)) {
+    if(body_len + data_len > sizeof(body)) return false;
+    memcpy(body + body_len, data, data_len);
+    body_len += data_len;
+  }
+
+  if(strcmp(conn->request.route, "/head") == 0) {
+    // The Content-Length is sent, the body is not
+    return http_server_respond(conn, 200, NULL, "0123456789", 10);
+  }
+
+  if(strcmp(conn->request.route, "/chunked") == 0) {
+    const char response[] =
+      "HTTP/1.1 200 OK\r\n"
+      "Transfer-Encoding: chunked\r\n"
+      "\r\n"
+      "5\r\nhello\r\n"
+      "1\r\n \r\n"
+      "a\r\nchunked wo\r\n"
+      "3\r\nrld\r\n"
+      "0\r\n\r\n";
+    conn->responded = true;
+    return http_server_write(response, sizeof(response) - 1, conn);
+  }
+
+  return http_server_respond(conn, 200, "Content-Type: text/plain\r\n", body, body_len);
+}
+
+typedef struct{
+  const char *label;
+  const char *body;
+  size_t content_length; // checked, if not 0
+}Expected;
+
+// Reads the body of the current response and compares it
+static void expect(Http_Request *r, Expected *e) {
+  char body[4096];
+  size_t body_len = 0;
+  char *data;
+  size_t data_len;
+  while(http_next_body(r, &data, &data_len)) {
+    if(body_len + data_len > sizeof(body)) panicf("%s: the body is too long", e->label);
+    memcpy(body + body_len, data, data_len);
+    body_len += data_len;
+  }
+
+  if(r->state != HTTP_REQUEST_STATE_DONE || r->response_code != 200) {
+    panicf("%s: failed with state %d, code %d", e->label, r->state, r->response_code);
+  }
+  if(body_len != strlen(e->body) || memcmp(body, e->body, body_len) != 0) {
+    panicf("%s: the body is '%.*s', expected '%s'", e->label, (int) body_len, body, e->body);
+  }
+  if(e->content_length > 0 && r->content_length != e->content_length) {
+    panicf("%s: the Content-Length is %zu, expected %zu", e->label, r->content_length, e->content_length);
+  }
+}
+
+int main() {
+  if(!http_server_init(&server, "127.0.0.1", 0, handler, NULL)) {
+    panicf("http_server_init");
+  }
+  Thread worker;
+  thread_create(&worker, http_server_worker, &server);
+
+  Http http;
+  if(!http_init("127.0.0.1", server.port, false, &http)) {
+    panicf("http_init");
+  }
+
+  const char content_length_body[] = "a body with a content-length";
+  Expected expected[] = {
+    { "content-length", content_length_body, 0 },
+    { "HEAD", "", 10 },
+    { "chunked response", "hello chunked world", 0 },
+    { "chunked upload", "chunked upload", 0 },
+    { "no body", "", 0 },
+  };
+  size_t expected_len = sizeof(expected)/sizeof(*expected);
+
+  char buffer[HTTP_BUFFER_SIZE];
+  for(int round=0;round<3;round++) {
+
+    // Every request is sent, before the first response is read
+    bool ok = http_request_send(&http, "/echo", "POST", NULL,
+				(const unsigned char *) content_length_body, sizeof(content_length_body) - 1,
+				buffer, sizeof(buffer));
+    ok = ok && http_request_send(&http, "/head", "HEAD", NULL, NULL, 0, buffer, sizeof(buffer));
+    ok = ok && http_request_send(&http, "/chunked", "GET", NULL, NULL, 0, buffer, sizeof(buffer));
+    ok = ok && http_request_chunked_begin(&http, "/echo", "POST", NULL, buffer, sizeof(buffer));
+    ok = ok && http_request_chunk(&http, "chunked ", 8);
+    ok = ok && http_request_chunk(&http, "upload", 6);
+    ok = ok && http_request_chunked_end(&http);
+    ok = ok && http_request_send(&http, "/echo", "GET", NULL, NULL, 0, buffer, sizeof(buffer));
+    if(!ok) {
+      panicf("Round %d: Can not send the requests", round);
+    }
+    if(http.pending != expected_len) {
+      panicf("Round %d: %zu requests are pending, expected %zu", round, (size_t) http.pending, expected_len);
+    }
+
+    Http_Request r;
+    if(!http_request_begin(&http, &r)) {
+      panicf("Round %d: http_request_begin", round);
+    }
+    for(size_t i=0;i<expected_len;i++) {
+      if(i > 0 && !http_request_next(&r)) {
+	panicf("Round %d: http_request_next before '%s'", round, expected[i].label);
+      }
+      expect(&r, &expected[i]);
+    }
+    if(http_request_next(&r)) {
+      panicf("Round %d: More responses than requests", round);
+    }
+
+    if(!http_reusable(&http)) {
+      panicf("Round %d: The connection can not be reused", round);
+    }
+  }
+
+  if(conns_len != 1) {
+    panicf("The requests arrived on %zu connections", conns_len);
+  }
+
+  printf("http_pipeline: ok\n");
+
+  http_free(&http);
+  http_server_stop(&server);
+  thread_join(worker);
+  http_server_free(&server);
+  return 0;
+}
@@ -0,0 +1,304 @@
+#define LIBSTD_IMPLEMENTATION
+#  define TYPES_ENABLE
+#  define IO_ENABLE
+#    define IO_QUIET
+#include "../libstd.h"
+
+#include <time.h>
+
+// Benchmarks for io.h
+//
+//   io_bench stream [size-mb] [work] [chunk-kb]
+//       streams a file of 'size-mb' through a callback, that hashes every byte 'work' times.
+//       Compares the disk alone, the callback alone, both in one loop (the disk idles while
+//       the callback runs) and io_stream_file/io_stream_file_pipelined, which read ahead.
+//       The pipelined runs should take about max(disk, callback) instead of their sum.
+//
+//       Before every run the file is evicted from the page cache (posix_fadvise), so the
+//       reads hit the disk, where the kernel honors it.
+//
+//   io_bench walk [files] [threads] [dir]
+//       walks 'dir' (or a generated tree of 'files' files) with readdir + stat per entry,
+//       with io_walk (d_type, getdents64) and with io_walk_parallel on 'threads' threads
+//
+//   io_bench write [lines]
+//       writes 'lines' short lines with one io_file_write each and through an Io_Writer
+//
+//   io_bench commit [files] [dir]
+//       replaces 'files' small files in 'dir' with io_write_file, io_write_file_atomic and in
+//       one Io_Commit, with and without syncing them to the disk
+
+static const char *path = "io_bench.bin";
+
+typedef struct{
+  int work;
+  u64 hash;
+  u64 bytes;
+}Consumer;
+
+static u64 now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (u64) ts.tv_sec * 1000000000ULL + (u64) ts.tv_nsec;
+}
+
+static bool consume(void *userdata, const unsigned char *buf, size_t buf_size) {
+  Consumer *c = userdata;
+  u64 hash = c->hash;
+  for(int w=0;w<c->work;w++) {
+    for(size_t i=0;i<buf_size;i++) {
+      hash = (hash ^ buf[i]) * 0x100000001b3ULL;
+    }
+  }
+  c->hash = hash;
+  c->bytes += buf_size;
+  return true;
+}
+
+static void evict() {
+  int fd = open(path, O_RDONLY);
+  if(fd >= 0) {
+    fdatasync(fd);
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    close(fd);
+  }
+}
+
+static void report(const char *label, u64 ns, u64 bytes, u64 hash) {
+  f64 s = (f64) ns / 1e9;
+  printf("  %-22s %7.3fs %9.1f MB/s  (%016llx)\n", label, s, (f64) bytes / s / 1e6, (unsigned long long) hash);
+}
+
+typedef struct{
+  u64 files, dirs, bytes;
+}Counter;
+
+static bool count_entry(void *userdata, Io_Walk_Entry *entry) {
+  Counter *c = userdata;
+  if(entry->is_dir) __atomic_add_fetch(&c->dirs, 1, __ATOMIC_RELAXED);
+  else __atomic_add_fetch(&c->files, 1, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&c->bytes, entry->path_len, __ATOMIC_RELAXED);
+  return true;
+}
+
+// How io_dir_next used to find out, if an entry is a directory
+static void walk_stat(const char *dir_path, Counter *c) {
+  DIR *dir = opendir(dir_path);
+  if(!dir) return;
+
+  struct dirent *ent;
+  char path[IO_MAX_PATH];
+  while((ent = readdir(dir)) != NULL) {
+    if(strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0) continue;
+    int len = snprintf(path, sizeof(path), "%s/%s", dir_path, ent->d_name);
+
+    struct stat stats;
+    if(lstat(path, &stats) < 0) continue;
+    bool is_dir = S_ISDIR(stats.st_mode);
+    count_entry(c, &(Io_Walk_Entry) { path, (size_t) len, ent->d_name, is_dir, 0 });
+    if(is_dir) walk_stat(path, c);
+  }
+  closedir(dir);
+}
+
+int walk_bench(int files, int threads, const char *root) {
+  bool generated = root == NULL;
+  if(generated) {
+    // 'files' files in directories of 100, 3 levels deep
+    root = "io_bench.tree";
+    char path[IO_MAX_PATH];
+    io_create_dir(root, NULL);
+    for(int i=0;i<files;i++) {
+      if(i % 100 == 0) {
+	snprintf(path, sizeof(path), "%s/%d", root, i / 10000);
+	io_create_dir(path, NULL);
+	snprintf(path, sizeof(path), "%s/%d/%d", root, i / 10000, i / 100);
+	io_create_dir(path, NULL);
+      }
+      snprintf(path, sizeof(path), "%s/%d/%d/%d.txt", root, i / 10000, i / 100, i);
+      int fd = open(path, O_CREAT | O_WRONLY, 0644);
+      if(fd < 0) panicf("Can not create '%s'", path);
+      close(fd);
+    }
+  }
+
+  printf("Walking '%s'\n", root);
+  for(int run=0;run<3;run++) {
+    const char *label = run == 0 ? "readdir + stat" : run == 1 ? "io_walk" : "io_walk_parallel";
+    Counter c = {0};
+    u64 start = now_ns();
+    if(run == 0) walk_stat(root, &c);
+    else if(run == 1) io_walk(root, count_entry, &c);
+    else io_walk_parallel(root, (size_t) threads, count_entry, &c);
+    f64 s = (f64) (now_ns() - start) / 1e9;
+    printf("  %-18s %7.3fs %10.0f entries/s  (%llu files, %llu dirs, %llu)\n", label, s,
+	   (f64) (c.files + c.dirs) / s, (unsigned long long) c.files, (unsigned long long) c.dirs,
+	   (unsigned long long) c.bytes);
+  }
+
+  if(generated) {
+    io_delete_dir(root);
+  }
+  return 0;
+}
+
+int write_bench(int lines) {
+  printf("Writing %d lines\n", lines);
+  for(int run=0;run<2;run++) {
+    Io_File f;
+    if(!io_file_open(&f, path, IO_MODE_WRITE)) panicf("Can not open '%s'", path);
+
+    u64 start = now_ns();
+    if(run == 0) {
+      char line[64];
+      for(int i=0;i<lines;i++) {
+	int len = snprintf(line, sizeof(line), "#  define LINE_%d\n", i);
+	io_file_write(&f, line, (size_t) len, 1);
+      }
+    } else {
+      Io_Writer w;
+      if(!io_writer_init(&w, &f, NULL, 0)) panicf("io_writer_init");
+      for(int i=0;i<lines;i++) {
+	io_writer_printf(&w, "#  define LINE_%d\n", i);
+      }
+      if(!io_writer_flush(&w)) panicf("io_writer_flush");
+      io_writer_free(&w);
+    }
+    f64 s = (f64) (now_ns() - start) / 1e9;
+
+    printf("  %-18s %7.3fs %12.0f lines/s  (%llu bytes)\n", run == 0 ? "io_file_write" : "io_writer", s,
+	   (f64) lines / s, (unsigned long long) f.size);
+    io_file_close(&f);
+  }
+
+  io_delete_file(path);
+  return 0;
+}
+
+int commit_bench(int files, const char *dir) {
+  io_create_dir(dir, NULL);
+  printf("Replacing %d files in '%s'\n", files, dir);
+
+  char file_path[IO_MAX_PATH];
+  char data[64];
+  for(int run=0;run<5;run++) {
+    const char *labels[] = { "io_write_file", "atomic", "atomic, durable", "commit", "commit, durable" };
+    bool durable = run == 2 || run == 4;
+
+    Io_Commit c;
+    io_commit_init(&c, durable);
+    u64 start = now_ns();
+    for(int i=0;i<files;i++) {
+      snprintf(file_path, sizeof(file_path), "%s/%d.txt", dir, i);
+      int len = snprintf(data, sizeof(data), "run %d, file %d\n", run, i);
+
+      bool ok;
+      if(run == 0) ok = io_write_file(file_path, (unsigned char *) data, (size_t) len);
+      else if(run < 3) ok = io_write_file_atomic(file_path, (unsigned char *) data, (size_t) len, durable);
+      else ok = io_commit_write(&c, file_path, (unsigned char *) data, (size_t) len);
+      if(!ok) panicf("Can not write '%s'", file_path);
+    }
+    if(run >= 3 && !io_commit_finish(&c)) panicf("io_commit_finish");
+    f64 s = (f64) (now_ns() - start) / 1e9;
+
+    printf("  %-18s %7.3fs %10.0f files/s\n", labels[run], s, (f64) files / s);
+  }
+
+  io_delete_dir(dir);
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  const char *mode = argc > 1 ? argv[1] : "stream";
+  if(strcmp(mode, "walk") == 0) {
+    return walk_bench(argc > 2 ? atoi(argv[2]) : 100000, argc > 3 ? atoi(argv[3]) : 4, argc > 4 ? argv[4] : NULL);
+  }
+  if(strcmp(mode, "commit") == 0) {
+    return commit_bench(argc > 2 ? atoi(argv[2]) : 1000, argc > 3 ? argv[3] : "io_bench.commit");
+  }
+  if(strcmp(mode, "write") == 0) {
+    return write_bench(argc > 2 ? atoi(argv[2]) : 1000000);
+  }
+  if(strcmp(mode, "stream") != 0) {
+    panicf("Unknown mode: '%s'", mode);
+  }
+
+  int size_mb = argc > 2 ? atoi(argv[2]) : 256;
+  int work = argc > 3 ? atoi(argv[3]) : 4;
+  size_t chunk = (size_t) (argc > 4 ? atoi(argv[4]) : 1024) << 10;
+
+  unsigned char *buf = malloc(8 * chunk);
+  if(!buf) {
+    panicf("Can not allocate %zu bytes", 8 * chunk);
+  }
+
+  Io_File f;
+  if(!io_file_open(&f, path, IO_MODE_WRITE)) {
+    panicf("Can not open '%s'", path);
+  }
+  u64 x = 88172645463325252ULL;
+  for(u64 written=0;written<((u64) size_mb << 20);written+=chunk) {
+    for(size_t i=0;i<chunk;i+=8) {
+      x ^= x << 13;
+      x ^= x >> 7;
+      x ^= x << 17;
+      memcpy(buf + i, &x, 8);
+    }
+    if(io_file_write(&f, buf, chunk, 1) != 1) {
+      panicf("Can not write '%s'", path);
+    }
+  }
+  io_file_close(&f);
+
+  printf("%d MB, %zu KB chunks, callback hashes every byte %d times\n", size_mb, chunk >> 10, work);
+
+  // The disk alone
+  Consumer c = {0};
+  evict();
+  u64 start = now_ns();
+  if(!io_file_open(&f, path, IO_MODE_READ)) panicf("Can not open '%s'", path);
+  size_t n;
+  while((n = io_file_read(&f, buf, 1, chunk)) > 0) c.bytes += n;
+  io_file_close(&f);
+  report("read", now_ns() - start, c.bytes, 0);
+
+  // The callback alone, on a chunk in memory
+  c = (Consumer) { .work = work };
+  start = now_ns();
+  for(u64 i=0;i<((u64) size_mb << 20);i+=chunk) consume(&c, buf, chunk);
+  report("callback", now_ns() - start, c.bytes, c.hash);
+
+  // Both in one loop, like io_stream_file used to
+  c = (Consumer) { .work = work };
+  evict();
+  start = now_ns();
+  if(!io_file_open(&f, path, IO_MODE_READ)) panicf("Can not open '%s'", path);
+  while((n = io_file_read(&f, buf, 1, chunk)) > 0) consume(&c, buf, n);
+  io_file_close(&f);
+  u64 expected = c.hash;
+  report("read + callback", now_ns() - start, c.bytes, c.hash);
+
+  c = (Consumer) { .work = work };
+  evict();
+  start = now_ns();
+  if(!io_stream_file(path, consume, buf, chunk, &c)) panicf("io_stream_file");
+  report("io_stream_file", now_ns() - start, c.bytes, c.hash);
+  if(c.hash != expected) panicf("io_stream_file: wrong hash");
+
+  size_t buffers[] = { 2, 4, 8 };
+  for(size_t i=0;i<sizeof(buffers)/sizeof(*buffers);i++) {
+    char label[64];
+    snprintf(label, sizeof(label), "pipelined, %zu buffers", buffers[i]);
+
+    c = (Consumer) { .work = work };
+    evict();
+    start = now_ns();
+    if(!io_stream_file_pipelined(path, consume, buf, chunk, buffers[i], &c)) panicf("io_stream_file_pipelined");
+    report(label, now_ns() - start, c.bytes, c.hash);
+    if(c.hash != expected) panicf("%s: wrong hash", label);
+  }
+
+  io_delete_file(path);
+  free(buf);
+  return 0;
+}
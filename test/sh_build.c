@@ -0,0 +1,212 @@
+#define LIBSTD_IMPLEMENTATION
+#  define TYPES_ENABLE
+#  define SH_ENABLE
+#include "../libstd.h"
+
+#include <time.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+// Tests for the processes, Sh_Jobs and Sh_Build of sh.h
+//
+//   sh_build
+//       builds a small graph in 'sh_build.test', with timestamps and with hashes, and
+//       checks which commands run after touching inputs, changing command lines and
+//       failing commands
+
+#define DIR "sh_build.test"
+
+static const char *db_path = DIR "/db";
+static const char *input_path = DIR "/input.txt";
+static const char *output_path = DIR "/output.txt";
+static const char *runs_path = DIR "/runs.txt";
+static const char *log_path = DIR "/log.txt";
+
+static int saved_stderr = -1;
+
+// sh_log and the children write to stderr, which is redirected to 'log_path'
+static void capture_begin() {
+  fflush(stderr);
+  saved_stderr = dup(2);
+  int fd = open(log_path, O_CREAT | O_TRUNC | O_WRONLY, 0644);
+  if(fd < 0) panicf("Can not open '%s'", log_path);
+  dup2(fd, 2);
+  close(fd);
+}
+
+static bool capture_end(const char *expected) {
+  fflush(stderr);
+  dup2(saved_stderr, 2);
+  close(saved_stderr);
+
+  char log[4096] = {0};
+  FILE *f = fopen(log_path, "rb");
+  if(!f) panicf("Can not open '%s'", log_path);
+  size_t n = fread(log, 1, sizeof(log) - 1, f);
+  log[n] = 0;
+  fclose(f);
+  return strstr(log, expected) != NULL;
+}
+
+static void write_file(const char *path, const char *content) {
+  FILE *f = fopen(path, "wb");
+  if(!f) panicf("Can not open '%s'", path);
+  fputs(content, f);
+  fclose(f);
+}
+
+// A touch, that is newer than anything, that was built so far
+static void touch(const char *path) {
+  static time_t future = 0;
+  if(future == 0) future = time(NULL) + 60;
+  struct timespec times[2] = { { future, 0 }, { future, 0 } };
+  future += 1;
+  if(utimensat(AT_FDCWD, path, times, 0) < 0) panicf("Can not touch '%s'", path);
+}
+
+static int runs() {
+  FILE *f = fopen(runs_path, "rb");
+  if(!f) return 0;
+  int lines = 0;
+  for(int c;(c = fgetc(f)) != EOF;) lines += c == '\n';
+  fclose(f);
+  return lines;
+}
+
+// Builds 'output_path' from 'input_path' with 'cmd', returns how many times the command ran
+static int build(Sh_Build_Mode mode, const char *cmd, bool expect_ok) {
+  int before = runs();
+
+  Sh_Build b;
+  sh_build_init(&b, db_path, mode);
+  Sh_Target *t = sh_build_target(&b, output_path);
+  sh_target_inputs(t, input_path);
+  sh_append(&t->cmd, "sh", "-c", cmd);
+  Sh_Target *all = sh_build_target(&b, "all");
+  sh_target_inputs(all, output_path);
+
+  capture_begin();
+  bool ok = sh_build_run(&b, NULL, 2);
+  capture_end("");
+  sh_build_free(&b);
+
+  if(ok != expect_ok) {
+    panicf("'%s' %s", cmd, ok ? "succeeded" : "failed");
+  }
+  return runs() - before;
+}
+
+static void expect_runs(const char *label, int actual, int expected) {
+  if(actual != expected) {
+    panicf("%s: the command ran %d times, expected %d", label, actual, expected);
+  }
+}
+
+static void test_split() {
+  char **argv = sh_split("  cc  \"a b\"\tc\\\"d \"e \\\"f\\\"\" \"\" ");
+  const char *expected[] = { "cc", "a b", "c\"d", "e \"f\"", "", NULL };
+  for(size_t i=0;;i++) {
+    if(!expected[i] || !argv[i]) {
+      if(expected[i] != argv[i]) panicf("sh_split: wrong argument count (%zu)", i);
+      break;
+    }
+    if(strcmp(argv[i], expected[i]) != 0) {
+      panicf("sh_split: argument %zu is '%s', expected '%s'", i, argv[i], expected[i]);
+    }
+  }
+  free(argv);
+}
+
+static void test_jobs() {
+  Sh_Jobs jobs;
+  sh_jobs_init(&jobs, 3);
+  Sh sh = {0};
+
+  capture_begin();
+  const char *cmds[] = { "true", "\"exit 3\"", "\"sleep 0.2; exit 5\"" };
+  for(size_t i=0;i<3;i++) {
+    sh.len = 0;
+    if(i == 0) sh_append(&sh, cmds[i]);
+    else sh_append(&sh, "sh", "-c", cmds[i]);
+    if(!sh_jobs_run(&jobs, &sh)) panicf("sh_jobs_run: %zu", i);
+  }
+  bool ok = sh_jobs_wait(&jobs);
+
+  // No new jobs after a failure
+  sh.len = 0;
+  sh_append(&sh, "true");
+  bool started = sh_jobs_run(&jobs, &sh);
+  bool logged = capture_end("'sh -c \"exit 3\" ' failed with exit code 3");
+
+  if(ok || started) panicf("Sh_Jobs: a failure was ignored");
+  if(jobs.failed_id != 1 || jobs.failed_code != 3) {
+    panicf("Sh_Jobs: the first failure is job %zu (%d), expected job 1 (3)", jobs.failed_id, jobs.failed_code);
+  }
+  if(!logged) panicf("Sh_Jobs: the failing command was not logged");
+
+  sh_jobs_free(&jobs);
+  free(sh.items);
+}
+
+static void test_cycle() {
+  Sh_Build b;
+  sh_build_init(&b, NULL, SH_BUILD_TIME);
+  Sh_Target *x = sh_build_target(&b, DIR "/x");
+  sh_target_inputs(x, DIR "/y");
+  sh_append(&x->cmd, "touch", DIR "/x");
+  Sh_Target *y = sh_build_target(&b, DIR "/y");
+  sh_target_inputs(y, DIR "/x");
+  sh_append(&y->cmd, "touch", DIR "/y");
+
+  capture_begin();
+  bool ok = sh_build_run(&b, NULL, 2);
+  bool logged = capture_end("part of a dependency cycle");
+  sh_build_free(&b);
+
+  if(ok || !logged) panicf("The cycle was not reported");
+}
+
+int main() {
+  mkdir(DIR, 0755);
+  remove(db_path);
+  remove(output_path);
+  remove(runs_path);
+  write_file(input_path, "input\n");
+
+  test_split();
+  test_jobs();
+  test_cycle();
+
+  const char *cmd = "\"cp " DIR "/input.txt " DIR "/output.txt && echo run >> " DIR "/runs.txt\"";
+  const char *cmd_changed = "\"cp " DIR "/input.txt " DIR "/output.txt && echo changed >> " DIR "/runs.txt\"";
+  const char *cmd_failing = "\"echo failed >> " DIR "/runs.txt; exit 1\"";
+
+  // SH_BUILD_TIME
+  expect_runs("time, first build", build(SH_BUILD_TIME, cmd, true), 1);
+  expect_runs("time, nothing changed", build(SH_BUILD_TIME, cmd, true), 0);
+  touch(input_path);
+  expect_runs("time, touched input", build(SH_BUILD_TIME, cmd, true), 1);
+  expect_runs("time, changed command", build(SH_BUILD_TIME, cmd_changed, true), 1);
+
+  // SH_BUILD_HASH: The database of the time-mode has no hashes
+  expect_runs("hash, first build", build(SH_BUILD_HASH, cmd, true), 1);
+  expect_runs("hash, nothing changed", build(SH_BUILD_HASH, cmd, true), 0);
+  touch(input_path);
+  expect_runs("hash, touched input", build(SH_BUILD_HASH, cmd, true), 0);
+  write_file(input_path, "changed\n");
+  expect_runs("hash, changed input", build(SH_BUILD_HASH, cmd, true), 1);
+  expect_runs("hash, changed command", build(SH_BUILD_HASH, cmd_changed, true), 1);
+
+  // The output of the last successful build is still there, but the failed
+  // command line replaced it
+  expect_runs("failing command", build(SH_BUILD_HASH, cmd_failing, false), 1);
+  expect_runs("after a failure", build(SH_BUILD_HASH, cmd_changed, true), 1);
+  expect_runs("after a failure, nothing changed", build(SH_BUILD_HASH, cmd_changed, true), 0);
+
+  printf("sh_build: ok\n");
+
+  const char *files[] = { db_path, input_path, output_path, runs_path, log_path, DIR "/x", DIR "/y" };
+  for(size_t i=0;i<sizeof(files)/sizeof(*files);i++) remove(files[i]);
+  rmdir(DIR);
+  return 0;
+}
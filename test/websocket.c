@@ -0,0 +1,159 @@
+#define LIBSTD_IMPLEMENTATION
+#  define TYPES_ENABLE
+#  define THREAD_ENABLE
+#  define _MINIZ_ENABLE
+#    define MINIZ_IMPLEMENTATION
+#  define HTTP_ENABLE
+#    define HTTP_QUIET
+#    define HTTP_MINIZ
+#include "../libstd.h"
+
+// Loopback echo test for the WebSockets of http.h
+//
+//   websocket
+//       starts an echo-server and sends text, binary, fragmented and compressed
+//       messages, pings and a close through it
+
+static Http_Server server;
+
+bool handler(Http_Server_Conn *conn, void *userdata) {
+  (void) userdata;
+
+  Http_Websocket ws;
+  if(!http_websocket_accept(conn, NULL, &ws)) {
+    return true;
+  }
+
+  int opcode;
+  char *data;
+  size_t data_len;
+  while(http_websocket_read(&ws, &opcode, &data, &data_len)) {
+    if(!http_websocket_send(&ws, opcode, data, data_len)) {
+      break;
+    }
+  }
+
+  http_websocket_free(&ws);
+  return true;
+}
+
+static void expect_echo(Http_Websocket *ws, int opcode, const char *data, size_t data_len) {
+  int echo_opcode;
+  char *echo;
+  size_t echo_len;
+  if(!http_websocket_read(ws, &echo_opcode, &echo, &echo_len)) {
+    panicf("No echo for a message of %zu bytes", data_len);
+  }
+  if(echo_opcode != opcode || echo_len != data_len || memcmp(echo, data, data_len) != 0) {
+    panicf("Wrong echo for a message of %zu bytes", data_len);
+  }
+}
+
+static void test_primitives() {
+  unsigned char digest[20];
+  char hex[41];
+  http_sha1("abc", 3, digest);
+  for(int i=0;i<20;i++) snprintf(hex + 2 * i, 3, "%02x", digest[i]);
+  if(strcmp(hex, "a9993e364706816aba3e25717850c26c9cd0d89d") != 0) {
+    panicf("sha1: %s", hex);
+  }
+
+  // RFC 6455 1.3
+  char accept[32];
+  http_sha1("dGhlIHNhbXBsZSBub25jZQ==258EAFA5-E914-47DA-95CA-C5AB0DC85B11", 60, digest);
+  http_base64_encode(digest, sizeof(digest), accept);
+  if(strcmp(accept, "s3pPLMBiTxaQ9kYGzzhZRbK+xOo=") != 0) {
+    panicf("accept-key: %s", accept);
+  }
+
+  // The vectorized mask has to match the bytewise one, for every length and offset
+  unsigned char mask[4] = { 0x12, 0x9a, 0x5c, 0xf0 };
+  char data[100], expected[100];
+  for(size_t len=0;len<sizeof(data);len++) {
+    for(size_t offset=0;offset<4;offset++) {
+      for(size_t i=0;i<len;i++) {
+	data[i] = (char) (i * 7);
+	expected[i] = data[i] ^ (char) mask[(offset + i) & 3];
+      }
+      http_websocket_mask(data, len, mask, offset);
+      if(memcmp(data, expected, len) != 0) {
+	panicf("mask: len %zu, offset %zu", len, offset);
+      }
+    }
+  }
+}
+
+int main() {
+  test_primitives();
+
+  if(!http_server_init(&server, "127.0.0.1", 0, handler, NULL)) {
+    panicf("http_server_init");
+  }
+  Thread worker;
+  thread_create(&worker, http_server_worker, &server);
+
+  Http http;
+  if(!http_init("127.0.0.1", server.port, false, &http)) {
+    panicf("http_init");
+  }
+  Http_Websocket ws;
+  if(!http_websocket_connect(&http, "/echo", NULL, &ws)) {
+    panicf("http_websocket_connect");
+  }
+  if(!ws.deflate) {
+    panicf("permessage-deflate was not negotiated");
+  }
+
+  const char hello[] = "Hello, WebSocket!";
+  http_websocket_send(&ws, HTTP_WEBSOCKET_TEXT, hello, sizeof(hello) - 1);
+  expect_echo(&ws, HTTP_WEBSOCKET_TEXT, hello, sizeof(hello) - 1);
+
+  http_websocket_send(&ws, HTTP_WEBSOCKET_BINARY, NULL, 0);
+  expect_echo(&ws, HTTP_WEBSOCKET_BINARY, NULL, 0);
+
+  // 126 and 127 need the extended lengths. The text compresses, the noise does not.
+  size_t sizes[] = { 125, 126, 65535, 65536, 1 << 20 };
+  char *text = malloc(1 << 20);
+  char *noise = malloc(1 << 20);
+  u64 x = 88172645463325252ULL;
+  for(size_t i=0;i<(1 << 20);i++) {
+    text[i] = "the quick brown fox jumps over the lazy dog "[i % 44];
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    noise[i] = (char) x;
+  }
+  for(size_t i=0;i<sizeof(sizes)/sizeof(*sizes);i++) {
+    http_websocket_send(&ws, HTTP_WEBSOCKET_TEXT, text, sizes[i]);
+    expect_echo(&ws, HTTP_WEBSOCKET_TEXT, text, sizes[i]);
+    http_websocket_send(&ws, HTTP_WEBSOCKET_BINARY, noise, sizes[i]);
+    expect_echo(&ws, HTTP_WEBSOCKET_BINARY, noise, sizes[i]);
+  }
+
+  // A fragmented message with a ping in between, which is answered by the server
+  http_websocket_send_frame(&ws, HTTP_WEBSOCKET_BINARY, false, noise, 1000);
+  http_websocket_send_frame(&ws, HTTP_WEBSOCKET_PING, true, "ping", 4);
+  http_websocket_send_frame(&ws, HTTP_WEBSOCKET_CONTINUATION, false, noise + 1000, 0);
+  http_websocket_send_frame(&ws, HTTP_WEBSOCKET_CONTINUATION, true, noise + 1000, 20000);
+  expect_echo(&ws, HTTP_WEBSOCKET_BINARY, noise, 21000);
+
+  http_websocket_close(&ws, 1000);
+  int opcode;
+  char *data;
+  size_t data_len;
+  if(http_websocket_read(&ws, &opcode, &data, &data_len) || ws.close_code != 1000) {
+    panicf("Close was not echoed (%u)", ws.close_code);
+  }
+
+  printf("websocket: ok\n");
+
+  http_websocket_free(&ws);
+  http_free(&http);
+  free(text);
+  free(noise);
+
+  http_server_stop(&server);
+  thread_join(worker);
+  http_server_free(&server);
+  return 0;
+}